@@ -0,0 +1,44 @@
+#!/usr/bin/env bash
+#
+# Compares the syscalls of the epoll and io_uring event loop backends.
+#
+# GCFFlasher runs in connect mode (-c) on a FIFO which stands in for the
+# serial port. A writer sends small frames with a short pause, so that every
+# frame wakes the loop like the responses of a real device. The FIFO also
+# loops back the status request connect mode sends, one extra frame.
+#
+# usage: ./bench_io.sh [GCFFlasher executable] [frames]
+
+set -e
+
+BIN=${1:-build/GCFFlasher}
+FRAMES=${2:-1000}
+DIR=$(mktemp -d)
+FIFO="$DIR/tty"
+
+trap 'rm -fr "$DIR"' EXIT
+
+mkfifo "$FIFO"
+
+# valid frame: payload 01 .. 08, crc 0xFFDC
+FRAME='\xc0\x01\x02\x03\x04\x05\x06\x07\x08\xdc\xff\xc0'
+
+for io in poll uring; do
+    "$BIN" -c -d "$FIFO" --io "$io" --io-stats > "$DIR/$io.log" 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    exec 3> "$FIFO"
+    for i in $(seq "$FRAMES"); do
+        printf "$FRAME" >&3
+        sleep 0.001
+    done
+    exec 3>&-
+
+    sleep 0.5
+    kill -INT $pid
+    wait $pid || true
+
+    echo "$io: $(grep -c packet "$DIR/$io.log") frames received"
+    grep "^io:" "$DIR/$io.log"
+done
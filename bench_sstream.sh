@@ -0,0 +1,93 @@
+#!/usr/bin/env bash
+#
+# Compares the number formatting of u_sstream.c with an older revision
+# and snprintf().
+#
+# The same benchmark is compiled against both u_sstream.c versions, the
+# old one is taken from git. Numbers are typical progress and metrics
+# values: counters, byte sizes, timestamps and doubles with a few
+# fractional digits.
+#
+# usage: ./bench_sstream.sh [old git revision] [iterations]
+
+set -e
+
+OLD=${1:-$(git rev-list --max-parents=0 HEAD)}
+ITER=${2:-2000000}
+CC=${CC:-cc}
+DIR=$(mktemp -d)
+
+trap 'rm -fr "$DIR"' EXIT
+
+cat > "$DIR/bench.c" <<'CEOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "u_sstream.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    long i;
+    long n;
+    double t;
+    unsigned long sum;
+    char buf[64];
+    U_SStream ss;
+    static long long ints[1024];
+    static double dbls[1024];
+
+    n = atol(argv[1]);
+    srand(1);
+    for (i = 0; i < 1024; i++)
+    {
+        ints[i] = (long long)rand() * (i & 1 ? 1 : rand()) - (i & 4 ? 0 : 50000);
+        dbls[i] = (rand() % 1000000) / (double)(1 + rand() % 1000);
+    }
+
+    sum = 0;
+    t = now();
+    for (i = 0; i < n; i++)
+    {
+        U_sstream_init(&ss, buf, sizeof(buf));
+        U_sstream_put_longlong(&ss, ints[i & 1023]);
+        sum += ss.pos;
+    }
+    printf("%-10s integer  %6.1f ns", argv[2], (now() - t) * 1e9 / n);
+
+    t = now();
+    for (i = 0; i < n; i++)
+        sum += snprintf(buf, sizeof(buf), "%lld", ints[i & 1023]);
+    printf("   snprintf %6.1f ns\n", (now() - t) * 1e9 / n);
+
+    t = now();
+    for (i = 0; i < n; i++)
+    {
+        U_sstream_init(&ss, buf, sizeof(buf));
+        U_sstream_put_double(&ss, dbls[i & 1023], 6);
+        sum += ss.pos;
+    }
+    printf("%-10s double   %6.1f ns", argv[2], (now() - t) * 1e9 / n);
+
+    t = now();
+    for (i = 0; i < n; i++)
+        sum += snprintf(buf, sizeof(buf), "%.17g", dbls[i & 1023]);
+    printf("   snprintf %6.1f ns  (%lu)\n", (now() - t) * 1e9 / n, sum & 1);
+
+    return 0;
+}
+CEOF
+
+git show "$OLD:u_sstream.c" > "$DIR/u_sstream_old.c"
+
+$CC -O2 -I. "$DIR/bench.c" "$DIR/u_sstream_old.c" -o "$DIR/bench_old"
+$CC -O2 -I. "$DIR/bench.c" u_sstream.c -o "$DIR/bench_new"
+
+"$DIR/bench_old" "$ITER" old
+"$DIR/bench_new" "$ITER" current
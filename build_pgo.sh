@@ -0,0 +1,104 @@
+#!/usr/bin/env bash
+#
+# Builds a profile guided (PGO) and link time optimized (LTO) GCFFlasher.
+#
+# 1. instrumented build, GCF_PGO=GENERATE
+# 2. training run: pack, --dry-run uploads against the V1 and V3 bootloader
+#    models (frame encoding, decoding and the upload state machine), -l
+# 3. rebuild in the same directory with GCF_PGO=USE and GCF_LTO=ON
+# 4. CPU time of pack and the --dry-run uploads (codec and state machine)
+#    compared with a plain Release build
+#
+# usage: ./build_pgo.sh [benchmark runs]
+#
+# The optimized executable is build_pgo/pgo/GCFFlasher.
+
+set -e
+
+RUNS=${1:-20}
+JOBS=$(nproc 2>/dev/null || echo 2)
+SRC=$(cd "$(dirname "$0")" && pwd)
+OUT="$SRC/build_pgo"
+DATA="$OUT/data"
+PROFILE="$OUT/pgo/profile"
+
+rm -fr "$OUT"
+mkdir -p "$DATA"
+
+# firmware like input: random code followed by erased flash
+head -c 196608 /dev/urandom > "$DATA/code.bin"
+head -c 49152 /dev/zero | tr '\0' '\377' > "$DATA/erased.bin"
+cat "$DATA/code.bin" "$DATA/erased.bin" > "$DATA/app.bin"
+head -c 131072 "$DATA/app.bin" > "$DATA/app_small.bin"
+
+# the workload, also used for the benchmark
+pack()
+{
+    local bin=$1
+
+    "$bin" pack -o "$DATA/cb2_0x26780700.gcf" -t 1 -a 0x5000 "$DATA/app.bin"
+    "$bin" pack -o "$DATA/cb1_0x26390500.gcf" -t 1 -a 0 "$DATA/app_small.bin"
+    "$bin" pack -o "$DATA/rb2_0x26780700.gcf" -t 30 -a 0x5000 "$DATA/app.bin"
+    "$bin" pack -o "$DATA/hive_0x26780700.gcf" -x 0xDEC0DE03 -a 0x8000 \
+        "$DATA/code.bin,1,0x5000" "$DATA/erased.bin,2,0x40000"
+}
+
+upload()
+{
+    local bin=$1
+
+    "$bin" --dry-run -f "$DATA/cb2_0x26780700.gcf"
+    "$bin" --dry-run -f "$DATA/cb1_0x26390500.gcf"
+    "$bin" --dry-run -f "$DATA/rb2_0x26780700.gcf"
+    "$bin" --dry-run --rtt 20 -f "$DATA/hive_0x26780700.gcf"
+}
+
+workload()
+{
+    pack "$1"
+    upload "$1"
+    "$1" -l || true
+}
+
+# prints user and sys CPU time of RUNS iterations of function $1
+benchmark()
+{
+    local bin=$2
+    local i
+
+    TIMEFORMAT="%3U s user, %3S s sys"
+    time (for i in $(seq "$RUNS"); do $1 "$bin" > /dev/null 2>&1; done)
+}
+
+# configure and build in directory $1 with the options $2 ..,
+# like build_cmake.sh, cmake -S/-B and --build -j need CMake 3.12+
+build()
+{
+    local dir=$1
+
+    shift
+    mkdir -p "$dir"
+    (cd "$dir" && cmake "$@" "$SRC" && cmake --build . -- -j"$JOBS")
+}
+
+build "$OUT/pgo" -DCMAKE_BUILD_TYPE=Release -DGCF_PGO=GENERATE
+
+echo "training ..."
+workload "$OUT/pgo/GCFFlasher" > "$OUT/training.log" 2>&1
+
+if ls "$PROFILE"/*.profraw > /dev/null 2>&1; then
+    # clang writes raw profiles which need to be merged
+    llvm-profdata merge -o "$PROFILE/default.profdata" "$PROFILE"/*.profraw
+fi
+
+(cd "$OUT/pgo" && cmake --build . --target clean)
+build "$OUT/pgo" -DGCF_PGO=USE -DGCF_LTO=ON
+
+build "$OUT/release" -DCMAKE_BUILD_TYPE=Release
+
+echo
+echo "CPU time of $RUNS runs"
+for task in pack upload; do
+    echo -n "$task release:   "; benchmark $task "$OUT/release/GCFFlasher"
+    echo -n "$task pgo + lto: "; benchmark $task "$OUT/pgo/GCFFlasher"
+done
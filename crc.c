@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#include "crc.h"
+
+static unsigned char crc8Table[256];
+static unsigned long crc32Table[256];
+static int crcTablesValid;
+
+static void crcInitTables(void)
+{
+    unsigned i;
+    unsigned bit;
+    unsigned char c8;
+    unsigned long c32;
+
+    for (i = 0; i < 256; i++)
+    {
+        c8 = (unsigned char)i;
+        c32 = i;
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            c8 = (c8 & 1) ? (unsigned char)((c8 >> 1) ^ 0x8C) : (unsigned char)(c8 >> 1);
+            c32 = (c32 & 1) ? (c32 >> 1) ^ 0xEDB88320UL : (c32 >> 1);
+        }
+
+        crc8Table[i] = c8;
+        crc32Table[i] = c32;
+    }
+
+    crcTablesValid = 1;
+}
+
+unsigned char CRC_Dallas8(unsigned char crc, const unsigned char *data, unsigned long len)
+{
+    if (!crcTablesValid)
+        crcInitTables();
+
+    for (; len; len--, data++)
+        crc = crc8Table[crc ^ *data];
+
+    return crc;
+}
+
+unsigned long CRC_Crc32(unsigned long crc, const unsigned char *data, unsigned long len)
+{
+    if (!crcTablesValid)
+        crcInitTables();
+
+    crc = ~crc & 0xFFFFFFFFUL;
+
+    for (; len; len--, data++)
+        crc = crc32Table[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+
+    return ~crc & 0xFFFFFFFFUL;
+}
+
+/* GF(2) matrix helpers to apply len2 zero bytes to a CRC in O(log(len2)),
+   same approach as zlib crc32_combine() but for any reflected CRC up to 32-bit.
+ */
+static unsigned long crcMatrixTimes(const unsigned long *mat, unsigned long vec)
+{
+    unsigned long sum;
+
+    for (sum = 0; vec; vec >>= 1, mat++)
+    {
+        if (vec & 1)
+            sum ^= *mat;
+    }
+
+    return sum;
+}
+
+static void crcMatrixSquare(unsigned long *square, const unsigned long *mat, unsigned width)
+{
+    unsigned n;
+
+    for (n = 0; n < width; n++)
+        square[n] = crcMatrixTimes(mat, mat[n]);
+}
+
+static unsigned long crcCombine(unsigned long crc1, unsigned long crc2, unsigned long len2,
+                                unsigned long poly, unsigned width)
+{
+    unsigned n;
+    unsigned long row;
+    unsigned long even[32]; /* even power of two zeros operator */
+    unsigned long odd[32];  /* odd power of two zeros operator */
+
+    if (len2 == 0)
+        return crc1;
+
+    /* operator for one zero bit */
+    odd[0] = poly;
+    for (n = 1, row = 1; n < width; n++, row <<= 1)
+        odd[n] = row;
+
+    crcMatrixSquare(even, odd, width); /* two zero bits */
+    crcMatrixSquare(odd, even, width); /* four zero bits */
+
+    for (;;)
+    {
+        crcMatrixSquare(even, odd, width);
+        if (len2 & 1)
+            crc1 = crcMatrixTimes(even, crc1);
+        len2 >>= 1;
+
+        if (len2 == 0)
+            break;
+
+        crcMatrixSquare(odd, even, width);
+        if (len2 & 1)
+            crc1 = crcMatrixTimes(odd, crc1);
+        len2 >>= 1;
+
+        if (len2 == 0)
+            break;
+    }
+
+    return crc1 ^ crc2;
+}
+
+unsigned char CRC_Dallas8Combine(unsigned char crc1, unsigned char crc2, unsigned long len2)
+{
+    return (unsigned char)crcCombine(crc1, crc2, len2, 0x8C, 8);
+}
+
+unsigned long CRC_Crc32Combine(unsigned long crc1, unsigned long crc2, unsigned long len2)
+{
+    return crcCombine(crc1, crc2, len2, 0xEDB88320UL, 32) & 0xFFFFFFFFUL;
+}
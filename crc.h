@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+/* Table driven checksums used by the GCF file format.
+
+   The functions can be called incrementally, the initial value for
+   CRC_Dallas8() is 0 and for CRC_Crc32() it's 0 as well, the pre and
+   post inversion of CRC-32 is handled internally.
+ */
+
+/*! Dallas/Maxim CRC-8 (polynomial 0x31 reflected). */
+unsigned char CRC_Dallas8(unsigned char crc, const unsigned char *data, unsigned long len);
+
+/*! CRC-32 as used by zlib/Ethernet (polynomial 0x04C11DB7 reflected). */
+unsigned long CRC_Crc32(unsigned long crc, const unsigned char *data, unsigned long len);
+
+/*! Returns the checksum of A || B given the checksums of A and B and length of B.
+
+    This allows to checksum a file whose header is patched after the data
+    was already written, without reading the data a second time.
+ */
+unsigned char CRC_Dallas8Combine(unsigned char crc1, unsigned char crc2, unsigned long len2);
+unsigned long CRC_Crc32Combine(unsigned long crc1, unsigned long crc2, unsigned long len2);
+
+#endif /* CRC_H */
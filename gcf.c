@@ -21,14 +21,35 @@
 #include "u_bstream.h"
 #include "u_strlen.h"
 #include "u_mem.h"
+#include "u_arena.h"
 #include "buffer_helper.h"
+#include "crc.h"
 #include "gcf.h"
+#include "net.h"
+#include "pack.h"
 #include "protocol.h"
+#include "rec.h"
+#include "sim.h"
 
 #define UI_MAX_LINE_LENGTH 255
 #define UI_MAX_LINES 32
+#define UI_FRAME_US 100000  /* progress redraw interval on a terminal */
+#define UI_PLAIN_US 2000000 /* progress line interval if stdout isn't a terminal */
 
-#define MAX_DEVICES 4
+/* states of a progress row */
+typedef enum
+{
+    UI_STATE_PENDING,
+    UI_STATE_UPLOAD,
+    UI_STATE_VERIFY,
+    UI_STATE_DONE,
+    UI_STATE_FAILED,
+    UI_STATE_RETRY
+} UI_State;
+
+#define MAX_DEVICES 64 /* test stations with many sticks */
+#define GCF_MAX_IMAGES 8 /* -f arguments flashed in sequence */
+#define UI_MAX_ROWS GCF_MAX_IMAGES
 
 #define GCF_HEADER_SIZE 14
 #define GCF_MAGIC 0xCAFEFEED
@@ -50,9 +71,37 @@
 #define BTL_FW_DATA_REQUEST    0x04
 #define BTL_FW_DATA_RESPONSE   0x84
 
+#define BTL_DATA_RESPONSE_HEADER 9 /* magic, command, status, u32 offset, u16 length */
+#define BTL_MAX_DATA_LENGTH 1024   /* largest data request which is served */
+
 /* Bootloader V1 */
 #define V1_PAGESIZE 256
 
+/* Reopening the port after the device re-enumerated (ConBee II/III) */
+#define BTL_CONNECT_DELAY 500   /* ms, first attempt when no reconnect time is known */
+#define BTL_CONNECT_EARLY 20000 /* us, first attempt ahead of the measured reconnect time */
+#define BTL_CONNECT_POLL  50    /* ms, retry interval */
+#define BTL_CONNECT_MAX   10000 /* ms, give up and start over via gcfRetry() */
+
+#define PORT_HANDOFF_WAIT 10000 /* ms, --handoff without --wait */
+
+#define BAUDRATE_PROBE_WINDOW 150 /* ms for the response at one candidate rate */
+#define BAUDRATE_CACHE "baudrates" /* <serial or path> <rate> per line in the cache directory */
+
+/* --selftest, frames are echoed by a loopback-wired adapter or a pty pair */
+#define SELFTEST_MAGIC 0x5A
+#define SELFTEST_HEADER 4 /* magic, phase, u16 sequence number */
+#define SELFTEST_MAX_PAYLOAD (PROT_MAX_FRAME_SIZE - 2)
+#define SELFTEST_PING_LENGTH 16
+#define SELFTEST_ROUNDS 200 /* latency phase, one frame in flight */
+#define SELFTEST_DURATION 3000 /* ms, throughput phase */
+#define SELFTEST_WINDOW 4 /* frames in flight during the throughput phase, < 2 kB on the wire */
+#define SELFTEST_RX_TIMEOUT 1000 /* ms without echo ends the test */
+#define SELFTEST_MAX_RTT 50 /* ms, default p99 round trip limit */
+#define SELFTEST_MIN_RATE 70 /* %, default throughput limit relative to the line rate */
+#define SELFTEST_PHASE_LATENCY 1
+#define SELFTEST_PHASE_THROUGHPUT 2
+
 typedef void (*state_handler_t)(GCF*, Event);
 
 typedef enum
@@ -62,6 +111,9 @@ typedef enum
     T_PROGRAM,
     T_LIST,
     T_CONNECT,
+    T_PROXY,
+    T_PACK,
+    T_SELFTEST,
     T_HELP
 } Task;
 
@@ -72,9 +124,46 @@ typedef enum
     DEV_RASPBEE_2,
     DEV_CONBEE_1,
     DEV_CONBEE_2,
+    DEV_CONBEE_3,
     DEV_HIVE
 } DeviceType;
 
+/* Fallback when the UART reset command doesn't work */
+typedef enum
+{
+    GCF_RESET_UART, /* none, the UART command only */
+    GCF_RESET_FTDI, /* FTDI CBUS0 */
+    GCF_RESET_GPIO  /* RaspBee GPIO17 */
+} GCF_ResetMethod;
+
+/* Device properties known from the USB identity */
+typedef struct
+{
+    unsigned short vendorId;
+    unsigned short productId;
+    const char *model; /* prefix of the product name, 0 = any */
+    DeviceType devType;
+    PL_Baudrate baudrate;
+    GCF_ResetMethod reset;
+    unsigned char bootloader; /* 1 = V1 (ASCII), 3 = V3 (BTL_MAGIC frames), 0 = from GCF file type */
+    unsigned short txBurst; /* --pace: bytes the device takes at once */
+    unsigned char txPacket; /* --pace: USB bulk packet size writes are aligned to */
+} GCF_DeviceProfile;
+
+/* Entries with the same vendor and product id are tried in order, the
+   generic one without model comes last. */
+static const GCF_DeviceProfile gcfDeviceProfiles[] =
+{
+    { 0x1cf1, 0x0030, 0,            DEV_CONBEE_2, PL_BAUDRATE_115200, GCF_RESET_UART, 1, 128, 64 }, /* CDC ACM */
+    { 0x0403, 0x6015, "ConBee III", DEV_CONBEE_3, PL_BAUDRATE_115200, GCF_RESET_FTDI, 0, 512, 64 },
+    { 0x0403, 0x6015, 0,            DEV_CONBEE_1, PL_BAUDRATE_38400,  GCF_RESET_FTDI, 0, 512, 64 }, /* FT230X Basic UART, also other FTDI adapters */
+    { 0x1a86, 0x7523, 0,            DEV_HIVE,     PL_BAUDRATE_115200, GCF_RESET_UART, 3, 32,  32 }  /* CH340 */
+};
+
+#define PACE_BURST 64 /* --pace without device profile, RaspBee UART */
+
+#define GCF_PROFILE_HASH_BITS 4 /* 16 slots, keep less than half full */
+
 typedef struct GCF_File_t
 {
     char fname[MAX_DEV_PATH_LENGTH];
@@ -89,59 +178,195 @@ typedef struct GCF_File_t
     unsigned char gcfCrc;
     unsigned long gcfCrc32;
 
-    unsigned char fcontent[MAX_GCF_FILE_SIZE];
+    unsigned char *fcontent; /* fsize bytes in the session arena */
+    unsigned long fcontentSize; /* bytes at fcontent, only the start of the file with --stream */
 } GCF_File;
 
+#define STREAM_CACHE_SIZE (4 * BTL_MAX_DATA_LENGTH) /* 16 V1 pages or 4 of the largest V3 chunks */
+
+/* --stream: image data is read from the file on demand through a read-ahead cache */
+typedef struct
+{
+    int file; /* PL_OpenFile() handle, -1 = closed */
+    unsigned long offset; /* file offset of buf[0] */
+    unsigned long len; /* valid bytes in buf */
+    unsigned long reads;
+    unsigned long long readBytes;
+    unsigned char buf[STREAM_CACHE_SIZE];
+} GCF_Stream;
+
+/* -f argument, the path is the local file, e.g. the cache of an URL */
+typedef struct
+{
+    char fname[MAX_DEV_PATH_LENGTH];
+    char path[MAX_DEV_PATH_LENGTH];
+} GCF_Image;
+
+/* Progress of one -f image */
+typedef struct
+{
+    UI_State state;
+    unsigned long done; /* bytes */
+    unsigned long total;
+    unsigned retries;
+    PL_time_t startUs; /* upload start, for the rate */
+    PL_time_t endUs; /* last chunk sent, 0 = uploading */
+} UI_Row;
+
 typedef struct UI_Line
 {
     unsigned length;
     char buf[UI_MAX_LINE_LENGTH];
 } UI_Line;
 
-/* The GCF struct holds the complete state as well as GCF file data. */
+#if defined(__GNUC__) || defined(__clang__)
+  #define GCF_CACHE_ALIGN __attribute__((aligned(64)))
+#else
+  #define GCF_CACHE_ALIGN
+#endif
+
+/* Session arena: UI lines, device table, frame buffers and the firmware file.
+   Allocations are sized to what the session uses, untouched pages of the
+   static block cost no memory. */
+#define GCF_ARENA_SIZE (MAX_GCF_FILE_SIZE + MAX_DEVICES * sizeof(Device) + 64 * 1024)
+
+typedef struct
+{
+    unsigned phase; /* SELFTEST_PHASE_* */
+    unsigned txSeq; /* frames sent in the phase */
+    unsigned rxSeq; /* next expected echo */
+    unsigned long frames; /* valid echos of both phases */
+    unsigned long lost;
+    unsigned long corrupt;
+    unsigned long long wireBytes; /* throughput phase, incl. escaping and framing */
+    PL_time_t startUs;
+    PL_time_t endUs;
+    PL_time_t sentUs; /* latency phase: send time of the frame in flight */
+    unsigned rttCount;
+    unsigned long rtt[SELFTEST_ROUNDS]; /* microseconds */
+    unsigned char frame[SELFTEST_MAX_PAYLOAD];
+} GCF_Selftest;
+
+/* The GCF struct holds the session state.
+
+   Fields used for every event and received byte come first and share a few
+   cache lines, bulk buffers are allocated from the session arena.
+ */
 typedef struct GCF_t
 {
-    int argc;
-    char **argv;
-    unsigned wp;     /* ascii[] write pointer */
-    char ascii[512]; /* buffer for raw data */
+    /* hot: state machine and receive path */
     state_handler_t state;
     state_handler_t substate;
-
-    /* UI line buffering */
-    unsigned uiCurrentLine;
-    UI_Line uiLines[UI_MAX_LINES];
-
+    Task task;
     int retry;
-
     unsigned remaining; /* remaining bytes during upload */
+    unsigned rxPort; /* port of the data currently being decoded, 0 = primary device */
+    unsigned wp;     /* ascii[] write pointer */
+    unsigned rxFrameLen;
+    const unsigned char *rxFrame; /* bootloader frame in the decoder buffer, only valid during EV_RX_BTL_PKG_DATA */
+    unsigned char *txFrame; /* bootloader response, BTL_DATA_RESPONSE_HEADER + BTL_MAX_DATA_LENGTH */
+    PROT_RxState rxstate;
+    char ascii[512]; /* buffer for raw data */
 
-    Task task;
+    /* cold: options, device selection and bulk buffers */
+    int argc;
+    char **argv;
+    int exitCode;
 
-    PROT_RxState rxstate;
+    /* UI line buffering */
+    unsigned uiCurrentLine;
+    UI_Line *uiLines; /* UI_MAX_LINES */
+    UI_Row *uiRows; /* UI_MAX_ROWS, kept over retries */
+    int uiTerminal; /* stdout is a terminal, else plain progress lines */
+    unsigned uiRowLine; /* --ui-row, terminal line of the first row, 0 = bottom */
+    PL_time_t uiDrawUs; /* last progress output */
+
+    /* connect mode (-c) with multiple -d arguments */
+    unsigned monitorCount;
+    const char *monitorPaths[MAX_CONNECT_PORTS - 1];
+    PROT_RxState *monitorRx; /* indexed by port - 1, allocated for -c and -p */
+    const char *proxyLink;
+
+    /* --selftest of the host serial path */
+    GCF_Selftest *selftest;
+    unsigned long selftestMinRate; /* bytes/s on the wire, 0 = SELFTEST_MIN_RATE of the line rate */
+    unsigned long selftestMaxRttUs; /* p99 limit, 0 = SELFTEST_MAX_RTT */
+
+    /* --dry-run against the device model in sim.c */
+    int dryRun;
+    unsigned long rttUs;
+    unsigned simChunkSize; /* V3 data request length of the model */
+    unsigned simRxBuffer; /* --rx-buffer, 0 = unlimited */
+    unsigned long simRxRate; /* --rx-rate in bytes/s, 0 = line rate */
+
+    /* --pace, token bucket pacing of writes to the device */
+    int pace;
+    unsigned long paceRate; /* bytes/s, 0 = line rate */
+
+    /* --usb-power-on and reconnect timing after UART reset */
+    int usbPowerOn;
+    PL_time_t resetTimeUs; /* reset command sent, 0 = no re-enumeration pending */
+    PL_time_t reconnectUs; /* last measured reset to reopened port time, 0 = unknown */
+
+    /* --wait and --handoff for a port held by another process */
+    unsigned long portWaitMs;
+    int handoff;
+
+    int ioStats; /* --io-stats */
+    int stats; /* --stats: 1 = text, 2 = JSON (--stats-json) */
+    PL_UartStats uartSeen; /* UART counters at the last retry */
+    int replay; /* --replay, the session runs against a recording */
 
     PL_time_t startTime;
     PL_time_t maxTime;
 
+    /* --stream and --max-rss for hosts with little memory */
+    int streamMode;
+    GCF_Stream *stream;
+    unsigned long maxRssKb; /* 0 = no budget */
+
     unsigned devCount;
-    Device devices[MAX_DEVICES];
+    Device *devices; /* MAX_DEVICES */
+    int listJson; /* -l --json */
+
+    /* sequence of -f images in one bootloader session */
+    GCF_Image *images; /* GCF_MAX_IMAGES */
+    unsigned imageCount;
+    unsigned imageIndex; /* loaded in gcf->file, kept over retries */
 
     DeviceType devType;
+    const GCF_DeviceProfile *devProfile; /* 0 = type guessed from the path */
+    GCF_ResetMethod devReset;
 
     PL_Baudrate devBaudrate;
+    int baudProbe; /* devBaudrate is a guess, probe before the UART reset */
+    int baudCached; /* devBaudrate is from BAUDRATE_CACHE */
+    unsigned baudProbeIndex;
     char devpath[MAX_DEV_PATH_LENGTH];
     char devSerialNum[MAX_DEV_SERIALNR_LENGTH];
     GCF_File file;
-} GCF;
+
+    U_Arena arena;
+} GCF_CACHE_ALIGN GCF;
 
 
 static DeviceType gcfGetDeviceType(GCF *gcf);
+static DeviceType gcfDeviceTypeFromPath(const char *path, PL_Baudrate *baudrate);
 static void gcfRetry(GCF *gcf);
+static GCF_Status gcfClaimPort(GCF *gcf);
+static unsigned long gcfBootloaderConnectDelay(const GCF *gcf);
+static unsigned gcfBootloaderGeneration(const GCF *gcf);
 static void gcfPrintHelp();
 static GCF_Status gcfProcessCommandline(GCF *gcf);
+static GCF_Status gcfCommandPack(GCF *gcf);
+static GCF_Status gcfDryRun(GCF *gcf);
+static GCF_Status gcfSetupPacing(GCF *gcf);
+static GCF_Status gcfLoadImage(GCF *gcf, const GCF_Image *image);
+static int gcfNextImage(GCF *gcf);
 static void gcfGetDevices(GCF *gcf);
 static void gcfCommandResetUart();
 static void gcfCommandQueryStatus();
+static void gcfStoreBaudrate(GCF *gcf, PL_Baudrate baudrate);
 static void gcfCommandQueryFirmwareVersion();
 static void ST_Void(GCF *gcf, Event event);
 static void ST_Init(GCF *gcf, Event event);
@@ -161,9 +386,13 @@ static void ST_BootloaderQuery(GCF *gcf, Event event);
 
 static void ST_Connect(GCF *gcf, Event event);
 static void ST_Connected(GCF *gcf, Event event);
+static void ST_Proxy(GCF *gcf, Event event);
+static void ST_Selftest(GCF *gcf, Event event);
+static void gcfSelftestFrame(GCF *gcf, const unsigned char *data, unsigned len);
 
 static void ST_Reset(GCF *gcf, Event event);
 static void ST_ResetUart(GCF *gcf, Event event);
+static void ST_ProbeBaudrate(GCF *gcf, Event event);
 static void ST_ResetFtdi(GCF *gcf, Event event);
 static void ST_ResetRaspBee(GCF *gcf, Event event);
 
@@ -173,6 +402,7 @@ static UI_Line *UI_NextLine(GCF *gcf);
 void UI_Printf(GCF *gcf, const char *format, ...);
 
 static GCF gcfLocal;
+static unsigned char gcfArenaMem[GCF_ARENA_SIZE];
 
 
 static const char hex_lookup[16] =
@@ -235,56 +465,219 @@ void UI_Printf(GCF *gcf, const char *format, ...)
   #define FMT_BLOCK_DONE "\xE2\x96\x93" /* Dark Shade U+2591 */
 #endif
 
-static void UI_UpdateProgress(GCF *gcf)
+/* Pads with spaces up to column \p col of the row starting at \p start. */
+static void UI_PadTo(U_SStream *ss, unsigned start, unsigned col)
+{
+    while (ss->pos < start + col && ss->status == U_SSTREAM_OK)
+        U_sstream_put_str(ss, " ");
+}
+
+/* Appends the last path component of \p path to \p name at \p len, cut at \p size - 1 characters.
+
+   \returns The new length.
+ */
+static unsigned UI_PutName(char *name, unsigned len, unsigned size, const char *path)
+{
+    unsigned i;
+    unsigned start;
+
+    start = 0;
+    for (i = 0; path[i]; i++)
+    {
+        if (path[i] == '/' || path[i] == '\\')
+            start = i + 1;
+    }
+
+    if (path[start] == '\0')
+        start = 0; /* " " or a path ending in a separator */
+
+    for (i = start; path[i] && len < size - 1; i++)
+        name[len++] = path[i];
+    name[len] = '\0';
+
+    return len;
+}
+
+/* Appends one progress row: label, state, percent, rate and retries, on a terminal also a bar. */
+static void UI_PutRow(GCF *gcf, U_SStream *ss, unsigned n, unsigned width, PL_time_t now)
 {
-    long percent;
-    int ndone;
     unsigned i;
+    unsigned col;
+    unsigned bar;
+    unsigned ndone;
+    unsigned long percent;
+    unsigned long long rate;
+    unsigned len;
+    const UI_Row *row;
+    const char *label;
+    char name[21];
+    static const char *stateNames[] = { "pending", "upload", "verify", "done", "failed", "retry" };
+
+    row = &gcf->uiRows[n];
+    len = 0;
+
+    /* the file name without directories, with --ui-row after the device */
+    if (gcf->uiRowLine != 0)
+    {
+        len = UI_PutName(name, len, sizeof(name), gcf->devpath);
+        len = UI_PutName(name, len, sizeof(name), " ");
+    }
+
+    label = gcf->imageCount > n ? gcf->images[n].fname : gcf->file.fname;
+    UI_PutName(name, len, sizeof(name), label);
+
+    col = ss->pos;
+
+    percent = row->total ? (unsigned long)((unsigned long long)row->done * 100 / row->total) : 0;
+    if (row->endUs)
+        now = row->endUs;
+
+    rate = 0;
+    if (row->startUs && now > row->startUs)
+        rate = (unsigned long long)row->done * 1000000 / (now - row->startUs); /* bytes/s */
+
+    U_sstream_put_str(ss, " ");
+    U_sstream_put_str(ss, name);
+    UI_PadTo(ss, col, 22);
+    U_sstream_put_str(ss, stateNames[row->state]);
+    UI_PadTo(ss, col, 33);
+    if      (percent < 10)  { U_sstream_put_str(ss, "  "); }
+    else if (percent < 100) { U_sstream_put_str(ss, " "); }
+    U_sstream_put_long(ss, (long)percent);
+    U_sstream_put_str(ss, "% ");
+    U_sstream_put_long(ss, (long)(rate / 1000));
+    U_sstream_put_str(ss, ".");
+    U_sstream_put_long(ss, (long)(rate / 100 % 10));
+    U_sstream_put_str(ss, " kB/s");
+
+    if (row->retries)
+    {
+        U_sstream_put_str(ss, ", ");
+        U_sstream_put_long(ss, (long)row->retries);
+        U_sstream_put_str(ss, " retries");
+    }
+
+    if (width == 0)
+        return;
+
+    /* bar in the remaining columns */
+    UI_PadTo(ss, col, 52);
+    bar = width > 56 ? width - 54 : 0;
+    ndone = row->total ? (unsigned)((unsigned long long)row->done * bar / row->total) : 0;
+    U_sstream_put_str(ss, " ");
+    for (i = 0; i < bar; i++)
+        U_sstream_put_str(ss, i < ndone ? FMT_BLOCK_DONE : FMT_BLOCK_OPEN);
+}
+
+/*! Draws the progress view with one row per -f image.
+
+    One process flashes one device. For many devices at once a wrapper
+    starts one process per device with a distinct --ui-row, each row then
+    shows device, image, state, percent, rate and retries.
+
+    The view is composed in one buffer and written at once, at most every
+    UI_FRAME_US, so the cost doesn't depend on how often the upload reports
+    progress. If stdout isn't a terminal the current row is printed as a
+    plain line every UI_PLAIN_US instead.
+ */
+static void UI_DrawProgress(GCF *gcf, int force)
+{
+    unsigned n;
+    unsigned rows;
     unsigned w;
     unsigned h;
-    unsigned wmax;
-    unsigned long total;
-    char buf[256];
-
+    PL_time_t now;
     U_SStream ss;
+    char buf[UI_MAX_ROWS * 320];
 
+    now = PL_TimeUs();
+    if (!force && gcf->uiDrawUs && now - gcf->uiDrawUs < (gcf->uiTerminal ? UI_FRAME_US : UI_PLAIN_US))
+        return;
+
+    gcf->uiDrawUs = now;
     U_sstream_init(&ss, &buf[0], sizeof(buf));
 
-    total = gcf->file.gcfFileSize;
+    if (!gcf->uiTerminal)
+    {
+        U_sstream_put_str(&ss, "progress:");
+        UI_PutRow(gcf, &ss, gcf->imageIndex, 0, now);
+        U_sstream_put_str(&ss, "\n");
+        PL_Print(&buf[0]);
+        return;
+    }
 
+    rows = gcf->imageCount > 1 ? gcf->imageCount : 1;
     UI_GetWinSize(&w, &h);
+    if (w > 80)
+        w = 80; /* cap line length */
 
-    wmax = w - 2 <= 80 ? w : 80; // cap line length
-    percent = (total - gcf->remaining) * 100 / total;
+    for (n = 0; n < rows; n++)
+    {
+        /* ESC[{line};1H, the rows end at the same line as the former single bar,
+           with --ui-row concurrent processes each draw their rows at their own lines */
+        U_sstream_put_str(&ss, FMT_ESC "[");
+        if (gcf->uiRowLine != 0)
+            U_sstream_put_long(&ss, (long)(gcf->uiRowLine + n));
+        else
+            U_sstream_put_long(&ss, (long)(h > rows ? h - rows + n : n + 1));
+        U_sstream_put_str(&ss, ";1H");
+        UI_PutRow(gcf, &ss, n, w, now);
+        U_sstream_put_str(&ss, FMT_ESC "[K"); /* clear to end of line */
+    }
 
-    if (percent > 95)
-        percent = 100;
+    if (ss.status == U_SSTREAM_OK)
+        PL_Print(&buf[0]);
+}
 
-    U_sstream_put_str(&ss, "\r ");
+/*! Sets the state shown in the row of the current image. */
+static void UI_SetState(GCF *gcf, UI_State state)
+{
+    UI_Row *row;
 
-    /* ' 100 % '   right align percent number */
-    if      (percent < 10) { U_sstream_put_str(&ss, "  "); }
-    else if (percent < 100) {U_sstream_put_str(&ss, " "); }
+    if (gcf->task != T_PROGRAM || gcf->imageIndex >= UI_MAX_ROWS)
+        return;
 
-    U_sstream_put_long(&ss, percent);
-    U_sstream_put_str(&ss, "% uploading ");
+    row = &gcf->uiRows[gcf->imageIndex];
+    if (row->state == state)
+        return;
 
-    w = wmax - ss.pos - 2;
-    ndone = (total - gcf->remaining) * w / total;
+    row->state = state;
+    if (row->total == 0)
+        return; /* upload not started */
 
-    for (i = 0; i < w; i++)
+    if (state == UI_STATE_VERIFY)
     {
-        if ((int)i <= ndone)
-            U_sstream_put_str(&ss, FMT_BLOCK_DONE);
-        else
-            U_sstream_put_str(&ss, FMT_BLOCK_OPEN);
+        /* the last chunk is reported before it's sent */
+        row->done = row->total;
+        row->endUs = PL_TimeUs();
+        UI_DrawProgress(gcf, 1);
+    }
+    else if (!gcf->uiTerminal)
+    {
+        UI_DrawProgress(gcf, 1); /* the terminal view shows it with the next frame */
     }
+}
+
+/*! Called for every served chunk, only stores the numbers unless a frame is due. */
+static void UI_UpdateProgress(GCF *gcf)
+{
+    UI_Row *row;
+
+    if (gcf->imageIndex >= UI_MAX_ROWS)
+        return;
 
-    for (; ss.pos < wmax;)
-        U_sstream_put_str(&ss, " ");
+    row = &gcf->uiRows[gcf->imageIndex];
+
+    if (row->total != gcf->file.gcfFileSize || row->startUs == 0)
+    {
+        row->total = gcf->file.gcfFileSize;
+        row->startUs = PL_TimeUs();
+        row->endUs = 0;
+        row->state = UI_STATE_UPLOAD;
+    }
 
-    UI_SetCursor(0, h - 1);
-    PL_Print(&buf[0]);
+    row->done = gcf->file.gcfFileSize - gcf->remaining;
+    UI_DrawProgress(gcf, 0);
 }
 
 static void ST_Void(GCF *gcf, Event event)
@@ -301,6 +694,11 @@ static void ST_Init(GCF *gcf, Event event)
         {
             PL_ShutDown();
         }
+        else if (gcfClaimPort(gcf) == GCF_FAILED)
+        {
+            gcf->exitCode = 1;
+            PL_ShutDown();
+        }
         else
         {
             GCF_HandleEvent(gcf, EV_ACTION);
@@ -313,7 +711,7 @@ static void ST_Reset(GCF *gcf, Event event)
     if (event == EV_ACTION)
     {
         gcf->wp = 0;
-        gcf->substate = ST_ResetUart;
+        gcf->substate = gcf->baudProbe ? ST_ProbeBaudrate : ST_ResetUart;
         gcf->substate(gcf, EV_ACTION);
     }
     else if (event == EV_UART_RESET_SUCCESS || event == EV_FTDI_RESET_SUCCESS || event == EV_RASPBEE_RESET_SUCCESS)
@@ -332,7 +730,9 @@ static void ST_Reset(GCF *gcf, Event event)
     }
     else if (event == EV_UART_RESET_FAILED)
     {
-        if (gcf->devType == DEV_CONBEE_1)
+        gcf->resetTimeUs = 0;
+
+        if (gcf->devReset == GCF_RESET_FTDI)
         {
             if (PL_Connect(gcf->devpath, gcf->devBaudrate) == GCF_SUCCESS)
             {
@@ -341,7 +741,7 @@ static void ST_Reset(GCF *gcf, Event event)
                 return;
             }
         }
-        else if (gcf->devType == DEV_RASPBEE_1 || gcf->devType == DEV_RASPBEE_2)
+        else if (gcf->devReset == GCF_RESET_GPIO)
         {
             if (PL_Connect(gcf->devpath, gcf->devBaudrate) == GCF_SUCCESS)
             {
@@ -378,18 +778,25 @@ static void ST_ResetUart(GCF *gcf, Event event)
     if (event == EV_ACTION)
     {
         PL_SetTimeout(3000);
+        gcf->resetTimeUs = 0;
+
+        if (gcf->usbPowerOn && PL_UsbPowerOn(gcf->devpath) != 0)
+            UI_Printf(gcf, "USB power control not available for %s\n", gcf->devpath);
 
         if (PL_Connect(gcf->devpath, gcf->devBaudrate) == GCF_SUCCESS)
         {
             if (gcf->task == T_RESET)
                 gcfCommandQueryFirmwareVersion();
             gcfCommandResetUart();
+            gcf->resetTimeUs = PL_TimeUs();
         }
     }
     else if (event == EV_RX_BTL_PKG_DATA)
     {
-        if ((unsigned char)gcf->ascii[1] == BTL_ID_RESPONSE)
+        if (gcf->rxFrame[1] == BTL_ID_RESPONSE)
         {
+            /* already in bootloader, the device won't re-enumerate */
+            gcf->resetTimeUs = 0;
             PL_ClearTimeout();
             PL_SetTimeout(100); /* for connect bootloader */
             GCF_HandleEvent(gcf, EV_UART_RESET_SUCCESS);
@@ -404,7 +811,7 @@ static void ST_ResetUart(GCF *gcf, Event event)
     else if (event == EV_PKG_UART_RESET)
     {
         UI_Printf(gcf, "command UART reset done\n");
-        if (gcf->devType == DEV_RASPBEE_1 || gcf->devType == DEV_CONBEE_1)
+        if (gcf->devType == DEV_RASPBEE_1 || gcf->devType == DEV_CONBEE_1 || gcf->devType == DEV_CONBEE_3)
         {
             /* due FTDI don't wait for disconnect */
             PL_ClearTimeout();
@@ -414,12 +821,181 @@ static void ST_ResetUart(GCF *gcf, Event event)
     else if (event == EV_TIMEOUT)
     {
         UI_Printf(gcf, "command reset timeout\n");
+        if (gcf->baudCached)
+            gcfStoreBaudrate(gcf, PL_BAUDRATE_UNKNOWN); /* maybe outdated, the retry probes */
         gcf->substate = ST_Void;
         PL_Disconnect();
         GCF_HandleEvent(gcf, EV_UART_RESET_FAILED);
     }
 }
 
+/* The device serial number, or the path for devices without one. */
+static int gcfBaudrateKey(const GCF *gcf, char *key, unsigned keylen)
+{
+    unsigned i;
+    const char *src;
+
+    src = gcf->devSerialNum[0] ? gcf->devSerialNum : gcf->devpath;
+
+    for (i = 0; src[i]; i++)
+    {
+        if (i + 1 >= keylen || src[i] == ' ' || src[i] == '\t' || src[i] == '\n')
+            return -1;
+        key[i] = src[i];
+    }
+
+    key[i] = '\0';
+    return i > 0 ? 0 : -1;
+}
+
+/* Devices without USB identity get the rate of the last probe, otherwise it's probed. */
+static void gcfLoadBaudrate(GCF *gcf)
+{
+    long rate;
+    U_SStream ss;
+    char key[MAX_DEV_PATH_LENGTH];
+    char value[16];
+
+    gcf->baudProbe = 0;
+    gcf->baudCached = 0;
+
+    if (gcf->devProfile || gcf->dryRun || gcf->devpath[0] == '\0')
+        return;
+
+    gcf->baudProbe = 1;
+
+    /* the cache is an input which isn't part of a recording */
+    if (REC_Recording() || REC_Replaying() || gcfBaudrateKey(gcf, key, sizeof(key)) != 0)
+        return;
+
+    if (NET_CacheGet(BAUDRATE_CACHE, key, value, sizeof(value)) != 0)
+        return;
+
+    U_sstream_init(&ss, value, U_strlen(value));
+    rate = U_sstream_get_long(&ss);
+
+    if (ss.status == U_SSTREAM_OK && (rate == PL_BAUDRATE_38400 || rate == PL_BAUDRATE_115200))
+    {
+        PL_Printf(DBG_DEBUG, "cached baudrate %ld for %s\n", rate, key);
+        gcf->devBaudrate = (PL_Baudrate)rate;
+        gcf->baudProbe = 0;
+        gcf->baudCached = 1;
+    }
+}
+
+/* Caches \p baudrate for the device, PL_BAUDRATE_UNKNOWN removes the entry. */
+static void gcfStoreBaudrate(GCF *gcf, PL_Baudrate baudrate)
+{
+    char key[MAX_DEV_PATH_LENGTH];
+    char value[16];
+
+    gcf->baudCached = 0;
+
+    if (REC_Replaying() || gcfBaudrateKey(gcf, key, sizeof(key)) != 0)
+        return;
+
+    value[0] = '\0';
+    if (baudrate != PL_BAUDRATE_UNKNOWN)
+        snprintf(value, sizeof(value), "%d", (int)baudrate);
+
+    if (NET_CacheSet(BAUDRATE_CACHE, key, value) != 0)
+        PL_Printf(DBG_DEBUG, "failed to cache baudrate of %s\n", key);
+}
+
+/* Candidate \p i of the probe, the guess comes first. */
+static PL_Baudrate gcfProbeBaudrate(const GCF *gcf, unsigned i)
+{
+    PL_Baudrate guess;
+
+    guess = gcf->devBaudrate == PL_BAUDRATE_115200 ? PL_BAUDRATE_115200 : PL_BAUDRATE_38400;
+    if (i == 0)
+        return guess;
+
+    return guess == PL_BAUDRATE_115200 ? PL_BAUDRATE_38400 : PL_BAUDRATE_115200;
+}
+
+/* Firmware and V3 bootloader answer one of the two queries. */
+static void gcfProbeQuery(GCF *gcf)
+{
+    unsigned char buf[2];
+
+    U_bzero(&gcf->rxstate, sizeof(gcf->rxstate)); /* partial frame of the previous rate */
+    gcfCommandQueryStatus();
+
+    buf[0] = BTL_MAGIC;
+    buf[1] = BTL_ID_REQUEST;
+    PROT_SendFlagged(buf, 2);
+
+    PL_SetTimeout(BAUDRATE_PROBE_WINDOW);
+}
+
+/*! Finds the baudrate of a device without USB identity before the UART reset.
+
+    The open port is switched through the candidate rates without reopening,
+    the first rate with a valid response frame is used and cached per device.
+    Without response the guess is kept.
+ */
+static void ST_ProbeBaudrate(GCF *gcf, Event event)
+{
+    PL_Baudrate baudrate;
+
+    if (event == EV_ACTION)
+    {
+        gcf->baudProbeIndex = 0;
+        if (PL_Connect(gcf->devpath, gcfProbeBaudrate(gcf, 0)) != GCF_SUCCESS)
+        {
+            gcf->substate = ST_ResetUart; /* handles the failed connect */
+            gcf->substate(gcf, EV_ACTION);
+            return;
+        }
+
+        /* an already open port may have another rate */
+        PL_SetBaudrate(gcfProbeBaudrate(gcf, 0));
+        gcfProbeQuery(gcf);
+    }
+    else if (event == EV_PKG_DEVICE_STATE || (event == EV_RX_BTL_PKG_DATA && gcf->rxFrame[1] == BTL_ID_RESPONSE))
+    {
+        PL_ClearTimeout();
+        baudrate = gcfProbeBaudrate(gcf, gcf->baudProbeIndex);
+        UI_Printf(gcf, "baudrate %d detected\n", (int)baudrate);
+
+        gcf->devBaudrate = baudrate;
+        gcf->baudProbe = 0;
+        gcfStoreBaudrate(gcf, baudrate);
+
+        if (event == EV_RX_BTL_PKG_DATA)
+        {
+            /* already in bootloader, same as in ST_ResetUart */
+            PL_SetTimeout(100);
+            GCF_HandleEvent(gcf, EV_UART_RESET_SUCCESS);
+            return;
+        }
+
+        gcf->substate = ST_ResetUart;
+        gcf->substate(gcf, EV_ACTION);
+    }
+    else if (event == EV_TIMEOUT)
+    {
+        gcf->baudProbeIndex++;
+
+        if (gcf->baudProbeIndex < 2 && PL_SetBaudrate(gcfProbeBaudrate(gcf, gcf->baudProbeIndex)) == 0)
+        {
+            gcfProbeQuery(gcf);
+            return;
+        }
+
+        UI_Printf(gcf, "no response at any baudrate, using %d\n", (int)gcfProbeBaudrate(gcf, 0));
+        PL_SetBaudrate(gcfProbeBaudrate(gcf, 0));
+        gcf->substate = ST_ResetUart;
+        gcf->substate(gcf, EV_ACTION);
+    }
+    else if (event == EV_DISCONNECTED)
+    {
+        gcf->substate = ST_ResetUart; /* reconnects */
+        gcf->substate(gcf, EV_ACTION);
+    }
+}
+
 /*! FTDI reset applies only to ConBee I */
 static void ST_ResetFtdi(GCF *gcf, Event event)
 {
@@ -456,64 +1032,457 @@ static void ST_ResetRaspBee(GCF *gcf, Event event)
     }
 }
 
-static void gcfGetDevices(GCF *gcf)
+/* Decoder states of the monitor and proxy ports. */
+static void gcfResetMonitorRx(GCF *gcf)
 {
-    int i;
-    int n;
-    U_SStream ss;
-    n = PL_GetDevices(&gcf->devices[0], MAX_DEVICES);
-    gcf->devCount = n > 0 ? (unsigned)n : 0;
+    U_bzero(gcf->monitorRx, (MAX_CONNECT_PORTS - 1) * sizeof(PROT_RxState));
+}
 
-    if (gcf->devpath[0] != '\0' && gcf->devSerialNum[0] == '\0')
-    {
-        U_sstream_init(&ss, &gcf->devpath[0], U_strlen(&gcf->devpath[0]));
+/* Reads the file at \p path into the session arena as gcf->file.fcontent.
 
-        for (i = 0; i < n; i++)
-        {
-            if (gcf->devices[i].serial[0] == '\0')
-                continue;
+   Only the actual file size stays allocated, a previously read file is replaced.
+   \returns The number of bytes read, or -1 on failure.
+ */
+static long gcfReadFile(GCF *gcf, const char *path)
+{
+    long nread;
+    unsigned long avail;
+    unsigned char *buf;
 
-            if (U_sstream_find(&ss, &gcf->devices[i].path[0]) || U_sstream_find(&ss, &gcf->devices[i].stablepath[0]))
-            {
-                U_memcpy(&gcf->devSerialNum[0], &gcf->devices[i].serial[0], MAX_DEV_SERIALNR_LENGTH);
+    if (gcf->file.fcontent) /* last allocation of the arena */
+    {
+        /* nothing allocated after it, the commit rounds up to U_ARENA_ALIGN */
+        Assert((unsigned long)(gcf->arena.data + gcf->arena.pos - (gcf->file.fcontent + gcf->file.fcontentSize)) < U_ARENA_ALIGN);
+        U_arena_release(&gcf->arena, (unsigned long)(gcf->file.fcontent - gcf->arena.data));
+    }
 
-                if (gcf->devBaudrate == PL_BAUDRATE_UNKNOWN)
-                    gcf->devBaudrate = gcf->devices[i].baudrate;
+    gcf->file.fcontent = 0;
+    gcf->file.fsize = 0;
 
-                break;
-            }
-        }
+    buf = U_arena_reserve(&gcf->arena, &avail);
+    if (avail < MAX_GCF_FILE_SIZE)
+        return -1;
+
+    nread = (long)PL_ReadFile(path, buf, MAX_GCF_FILE_SIZE);
+    if (nread > 0)
+    {
+        U_arena_commit(&gcf->arena, (unsigned long)nread);
+        gcf->file.fcontent = buf;
+        gcf->file.fcontentSize = (unsigned long)nread;
     }
+
+    return nread;
 }
 
-static void ST_ListDevices(GCF *gcf, Event event)
+/*! \returns \p len bytes at file \p offset from the read-ahead cache, or 0 on a read error or short file. */
+static const unsigned char *gcfStreamRead(GCF_Stream *st, unsigned long offset, unsigned len)
 {
-    Device *dev;
-    unsigned i;
+    long n;
 
-    if (event == EV_ACTION)
+    Assert(len <= STREAM_CACHE_SIZE);
+
+    if (offset >= st->offset && offset + len <= st->offset + st->len)
+        return &st->buf[offset - st->offset];
+
+    /* requests are sequential, read ahead from the requested offset */
+    n = PL_ReadFileAt(st->file, offset, st->buf, STREAM_CACHE_SIZE);
+    st->reads++;
+
+    if (n < 0)
     {
-        gcfGetDevices(gcf);
+        st->len = 0;
+        return 0;
+    }
 
-        if (gcf->devCount == 0)
-        {
-            UI_Printf(gcf, "no devices found\n");
-        }
+    st->offset = offset;
+    st->len = (unsigned long)n;
+    st->readBytes += (unsigned long)n;
 
-        UI_Printf(gcf, "Path              | Serial      | Type\n");
-        UI_Printf(gcf, "------------------+-------------+---------------\n");
+    return st->len >= len ? &st->buf[0] : 0;
+}
 
-        for (i = 0; i < gcf->devCount; i++)
-        {
-            dev = &gcf->devices[i];
-            UI_Printf(gcf, "%-18s| %-12s| %s\n", dev->path, dev->serial, dev->name);
-        }
+/*! Opens the file at \p path for --stream, the start of the file is placed
+    in gcf->file.fcontent for GCF_ParseFile().
 
-        PL_ShutDown();
-    }
+    \returns The file size, or -1 on failure.
+ */
+static long gcfOpenStream(GCF *gcf, const char *path)
+{
+    unsigned n;
+    unsigned long size;
+    GCF_Stream *st;
+
+    gcf->file.fcontent = 0;
+    gcf->file.fcontentSize = 0;
+    gcf->file.fsize = 0;
+
+    st = gcf->stream;
+    PL_CloseFile(st->file);
+    st->len = 0;
+    st->offset = 0;
+
+    st->file = PL_OpenFile(path, &size);
+    if (st->file < 0 || size == 0)
+        return -1;
+
+    n = size < STREAM_CACHE_SIZE ? (unsigned)size : STREAM_CACHE_SIZE;
+    if (!gcfStreamRead(st, 0, n))
+        return -1;
+
+    gcf->file.fcontent = &st->buf[0];
+    gcf->file.fcontentSize = n;
+
+    return (long)size;
 }
 
-static void ST_Program(GCF *gcf, Event event)
+/*! Checks the CRC-8 of the GCF header over the data in one pass through the cache. */
+static int gcfStreamCheckCrc(GCF *gcf)
+{
+    unsigned n;
+    unsigned char crc;
+    unsigned long offset;
+    const unsigned char *p;
+
+    crc = 0;
+    for (offset = 0; offset < gcf->file.gcfFileSize; offset += n)
+    {
+        n = STREAM_CACHE_SIZE;
+        if (gcf->file.gcfFileSize - offset < n)
+            n = (unsigned)(gcf->file.gcfFileSize - offset);
+
+        p = gcfStreamRead(gcf->stream, GCF_HEADER_SIZE + offset, n);
+        if (!p)
+            return -1;
+
+        crc = CRC_Dallas8(crc, p, n);
+    }
+
+    return crc == gcf->file.gcfCrc ? 0 : -1;
+}
+
+/*! \returns \p len bytes of the image data after the GCF header at \p offset, or 0 on a read error. */
+static const unsigned char *gcfImageData(GCF *gcf, unsigned long offset, unsigned len)
+{
+    if (gcf->streamMode)
+        return gcfStreamRead(gcf->stream, GCF_HEADER_SIZE + offset, len);
+
+    if (!gcf->file.fcontent || GCF_HEADER_SIZE + offset + len > gcf->file.fcontentSize)
+        return 0;
+
+    return &gcf->file.fcontent[GCF_HEADER_SIZE + offset];
+}
+
+/*! Reads and parses \p image into gcf->file. */
+static GCF_Status gcfLoadImage(GCF *gcf, const GCF_Image *image)
+{
+    long nread;
+    int ret;
+
+    U_memcpy(gcf->file.fname, image->fname, sizeof(gcf->file.fname));
+
+    if (gcf->streamMode)
+        nread = gcfOpenStream(gcf, image->path);
+    else
+        nread = gcfReadFile(gcf, image->path);
+
+    if (nread <= 0)
+    {
+        PL_Printf(DBG_INFO, "failed to read file: %s\n", gcf->file.fname);
+        return GCF_FAILED;
+    }
+
+    PL_Printf(DBG_INFO, "read file success: %s (%ld bytes)\n", gcf->file.fname, nread);
+    gcf->file.fsize = (unsigned long)nread;
+
+    ret = GCF_ParseFile(&gcf->file);
+
+    if (gcf->streamMode)
+    {
+        gcf->file.fcontent = 0; /* the cache moves on */
+        gcf->file.fcontentSize = 0;
+
+        if (ret == 0 && gcfStreamCheckCrc(gcf) != 0)
+        {
+            PL_Printf(DBG_INFO, "invalid file: %s, checksum mismatch\n", gcf->file.fname);
+            return GCF_FAILED;
+        }
+    }
+
+    if (ret != 0)
+    {
+        PL_Printf(DBG_INFO, "invalid file: %s\n", gcf->file.fname);
+        return GCF_FAILED;
+    }
+
+    return GCF_SUCCESS;
+}
+
+/*! Loads the next -f image after the current one was written.
+
+    \returns 1 if there is one, 0 if the sequence is done.
+ */
+static int gcfNextImage(GCF *gcf)
+{
+    if (gcf->imageIndex + 1 >= gcf->imageCount)
+        return 0;
+
+    gcf->imageIndex++;
+
+    if (gcfLoadImage(gcf, &gcf->images[gcf->imageIndex]) != GCF_SUCCESS)
+    {
+        gcf->exitCode = 1;
+        return 0;
+    }
+
+    UI_Printf(gcf, "image %u of %u: %s\n", gcf->imageIndex + 1, gcf->imageCount, gcf->file.fname);
+
+    if (SIM_Active())
+    {
+        SIM_SetImage(gcf->streamMode ? 0 : &gcf->file.fcontent[GCF_HEADER_SIZE],
+                     gcf->file.gcfFileSize, gcf->file.gcfCrc32, gcf->file.gcfCrc);
+    }
+
+    return 1;
+}
+
+static unsigned gcfProfileSlot(unsigned vendorId, unsigned productId)
+{
+    unsigned long key;
+
+    /* multiplicative hash, the top bits are the slot */
+    key = (((unsigned long)vendorId << 16) | productId) * 2654435761UL;
+    return (unsigned)((key & 0xFFFFFFFFUL) >> (32 - GCF_PROFILE_HASH_BITS));
+}
+
+/* Case insensitive prefix match, '_' in enumerated names matches ' '. */
+static int gcfModelMatch(const char *model, const char *name)
+{
+    char a;
+    char b;
+
+    for (; *model; model++, name++)
+    {
+        a = *model;
+        b = *name == '_' ? ' ' : *name;
+        if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+        if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+        if (a != b)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*! Looks up the profile of an enumerated device by USB vendor id, product id and name.
+
+    \returns The profile or 0 if the device isn't known.
+ */
+static const GCF_DeviceProfile *gcfLookupProfile(const Device *dev)
+{
+    unsigned i;
+    unsigned slot;
+    const GCF_DeviceProfile *p;
+    static unsigned char table[1 << GCF_PROFILE_HASH_BITS]; /* profile index + 1, 0 = empty */
+
+    if (table[gcfProfileSlot(gcfDeviceProfiles[0].vendorId, gcfDeviceProfiles[0].productId)] == 0)
+    {
+        /* linear probing, entries of the same id keep their order */
+        for (i = 0; i < sizeof(gcfDeviceProfiles) / sizeof(gcfDeviceProfiles[0]); i++)
+        {
+            slot = gcfProfileSlot(gcfDeviceProfiles[i].vendorId, gcfDeviceProfiles[i].productId);
+            while (table[slot] != 0)
+                slot = (slot + 1) & ((1 << GCF_PROFILE_HASH_BITS) - 1);
+            table[slot] = (unsigned char)(i + 1);
+        }
+    }
+
+    if (dev->vendorId == 0)
+        return 0;
+
+    slot = gcfProfileSlot(dev->vendorId, dev->productId);
+
+    for (; table[slot] != 0; slot = (slot + 1) & ((1 << GCF_PROFILE_HASH_BITS) - 1))
+    {
+        p = &gcfDeviceProfiles[table[slot] - 1];
+
+        if (p->vendorId != dev->vendorId || p->productId != dev->productId)
+            continue;
+
+        if (p->model == 0 || gcfModelMatch(p->model, dev->name))
+            return p;
+    }
+
+    return 0;
+}
+
+static void gcfGetDevices(GCF *gcf)
+{
+    int i;
+    int n;
+    U_SStream ss;
+    n = PL_GetDevices(&gcf->devices[0], MAX_DEVICES);
+    gcf->devCount = n > 0 ? (unsigned)n : 0;
+
+    if (gcf->devpath[0] != '\0' && gcf->devSerialNum[0] == '\0')
+    {
+        U_sstream_init(&ss, &gcf->devpath[0], U_strlen(&gcf->devpath[0]));
+
+        for (i = 0; i < n; i++)
+        {
+            if (gcf->devices[i].serial[0] == '\0')
+                continue;
+
+            if (U_sstream_find(&ss, &gcf->devices[i].path[0]) || U_sstream_find(&ss, &gcf->devices[i].stablepath[0]))
+            {
+                U_memcpy(&gcf->devSerialNum[0], &gcf->devices[i].serial[0], MAX_DEV_SERIALNR_LENGTH);
+                gcf->devProfile = gcfLookupProfile(&gcf->devices[i]);
+
+                if (gcf->devBaudrate == PL_BAUDRATE_UNKNOWN)
+                    gcf->devBaudrate = gcf->devices[i].baudrate;
+
+                break;
+            }
+        }
+    }
+}
+
+/* Puts \p str as quoted JSON string. */
+static void gcfPutJsonStr(U_SStream *ss, const char *str)
+{
+    char esc[7];
+
+    U_sstream_put_str(ss, "\"");
+
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+        {
+            esc[0] = '\\';
+            esc[1] = *str;
+            esc[2] = '\0';
+        }
+        else if ((unsigned char)*str < 0x20)
+        {
+            esc[0] = '\\';
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            put_hex((unsigned char)*str, &esc[4]);
+            esc[6] = '\0';
+        }
+        else
+        {
+            esc[0] = *str;
+            esc[1] = '\0';
+        }
+
+        U_sstream_put_str(ss, esc);
+    }
+
+    U_sstream_put_str(ss, "\"");
+}
+
+/* Puts a USB id as four lower case hex digits like lsusb. */
+static void gcfPutUsbId(U_SStream *ss, unsigned short id)
+{
+    unsigned i;
+    char buf[5];
+
+    for (i = 0; i < 4; i++)
+        buf[i] = "0123456789abcdef"[(id >> (12 - i * 4)) & 0xF];
+
+    buf[4] = '\0';
+    U_sstream_put_str(ss, buf);
+}
+
+/*! Prints the devices as JSON array, one object per line.
+
+    The output is built in the arena and written with one call, so that
+    a reader never sees a partial record.
+ */
+static void gcfListDevicesJson(GCF *gcf)
+{
+    unsigned i;
+    unsigned long mark;
+    unsigned long avail;
+    char *buf;
+    Device *dev;
+    U_SStream ss;
+
+    mark = U_arena_mark(&gcf->arena);
+    buf = U_arena_reserve(&gcf->arena, &avail);
+    U_sstream_init(&ss, buf, (unsigned)avail);
+
+    U_sstream_put_str(&ss, "[");
+
+    for (i = 0; i < gcf->devCount; i++)
+    {
+        dev = &gcf->devices[i];
+
+        U_sstream_put_str(&ss, i == 0 ? "\n{\"path\":" : ",\n{\"path\":");
+        gcfPutJsonStr(&ss, dev->path);
+        U_sstream_put_str(&ss, ",\"stable_path\":");
+        gcfPutJsonStr(&ss, dev->stablepath);
+        U_sstream_put_str(&ss, ",\"serial\":");
+        gcfPutJsonStr(&ss, dev->serial);
+        U_sstream_put_str(&ss, ",\"name\":");
+        gcfPutJsonStr(&ss, dev->name);
+        U_sstream_put_str(&ss, ",\"vendor_id\":\"");
+        gcfPutUsbId(&ss, dev->vendorId);
+        U_sstream_put_str(&ss, "\",\"product_id\":\"");
+        gcfPutUsbId(&ss, dev->productId);
+        U_sstream_put_str(&ss, "\",\"usb_path\":");
+        gcfPutJsonStr(&ss, dev->topology);
+        U_sstream_put_str(&ss, ",\"baudrate\":");
+        U_sstream_put_long(&ss, (long)dev->baudrate); /* 0 = unknown */
+        U_sstream_put_str(&ss, "}");
+    }
+
+    U_sstream_put_str(&ss, gcf->devCount ? "\n]\n" : "]\n");
+
+    if (ss.status == U_SSTREAM_OK)
+        PL_Print(buf);
+    else
+        PL_Printf(DBG_INFO, "device list too large\n");
+
+    U_arena_release(&gcf->arena, mark);
+}
+
+static void ST_ListDevices(GCF *gcf, Event event)
+{
+    Device *dev;
+    unsigned i;
+
+    if (event == EV_ACTION)
+    {
+        gcfGetDevices(gcf);
+
+        if (gcf->listJson)
+        {
+            gcfListDevicesJson(gcf);
+            PL_ShutDown();
+            return;
+        }
+
+        if (gcf->devCount == 0)
+        {
+            UI_Printf(gcf, "no devices found\n");
+        }
+
+        UI_Printf(gcf, "Path              | Serial      | Type\n");
+        UI_Printf(gcf, "------------------+-------------+---------------\n");
+
+        for (i = 0; i < gcf->devCount; i++)
+        {
+            dev = &gcf->devices[i];
+            UI_Printf(gcf, "%-18s| %-12s| %s\n", dev->path, dev->serial, dev->name);
+        }
+
+        PL_ShutDown();
+    }
+}
+
+static void ST_Program(GCF *gcf, Event event)
 {
     if (event == EV_ACTION)
     {
@@ -524,14 +1493,16 @@ static void ST_Program(GCF *gcf, Event event)
     }
     else if (event == EV_RESET_SUCCESS)
     {
-        if (gcf->devType == DEV_RASPBEE_1 || gcf->devType == DEV_CONBEE_1)
+        /* UART bridges don't re-enumerate, the bootloader is on the same port */
+        if (gcf->devType == DEV_RASPBEE_1 || gcf->devType == DEV_CONBEE_1 || gcf->devType == DEV_CONBEE_3)
         {
             PL_SetTimeout(5000);
             gcf->state = ST_BootloaderQuery; /* wait for bootloader message */
         }
         else
         {
-            PL_SetTimeout(500);
+            gcf->retry = 0;
+            PL_SetTimeout(gcfBootloaderConnectDelay(gcf));
             gcf->state = ST_BootloaderConnect;
         }
     }
@@ -547,14 +1518,31 @@ static void ST_BootloaderConnect(GCF *gcf, Event event)
     {
         if (PL_Connect(gcf->devpath, gcf->devBaudrate) == GCF_SUCCESS)
         {
+            if (gcf->resetTimeUs != 0)
+            {
+                gcf->reconnectUs = PL_TimeUs() - gcf->resetTimeUs;
+                gcf->resetTimeUs = 0;
+                UI_Printf(gcf, "bootloader port reopened %u ms after reset\n", (unsigned)(gcf->reconnectUs / 1000));
+
+                /* re-enumeration created new sysfs nodes */
+                if (gcf->usbPowerOn)
+                    PL_UsbPowerOn(gcf->devpath);
+            }
+
             gcf->state = ST_BootloaderQuery;
             GCF_HandleEvent(gcf, EV_ACTION);
         }
+        else if (gcf->resetTimeUs != 0 && PL_TimeUs() - gcf->resetTimeUs > (PL_time_t)BTL_CONNECT_MAX * 1000)
+        {
+            UI_Printf(gcf, "bootloader port %s didn't reappear\n", gcf->devpath);
+            gcf->resetTimeUs = 0;
+            gcfRetry(gcf);
+        }
         else
         {
-            // todo retry, a couple of times and revert to gcfRetry()
-            PL_SetTimeout(500);
-            UI_Printf(gcf, "retry connect bootloader %s\n", gcf->devpath);
+            if (gcf->retry++ == 0)
+                UI_Printf(gcf, "retry connect bootloader %s\n", gcf->devpath);
+            PL_SetTimeout(BTL_CONNECT_POLL);
         }
     }
     else if (event == EV_RX_ASCII)
@@ -591,7 +1579,7 @@ static void ST_BootloaderQuery(GCF *gcf, Event event)
             UI_Printf(gcf, "query bootloader failed\n");
             gcfRetry(gcf);
         }
-        else if (gcf->file.gcfFileType < 30)
+        else if (gcfBootloaderGeneration(gcf) == 1)
         {
             /* 2) V1 Bootloader of ConBee II
                   Query the id here, after initial timeout. This also
@@ -605,7 +1593,7 @@ static void ST_BootloaderQuery(GCF *gcf, Event event)
             PROT_Write(buf, sizeof(buf));
             PL_SetTimeout(200);
         }
-        else if (gcf->file.gcfFileType >= 30)
+        else
         {
             /* 3) V3 Bootloader of RaspBee II, Hive
                   Query the id here, after initial timeout. This also
@@ -636,13 +1624,13 @@ static void ST_BootloaderQuery(GCF *gcf, Event event)
     }
     else if (event == EV_RX_BTL_PKG_DATA)
     {
-        if ((unsigned char)gcf->ascii[1] == BTL_ID_RESPONSE)
+        if (gcf->rxFrame[1] == BTL_ID_RESPONSE && gcf->rxFrameLen >= 10)
         {
             unsigned long btlVersion;
             unsigned long appCrc;
 
-            get_u32_le((unsigned char*)&gcf->ascii[2], &btlVersion);
-            get_u32_le((unsigned char*)&gcf->ascii[6], &appCrc);
+            get_u32_le(&gcf->rxFrame[2], &btlVersion);
+            get_u32_le(&gcf->rxFrame[6], &appCrc);
 
             UI_Printf(gcf, "bootloader version 0x%08X, app crc 0x%08X\n\n", btlVersion, appCrc);
 
@@ -725,9 +1713,9 @@ static void ST_V1ProgramUpload(GCF *gcf, Event event)
 {
     if (event == EV_RX_ASCII)
     {
-        unsigned char *end;
-        unsigned char *page;
+        const unsigned char *page;
         unsigned long pageNumber;
+        unsigned long offset;
         unsigned size;
 
         /* Firmware GET requests (6 bytes)
@@ -742,24 +1730,28 @@ static void ST_V1ProgramUpload(GCF *gcf, Event event)
         pageNumber <<= 8;
         pageNumber |= (unsigned char)(gcf->ascii[3] & 0xFF);
 
-        page = &gcf->file.fcontent[GCF_HEADER_SIZE] + pageNumber * V1_PAGESIZE;
-        end = &gcf->file.fcontent[GCF_HEADER_SIZE + gcf->file.gcfFileSize];
+        offset = pageNumber * V1_PAGESIZE;
 
-        Assert(page < end);
-        if (page >= end)
+        Assert(offset < gcf->file.gcfFileSize);
+        if (offset >= gcf->file.gcfFileSize)
         {
             gcfRetry(gcf);
+            return;
         }
 
-        gcf->remaining = (unsigned)(end - page);
+        gcf->remaining = (unsigned)(gcf->file.gcfFileSize - offset);
         size = gcf->remaining > V1_PAGESIZE ? V1_PAGESIZE : gcf->remaining;
 
-        if (pageNumber % 20 == 0 || gcf->remaining < V1_PAGESIZE)
+        page = gcfImageData(gcf, offset, size);
+        if (!page)
         {
-            // UI_Printf(gcf, "GET 0x%04X (page %u)\n", pageNumber, pageNumber);
-            UI_UpdateProgress(gcf);
+            UI_Printf(gcf, "failed to read page %lu\n", pageNumber);
+            gcfRetry(gcf);
+            return;
         }
 
+        UI_UpdateProgress(gcf);
+
         gcf->wp = 0;
         gcf->ascii[0] = '\0';
 
@@ -768,6 +1760,7 @@ static void ST_V1ProgramUpload(GCF *gcf, Event event)
         if ((gcf->remaining - size) == 0)
         {
             gcf->state = ST_V1ProgramValidate;
+            UI_SetState(gcf, UI_STATE_VERIFY);
             UI_Printf(gcf, "\ndone, wait validation...\n");
             PL_SetTimeout(25600);
         }
@@ -793,8 +1786,20 @@ static void ST_V1ProgramValidate(GCF *gcf, Event event)
 
         if (gcf->wp > 6 && U_sstream_find(&ss, "#VALID CRC"))
         {
+            UI_SetState(gcf, UI_STATE_DONE);
             UI_Printf(gcf, FMT_GREEN "firmware successful written\n" FMT_RESET, gcf->ascii);
-            PL_ShutDown();
+
+            if (gcfNextImage(gcf))
+            {
+                /* the bootloader is still running, a timeout falls back to reset */
+                PL_ClearTimeout();
+                gcf->state = gcfBootloaderGeneration(gcf) == 1 ? ST_V1ProgramSync : ST_BootloaderQuery;
+                GCF_HandleEvent(gcf, EV_ACTION);
+            }
+            else
+            {
+                PL_ShutDown();
+            }
         }
         else
         {
@@ -836,9 +1841,9 @@ static void ST_V3ProgramSync(GCF *gcf, Event event)
     }
     else if (event == EV_RX_BTL_PKG_DATA)
     {
-        if ((unsigned char)gcf->ascii[1] == BTL_FW_UPDATE_RESPONSE)
+        if (gcf->rxFrame[1] == BTL_FW_UPDATE_RESPONSE && gcf->rxFrameLen >= 3)
         {
-            if (gcf->ascii[2] == 0x00) /* success */
+            if (gcf->rxFrame[2] == 0x00) /* success */
             {
                 PL_SetTimeout(1000);
                 gcf->state = ST_V3ProgramUpload;
@@ -855,24 +1860,25 @@ static void ST_V3ProgramUpload(GCF *gcf, Event event)
 {
     if (event == EV_RX_BTL_PKG_DATA)
     {
-        if ((unsigned char)gcf->ascii[1] == BTL_FW_DATA_REQUEST && gcf->wp == 8)
+        if (gcf->rxFrame[1] == BTL_FW_DATA_REQUEST && gcf->rxFrameLen == 8)
         {
             unsigned char *buf;
             unsigned char *p;
+            const unsigned char *data;
             unsigned long offset;
             unsigned short length;
             unsigned char status;
 
             PL_SetTimeout(5000);
 
-            get_u32_le((unsigned char*)&gcf->ascii[2], &offset);
-            get_u16_le((unsigned char*)&gcf->ascii[6], &length);
+            get_u32_le(&gcf->rxFrame[2], &offset);
+            get_u16_le(&gcf->rxFrame[6], &length);
 
 #ifndef NDEBUG
             UI_Printf(gcf, "BTL data request, offset: 0x%08X, length: %u\n", offset, length);
 #endif
 
-            buf = (unsigned char*)&gcf->ascii[0];
+            buf = &gcf->txFrame[0];
             p = buf;
 
             *p++ = BTL_MAGIC;
@@ -880,12 +1886,13 @@ static void ST_V3ProgramUpload(GCF *gcf, Event event)
 
             status = 0; // success
             gcf->remaining = 0;
+            data = 0;
 
             if ((offset + length) > gcf->file.gcfFileSize)
             {
                 status = 1; /* error */
             }
-            else if (length > (sizeof(gcf->ascii) - 32))
+            else if (length > BTL_MAX_DATA_LENGTH)
             {
                 status = 2; /* error */
             }
@@ -899,6 +1906,13 @@ static void ST_V3ProgramUpload(GCF *gcf, Event event)
                 gcf->remaining = gcf->file.gcfFileSize - offset;
                 length = length < gcf->remaining ? length : (unsigned short)gcf->remaining;
                 Assert(length > 0);
+
+                data = gcfImageData(gcf, offset, length);
+                if (!data)
+                {
+                    status = 4; /* --stream read error */
+                    gcf->remaining = 0;
+                }
             }
 
             p = put_u8_le(p, &status);
@@ -908,7 +1922,7 @@ static void ST_V3ProgramUpload(GCF *gcf, Event event)
             if (status == 0)
             {
                 Assert(length > 0);
-                U_memcpy(p, &gcf->file.fcontent[GCF_HEADER_SIZE + offset], length);
+                U_memcpy(p, data, length);
                 p += length;
             }
             else
@@ -917,7 +1931,7 @@ static void ST_V3ProgramUpload(GCF *gcf, Event event)
             }
 
             Assert(p > buf);
-            Assert(p < buf + sizeof(gcf->ascii));
+            Assert(p <= buf + BTL_DATA_RESPONSE_HEADER + BTL_MAX_DATA_LENGTH);
 
             PROT_SendFlagged(buf, (unsigned)(p - buf));
 
@@ -925,6 +1939,7 @@ static void ST_V3ProgramUpload(GCF *gcf, Event event)
 
             if (gcf->remaining == length)
             {
+                UI_SetState(gcf, UI_STATE_VERIFY);
                 UI_Printf(gcf, "\ndone, wait (up to 20 seconds) for verification\n");
                 PL_SetTimeout(20000);
                 gcf->state = ST_V3ProgramWaitID;
@@ -932,7 +1947,7 @@ static void ST_V3ProgramUpload(GCF *gcf, Event event)
         }
         else
         {
-            PL_Printf(DBG_DEBUG, "unexpected command %02X\n", (unsigned char)gcf->ascii[1]);
+            PL_Printf(DBG_DEBUG, "unexpected command %02X\n", gcf->rxFrame[1]);
         }
     }
     else if (event == EV_TIMEOUT)
@@ -945,13 +1960,13 @@ static void ST_V3ProgramWaitID(GCF *gcf, Event event)
 {
     if (event == EV_RX_BTL_PKG_DATA)
     {
-        if ((unsigned char)gcf->ascii[1] == BTL_ID_RESPONSE)
+        if (gcf->rxFrame[1] == BTL_ID_RESPONSE && gcf->rxFrameLen >= 10)
         {
             unsigned long btlVersion;
             unsigned long appCrc;
 
-            get_u32_le((unsigned char*)&gcf->ascii[2], &btlVersion);
-            get_u32_le((unsigned char*)&gcf->ascii[6], &appCrc);
+            get_u32_le(&gcf->rxFrame[2], &btlVersion);
+            get_u32_le(&gcf->rxFrame[6], &appCrc);
 
             if (gcf->file.gcfCrc32 != 0)
             {
@@ -965,8 +1980,20 @@ static void ST_V3ProgramWaitID(GCF *gcf, Event event)
                 }
             }
 
+            UI_SetState(gcf, UI_STATE_DONE);
             UI_Printf(gcf, "finished\n");
-            PL_ShutDown();
+
+            if (gcfNextImage(gcf))
+            {
+                /* the ID response means the bootloader accepts the next update request */
+                PL_ClearTimeout();
+                gcf->state = gcfBootloaderGeneration(gcf) == 3 ? ST_V3ProgramSync : ST_BootloaderQuery;
+                GCF_HandleEvent(gcf, EV_ACTION);
+            }
+            else
+            {
+                PL_ShutDown();
+            }
         }
     }
     else if (event == EV_TIMEOUT)
@@ -977,11 +2004,30 @@ static void ST_V3ProgramWaitID(GCF *gcf, Event event)
 
 static void ST_Connect(GCF *gcf, Event event)
 {
+    int port;
+    unsigned i;
+    PL_Baudrate baudrate;
+
     if (event == EV_ACTION)
     {
         if (PL_Connect(gcf->devpath, gcf->devBaudrate) == GCF_SUCCESS)
         {
             gcf->state = ST_Connected;
+            gcfResetMonitorRx(gcf);
+
+            if (gcf->monitorCount > 0)
+                UI_Printf(gcf, "[0] %s\n", gcf->devpath);
+
+            for (i = 0; i < gcf->monitorCount; i++)
+            {
+                gcfDeviceTypeFromPath(gcf->monitorPaths[i], &baudrate);
+                port = PL_ConnectMonitor(gcf->monitorPaths[i], baudrate);
+                if (port > 0)
+                    UI_Printf(gcf, "[%d] %s\n", port, gcf->monitorPaths[i]);
+                else
+                    UI_Printf(gcf, "failed to connect %s\n", gcf->monitorPaths[i]);
+            }
+
             PL_SetTimeout(1000);
         }
         else
@@ -1009,30 +2055,536 @@ static void ST_Connected(GCF *gcf, Event event)
     }
 }
 
-GCF *GCF_Init(int argc, char *argv[])
+/*! Forwards traffic between the device and a pty, only decoding is done here. */
+static void ST_Proxy(GCF *gcf, Event event)
 {
-    GCF *gcf;
-
-    gcf = &gcfLocal;
-
-    U_bzero(&gcf->rxstate, sizeof(gcf->rxstate));
-    gcf->startTime = PL_Time();
-    gcf->maxTime = 0;
-    gcf->devCount = 0;
-    gcf->task = T_NONE;
-    gcf->state = ST_Init;
-    gcf->substate = ST_Void;
-    gcf->argc = argc;
-    gcf->argv = argv;
-    gcf->wp = 0;
-    gcf->ascii[0] = '\0';
+    int port;
 
-    return gcf;
-}
+    if (event == EV_ACTION)
+    {
+        if (PL_Connect(gcf->devpath, gcf->devBaudrate) == GCF_FAILED)
+        {
+            gcf->state = ST_Init;
+            UI_Printf(gcf, "failed to connect\n");
+            PL_SetTimeout(10000);
+            return;
+        }
 
-void GCF_Exit(GCF *gcf)
-{
-    (void)gcf;
+        gcfResetMonitorRx(gcf);
+        port = PL_ConnectProxy(gcf->proxyLink);
+        if (port > 0)
+        {
+            UI_Printf(gcf, "proxy %s <--> %s\n", gcf->devpath, gcf->proxyLink);
+        }
+        else
+        {
+            UI_Printf(gcf, "failed to create proxy %s\n", gcf->proxyLink);
+            PL_ShutDown();
+        }
+    }
+    else if (event == EV_DISCONNECTED)
+    {
+        gcf->state = ST_Init;
+        UI_Printf(gcf, "disconnected\n");
+        PL_SetTimeout(1000);
+    }
+}
+
+/* Frame \p seq of \p phase, every 4th frame consists of escaped bytes only. */
+static unsigned gcfSelftestFill(unsigned char *frame, unsigned phase, unsigned seq)
+{
+    unsigned i;
+    unsigned len;
+
+    seq &= 0xFFFF;
+    if (phase == SELFTEST_PHASE_LATENCY)
+        len = SELFTEST_PING_LENGTH;
+    else /* all lengths in turn */
+        len = SELFTEST_HEADER + (seq * 37) % (SELFTEST_MAX_PAYLOAD - SELFTEST_HEADER + 1);
+
+    frame[0] = SELFTEST_MAGIC;
+    frame[1] = (unsigned char)phase;
+    frame[2] = seq & 0xFF;
+    frame[3] = (seq >> 8) & 0xFF;
+
+    for (i = SELFTEST_HEADER; i < len; i++)
+    {
+        if ((seq & 3) == 0)
+            frame[i] = (i & 1) ? 0xDB : 0xC0; /* ESC and END */
+        else
+            frame[i] = (unsigned char)(seq * 7 + i * 13);
+    }
+
+    return len;
+}
+
+/* \returns The number of bytes PROT_SendFlagged() puts on the wire for \p data. */
+static unsigned gcfSelftestWireLength(const unsigned char *data, unsigned len)
+{
+    unsigned i;
+    unsigned n;
+    unsigned short crc;
+
+    n = 2; /* END before and after */
+    crc = 0;
+    for (i = 0; i < len; i++)
+    {
+        crc += data[i];
+        n += (data[i] == 0xC0 || data[i] == 0xDB) ? 2 : 1;
+    }
+
+    crc = (unsigned short)(~crc + 1);
+    n += ((crc & 0xFF) == 0xC0 || (crc & 0xFF) == 0xDB) ? 2 : 1;
+    n += (((crc >> 8) & 0xFF) == 0xC0 || ((crc >> 8) & 0xFF) == 0xDB) ? 2 : 1;
+
+    return n;
+}
+
+static void gcfSelftestSend(GCF *gcf)
+{
+    unsigned len;
+    GCF_Selftest *st = gcf->selftest;
+
+    len = gcfSelftestFill(st->frame, st->phase, st->txSeq);
+    st->txSeq++;
+    st->sentUs = PL_TimeUs();
+    PROT_SendFlagged(st->frame, len);
+}
+
+/* \returns The \p percent percentile of the sorted round trip times. */
+static unsigned long gcfSelftestPercentile(const GCF_Selftest *st, unsigned percent)
+{
+    unsigned i;
+
+    i = (st->rttCount * percent) / 100;
+    if (i >= st->rttCount)
+        i = st->rttCount - 1;
+
+    return st->rtt[i];
+}
+
+static void gcfSelftestReport(GCF *gcf)
+{
+    unsigned i;
+    unsigned k;
+    int pass;
+    unsigned long v;
+    unsigned long rate;
+    unsigned long lineRate;
+    unsigned long minRate;
+    unsigned long maxRtt;
+    GCF_Selftest *st = gcf->selftest;
+
+    PL_ClearTimeout();
+
+    lineRate = (unsigned long)(gcf->devBaudrate ? gcf->devBaudrate : PL_BAUDRATE_115200) / 10; /* 8N1 */
+    minRate = gcf->selftestMinRate ? gcf->selftestMinRate : lineRate * SELFTEST_MIN_RATE / 100;
+    maxRtt = gcf->selftestMaxRttUs ? gcf->selftestMaxRttUs : SELFTEST_MAX_RTT * 1000;
+
+    rate = 0;
+    if (st->endUs > st->startUs)
+        rate = (unsigned long)(st->wireBytes * 1000000 / (st->endUs - st->startUs));
+
+    /* insertion sort, a few hundred entries */
+    for (i = 1; i < st->rttCount; i++)
+    {
+        v = st->rtt[i];
+        for (k = i; k > 0 && st->rtt[k - 1] > v; k--)
+            st->rtt[k] = st->rtt[k - 1];
+        st->rtt[k] = v;
+    }
+
+    UI_Printf(gcf, "selftest: framing %lu frames, %lu lost, %lu corrupt\n", st->frames, st->lost, st->corrupt);
+
+    pass = st->lost == 0 && st->corrupt == 0 && st->rttCount == SELFTEST_ROUNDS && rate >= minRate;
+
+    if (st->rttCount > 0)
+    {
+        UI_Printf(gcf, "selftest: latency %u round trips of %u bytes, min/p50/p95/p99/max: %lu/%lu/%lu/%lu/%lu us (limit p99 <= %lu us)\n",
+                  st->rttCount, SELFTEST_PING_LENGTH, st->rtt[0],
+                  gcfSelftestPercentile(st, 50), gcfSelftestPercentile(st, 95),
+                  gcfSelftestPercentile(st, 99), st->rtt[st->rttCount - 1], maxRtt);
+
+        if (gcfSelftestPercentile(st, 99) > maxRtt)
+            pass = 0;
+    }
+
+    UI_Printf(gcf, "selftest: throughput %lu.%03lu kB/s on the wire, %lu%% of the line rate (limit >= %lu.%03lu kB/s)\n",
+              rate / 1000, rate % 1000, rate * 100 / lineRate, minRate / 1000, minRate % 1000);
+
+    if (pass)
+    {
+        UI_Printf(gcf, FMT_GREEN "selftest: PASS\n" FMT_RESET);
+    }
+    else
+    {
+        UI_Printf(gcf, "selftest: FAIL\n");
+        gcf->exitCode = 1;
+    }
+
+    gcf->state = ST_Void;
+    PL_ShutDown();
+}
+
+/* Sends the next frame(s) of the current phase or moves on to the next phase. */
+static void gcfSelftestNext(GCF *gcf)
+{
+    PL_time_t now;
+    GCF_Selftest *st = gcf->selftest;
+
+    now = PL_TimeUs();
+
+    if (st->phase == SELFTEST_PHASE_LATENCY)
+    {
+        if (st->txSeq < SELFTEST_ROUNDS)
+        {
+            gcfSelftestSend(gcf);
+            PL_SetTimeout(SELFTEST_RX_TIMEOUT);
+            return;
+        }
+
+        st->phase = SELFTEST_PHASE_THROUGHPUT;
+        st->txSeq = 0;
+        st->rxSeq = 0;
+        st->startUs = now;
+        st->endUs = now;
+    }
+
+    if (now - st->startUs < (PL_time_t)SELFTEST_DURATION * 1000)
+    {
+        while (st->txSeq - st->rxSeq < SELFTEST_WINDOW)
+            gcfSelftestSend(gcf);
+
+        PL_SetTimeout(SELFTEST_RX_TIMEOUT);
+    }
+    else if (st->txSeq == st->rxSeq)
+    {
+        gcfSelftestReport(gcf);
+    }
+}
+
+/*! Checks an echoed frame against the sent one. */
+static void gcfSelftestFrame(GCF *gcf, const unsigned char *data, unsigned len)
+{
+    unsigned i;
+    unsigned gap;
+    unsigned elen;
+    PL_time_t now;
+    GCF_Selftest *st = gcf->selftest;
+
+    if (!st || gcf->state != ST_Selftest)
+        return;
+
+    now = PL_TimeUs();
+
+    if (len < SELFTEST_HEADER || data[0] != SELFTEST_MAGIC || data[1] != st->phase)
+    {
+        st->corrupt++;
+        return;
+    }
+
+    /* frames in flight which were skipped are lost */
+    gap = ((unsigned)data[2] | (unsigned)data[3] << 8) - (st->rxSeq & 0xFFFF);
+    gap &= 0xFFFF;
+    if (gap >= st->txSeq - st->rxSeq)
+    {
+        st->corrupt++; /* not in flight */
+        return;
+    }
+
+    st->lost += gap;
+    st->rxSeq += gap;
+
+    elen = gcfSelftestFill(st->frame, st->phase, st->rxSeq);
+    st->rxSeq++;
+
+    for (i = 0; i < len && len == elen; i++)
+    {
+        if (data[i] != st->frame[i])
+            break;
+    }
+
+    if (i != elen)
+    {
+        st->corrupt++;
+    }
+    else
+    {
+        st->frames++;
+        if (st->phase == SELFTEST_PHASE_LATENCY)
+        {
+            st->rtt[st->rttCount++] = (unsigned long)(now - st->sentUs);
+        }
+        else
+        {
+            st->wireBytes += gcfSelftestWireLength(data, len);
+            st->endUs = now;
+        }
+    }
+
+    gcfSelftestNext(gcf);
+}
+
+/*! Measures the host serial path: frame echos of a loopback-wired adapter (-d)
+    or of a pty pair. The latency phase has one frame in flight, the throughput
+    phase keeps SELFTEST_WINDOW frames of all lengths in flight.
+ */
+static void ST_Selftest(GCF *gcf, Event event)
+{
+    GCF_Status status;
+    PL_Baudrate baudrate;
+    GCF_Selftest *st;
+
+    if (event == EV_ACTION)
+    {
+        baudrate = gcf->devBaudrate ? gcf->devBaudrate : PL_BAUDRATE_115200;
+
+        if (gcf->devpath[0] != '\0')
+            status = PL_Connect(gcf->devpath, baudrate);
+        else
+            status = PL_ConnectLoopback(baudrate);
+
+        if (status != GCF_SUCCESS)
+        {
+            UI_Printf(gcf, "failed to connect\n");
+            gcf->exitCode = 1;
+            PL_ShutDown();
+            return;
+        }
+
+        st = gcf->selftest;
+        U_bzero(st, sizeof(*st));
+        st->phase = SELFTEST_PHASE_LATENCY;
+
+        UI_Printf(gcf, "selftest: %s, %d baud\n", gcf->devpath[0] ? gcf->devpath : "pty loopback", (int)baudrate);
+        gcfSelftestNext(gcf);
+    }
+    else if (event == EV_TIMEOUT)
+    {
+        st = gcf->selftest;
+        UI_Printf(gcf, "selftest: no echo for %d ms%s\n", SELFTEST_RX_TIMEOUT,
+                  st->frames == 0 ? ", is TX connected to RX?" : "");
+        st->lost += st->txSeq - st->rxSeq;
+        gcfSelftestReport(gcf);
+    }
+    else if (event == EV_DISCONNECTED)
+    {
+        UI_Printf(gcf, "disconnected\n");
+        gcf->exitCode = 1;
+        PL_ShutDown();
+    }
+}
+
+GCF *GCF_Init(int argc, char *argv[])
+{
+    GCF *gcf;
+
+    gcf = &gcfLocal;
+
+    U_arena_init(&gcf->arena, gcfArenaMem, sizeof(gcfArenaMem));
+    gcf->uiLines = U_arena_alloc(&gcf->arena, UI_MAX_LINES * sizeof(UI_Line));
+    gcf->uiRows = U_arena_alloc(&gcf->arena, UI_MAX_ROWS * sizeof(UI_Row));
+    U_bzero(gcf->uiRows, UI_MAX_ROWS * sizeof(UI_Row));
+    gcf->uiTerminal = UI_IsTerminal();
+    gcf->uiRowLine = 0;
+    gcf->uiDrawUs = 0;
+    gcf->devices = U_arena_alloc(&gcf->arena, MAX_DEVICES * sizeof(Device));
+    gcf->images = U_arena_alloc(&gcf->arena, GCF_MAX_IMAGES * sizeof(GCF_Image));
+    gcf->imageCount = 0;
+    gcf->imageIndex = 0;
+    gcf->txFrame = U_arena_alloc(&gcf->arena, BTL_DATA_RESPONSE_HEADER + BTL_MAX_DATA_LENGTH);
+    /* allocated before any file, gcfReadFile() replaces the file at the end of the arena;
+       pages of the unused ones are never touched */
+    gcf->monitorRx = U_arena_alloc(&gcf->arena, (MAX_CONNECT_PORTS - 1) * sizeof(PROT_RxState)); /* -c and -p */
+    gcf->selftest = U_arena_alloc(&gcf->arena, sizeof(GCF_Selftest)); /* --selftest */
+    gcf->stream = U_arena_alloc(&gcf->arena, sizeof(GCF_Stream)); /* --stream */
+    Assert(gcf->monitorRx && gcf->selftest && gcf->stream);
+    gcf->stream->file = -1;
+    gcf->file.fcontent = 0;
+    gcf->file.fcontentSize = 0;
+    gcf->file.fsize = 0;
+
+    U_bzero(&gcf->rxstate, sizeof(gcf->rxstate));
+    gcf->startTime = PL_Time();
+    gcf->maxTime = 0;
+    gcf->devCount = 0;
+    gcf->task = T_NONE;
+    gcf->state = ST_Init;
+    gcf->substate = ST_Void;
+    gcf->argc = argc;
+    gcf->argv = argv;
+    gcf->exitCode = 0;
+    gcf->wp = 0;
+    gcf->ascii[0] = '\0';
+    gcf->rxFrameLen = 0;
+    gcf->rxFrame = 0;
+    gcf->rxPort = 0;
+    gcf->monitorCount = 0;
+    gcf->proxyLink = 0;
+    gcf->dryRun = 0;
+    gcf->rttUs = 1000;
+    gcf->simChunkSize = 256;
+    gcf->simRxBuffer = 0;
+    gcf->simRxRate = 0;
+    gcf->pace = 0;
+    gcf->paceRate = 0;
+    gcf->usbPowerOn = 0;
+    gcf->resetTimeUs = 0;
+    gcf->reconnectUs = 0;
+    gcf->ioStats = 0;
+    gcf->stats = 0;
+    gcf->listJson = 0;
+    gcf->streamMode = 0;
+    gcf->maxRssKb = 0;
+    gcf->replay = 0;
+    gcf->portWaitMs = 0;
+    gcf->handoff = 0;
+
+    return gcf;
+}
+
+/*! Prints the resource usage of the run (--stats, --stats-json). */
+static void gcfPrintStats(GCF *gcf)
+{
+    PL_IoStats io;
+    PL_Usage usage;
+    PL_UartStats uart;
+    U_SStream ss;
+    char buf[896];
+
+    PL_GetIoStats(&io);
+    PL_GetUartStats(&uart);
+    U_bzero(&usage, sizeof(usage));
+    PL_GetUsage(&usage);
+
+    U_sstream_init(&ss, buf, sizeof(buf));
+
+    if (gcf->stats == 2)
+    {
+        /* one line of JSON, keys stay stable for scripts */
+        U_sstream_put_str(&ss, "{\"elapsed_ms\":");
+        U_sstream_put_ulonglong(&ss, PL_Time() - gcf->startTime);
+        U_sstream_put_str(&ss, ",\"cpu_user_us\":");
+        U_sstream_put_ulonglong(&ss, usage.userUs);
+        U_sstream_put_str(&ss, ",\"cpu_system_us\":");
+        U_sstream_put_ulonglong(&ss, usage.systemUs);
+        U_sstream_put_str(&ss, ",\"ctx_voluntary\":");
+        U_sstream_put_ulonglong(&ss, usage.voluntarySwitches);
+        U_sstream_put_str(&ss, ",\"ctx_involuntary\":");
+        U_sstream_put_ulonglong(&ss, usage.involuntarySwitches);
+        U_sstream_put_str(&ss, ",\"max_rss_kb\":");
+        U_sstream_put_ulonglong(&ss, usage.maxRssKb);
+        U_sstream_put_str(&ss, ",\"io_backend\":\"");
+        U_sstream_put_str(&ss, io.backend);
+        U_sstream_put_str(&ss, "\",\"loops\":");
+        U_sstream_put_ulonglong(&ss, io.loops);
+        U_sstream_put_str(&ss, ",\"idle_wakeups\":");
+        U_sstream_put_ulonglong(&ss, io.idle);
+        U_sstream_put_str(&ss, ",\"waits\":");
+        U_sstream_put_ulonglong(&ss, io.waits);
+        U_sstream_put_str(&ss, ",\"reads\":");
+        U_sstream_put_ulonglong(&ss, io.reads);
+        U_sstream_put_str(&ss, ",\"writes\":");
+        U_sstream_put_ulonglong(&ss, io.writes);
+        U_sstream_put_str(&ss, ",\"io_uring_enter\":");
+        U_sstream_put_ulonglong(&ss, io.enters);
+        U_sstream_put_str(&ss, ",\"rx_bytes\":");
+        U_sstream_put_ulonglong(&ss, io.rxBytes);
+        U_sstream_put_str(&ss, ",\"tx_bytes\":");
+        U_sstream_put_ulonglong(&ss, io.txBytes);
+        U_sstream_put_str(&ss, ",\"pace_waits\":");
+        U_sstream_put_ulonglong(&ss, io.paceWaits);
+        U_sstream_put_str(&ss, ",\"file_reads\":");
+        U_sstream_put_ulonglong(&ss, gcf->stream->reads);
+        U_sstream_put_str(&ss, ",\"uart_supported\":");
+        U_sstream_put_str(&ss, uart.supported ? "true" : "false");
+        U_sstream_put_str(&ss, ",\"uart_rx\":");
+        U_sstream_put_ulonglong(&ss, uart.rx);
+        U_sstream_put_str(&ss, ",\"uart_tx\":");
+        U_sstream_put_ulonglong(&ss, uart.tx);
+        U_sstream_put_str(&ss, ",\"uart_overrun\":");
+        U_sstream_put_ulonglong(&ss, uart.overrun);
+        U_sstream_put_str(&ss, ",\"uart_buf_overrun\":");
+        U_sstream_put_ulonglong(&ss, uart.bufOverrun);
+        U_sstream_put_str(&ss, ",\"uart_frame\":");
+        U_sstream_put_ulonglong(&ss, uart.frame);
+        U_sstream_put_str(&ss, ",\"uart_parity\":");
+        U_sstream_put_ulonglong(&ss, uart.parity);
+        U_sstream_put_str(&ss, ",\"uart_break\":");
+        U_sstream_put_ulonglong(&ss, uart.brk);
+        U_sstream_put_str(&ss, ",\"exit_code\":");
+        U_sstream_put_long(&ss, gcf->exitCode);
+        U_sstream_put_str(&ss, "}\n");
+        PL_Print(buf);
+        return;
+    }
+
+    PL_Printf(DBG_INFO, "stats: %lu ms, cpu user %llu.%03llu ms, system %llu.%03llu ms, context switches %lu voluntary, %lu involuntary, peak rss %lu kB\n",
+              (unsigned long)(PL_Time() - gcf->startTime),
+              usage.userUs / 1000, usage.userUs % 1000, usage.systemUs / 1000, usage.systemUs % 1000,
+              usage.voluntarySwitches, usage.involuntarySwitches, usage.maxRssKb);
+    PL_Printf(DBG_INFO, "stats: %s loop %lu iterations, %lu idle wakeups, %lu syscalls (wait: %lu, read: %lu, write: %lu, io_uring_enter: %lu), rx %llu bytes, tx %llu bytes, %lu pacing waits\n",
+              io.backend, io.loops, io.idle, io.waits + io.reads + io.writes + io.enters,
+              io.waits, io.reads, io.writes, io.enters, io.rxBytes, io.txBytes, io.paceWaits);
+
+    if (gcf->streamMode)
+    {
+        PL_Printf(DBG_INFO, "stats: stream %lu file reads, %llu bytes, cache %u bytes\n",
+                  gcf->stream->reads, gcf->stream->readBytes, STREAM_CACHE_SIZE);
+    }
+
+    if (uart.supported)
+    {
+        PL_Printf(DBG_INFO, "stats: uart rx %lu, tx %lu, overrun %lu, buffer overrun %lu, frame %lu, parity %lu, break %lu\n",
+                  uart.rx, uart.tx, uart.overrun, uart.bufOverrun, uart.frame, uart.parity, uart.brk);
+    }
+    else
+    {
+        PL_Printf(DBG_INFO, "stats: uart counters not supported by the driver\n");
+    }
+}
+
+int GCF_Exit(GCF *gcf)
+{
+    if (gcf->usbPowerOn)
+        PL_UsbPowerRestore();
+
+    if (gcf->dryRun && SIM_Active() && SIM_Report() != 0)
+        gcf->exitCode = 1;
+
+    if (gcf->replay && REC_Report() != 0)
+        gcf->exitCode = 1;
+
+    REC_Close();
+
+    PL_CloseFile(gcf->stream->file);
+
+    if (gcf->maxRssKb != 0)
+    {
+        PL_Usage usage;
+
+        U_bzero(&usage, sizeof(usage));
+        if (PL_GetUsage(&usage) == 0 && usage.maxRssKb > gcf->maxRssKb)
+        {
+            PL_Printf(DBG_INFO, "peak rss %lu kB exceeds --max-rss %lu kB\n", usage.maxRssKb, gcf->maxRssKb);
+            gcf->exitCode = 1;
+        }
+    }
+
+    if (gcf->ioStats)
+    {
+        PL_IoStats io;
+
+        PL_GetIoStats(&io);
+        PL_Printf(DBG_INFO, "io: %s, %lu syscalls (wait: %lu, read: %lu, write: %lu, io_uring_enter: %lu)\n",
+                  io.backend, io.waits + io.reads + io.writes + io.enters,
+                  io.waits, io.reads, io.writes, io.enters);
+    }
+
+    if (gcf->stats)
+        gcfPrintStats(gcf);
+
+    return gcf->exitCode;
 }
 
 void GCF_HandleEvent(GCF *gcf, Event event)
@@ -1071,7 +2623,7 @@ int GCF_ParseFile(GCF_File *file)
         return -1;
     }
 
-    U_bstream_init(bs, file->fcontent, file->fsize);
+    U_bstream_init(bs, file->fcontent, file->fcontentSize);
 
     Assert(file->fname[0] != '\0');
 
@@ -1231,9 +2783,24 @@ void GCF_Received(GCF *gcf, const unsigned char *data, int len)
         }
     }
 
+    gcf->rxPort = 0;
     PROT_ReceiveFlagged(&gcf->rxstate, data, len);
 }
 
+void GCF_ReceivedPort(GCF *gcf, unsigned port, const unsigned char *data, int len)
+{
+    Assert(len > 0);
+    Assert(port > 0 && port < MAX_CONNECT_PORTS);
+
+    if (port == 0 || port >= MAX_CONNECT_PORTS || !gcf->monitorRx)
+        return;
+
+    /* monitor ports are only decoded, they don't drive the state machine */
+    gcf->rxPort = port;
+    PROT_ReceiveFlagged(&gcf->monitorRx[port - 1], data, (unsigned)len);
+    gcf->rxPort = 0;
+}
+
 void PROT_Packet(const unsigned char *data, unsigned len)
 {
     Assert(len > 0);
@@ -1241,23 +2808,52 @@ void PROT_Packet(const unsigned char *data, unsigned len)
     int i;
     char *p;
     GCF *gcf = &gcfLocal;
+    char hex[PROT_MAX_FRAME_SIZE * 2 + 1]; /* not in gcf->ascii, which may hold pending bootloader text */
 
+    if (gcf->task == T_SELFTEST)
+    {
+        gcfSelftestFrame(gcf, data, len);
+        return;
+    }
 
-    if (data[0] != BTL_MAGIC && gcf->task == T_CONNECT)
+    if (data[0] != BTL_MAGIC && (gcf->task == T_CONNECT || gcf->task == T_PROXY))
     {
-        p = &gcf->ascii[0];
+        p = &hex[0];
         for (i = 0; i < (int)len; i++, p += 2)
         {
             put_hex(data[i], p);
         }
         *p = '\0';
-        UI_Printf(gcf, "packet: %d bytes, %s\n", len, gcf->ascii);
+
+        if (gcf->task == T_PROXY)
+        {
+            /* port 0: device --> host, pty port: host --> device */
+            PL_time_t t = PL_Time() - gcf->startTime;
+            UI_Printf(gcf, "%5u.%03u %s packet: %d bytes, %s\n",
+                      (unsigned)(t / 1000), (unsigned)(t % 1000), gcf->rxPort == 0 ? "dev" : "host", len, hex);
+        }
+        else if (gcf->monitorCount > 0)
+        {
+            /* frames of all ports are printed in order of arrival */
+            PL_time_t t = PL_Time() - gcf->startTime;
+            UI_Printf(gcf, "%5u.%03u [%u] packet: %d bytes, %s\n",
+                      (unsigned)(t / 1000), (unsigned)(t % 1000), gcf->rxPort, len, hex);
+        }
+        else
+        {
+            UI_Printf(gcf, "packet: %d bytes, %s\n", len, hex);
+        }
     }
     else
     {
         gcfDebugHex(gcf, "recv_packet", data, len);
     }
 
+    if (gcf->rxPort != 0)
+    {
+        return; /* monitor port */
+    }
+
     if (data[0] == 0x0B && len >= 8) /* write parameter response */
     {
         switch (data[7])
@@ -1271,17 +2867,49 @@ void PROT_Packet(const unsigned char *data, unsigned len)
                 break;
         }
     }
-    else if (data[0] == BTL_MAGIC)
+    else if (data[0] == 0x07 && len >= 6) /* device state response */
     {
-        if (len < sizeof(gcf->ascii))
-        {
-            U_memcpy(&gcf->ascii[0], data, len);
-            gcf->wp = len;
-            GCF_HandleEvent(gcf, EV_RX_BTL_PKG_DATA);
-        }
+        GCF_HandleEvent(gcf, EV_PKG_DEVICE_STATE);
+    }
+    else if (data[0] == BTL_MAGIC && len >= 2)
+    {
+        /* the handlers read the frame in place, the decoder buffer isn't touched until they return */
+        gcf->rxFrame = data;
+        gcf->rxFrameLen = len;
+        GCF_HandleEvent(gcf, EV_RX_BTL_PKG_DATA);
+        gcf->rxFrame = 0;
+        gcf->rxFrameLen = 0;
     }
 }
 
+/*! Guesses the device type and baudrate from substrings of the device \p path. */
+static DeviceType gcfDeviceTypeFromPath(const char *path, PL_Baudrate *baudrate)
+{
+    U_SStream ss;
+    DeviceType result;
+
+    result = DEV_UNKNOWN;
+    *baudrate = PL_BAUDRATE_UNKNOWN;
+
+    if (path[0] == '\0')
+        return result;
+
+    U_sstream_init(&ss, (void*)path, U_strlen(path));
+
+    if      (U_sstream_find(&ss, "ttyACM"))        { result = DEV_CONBEE_2; *baudrate = PL_BAUDRATE_115200; }
+    else if (U_sstream_find(&ss, "ConBee_II"))     { result = DEV_CONBEE_2; *baudrate = PL_BAUDRATE_115200; }
+    else if (U_sstream_find(&ss, "cu.usbmodemDE")) { result = DEV_CONBEE_2; *baudrate = PL_BAUDRATE_115200; }
+    else if (U_sstream_find(&ss, "ttyUSB"))        { result = DEV_CONBEE_1; *baudrate = PL_BAUDRATE_38400; }
+    else if (U_sstream_find(&ss, "usb-FTDI"))      { result = DEV_CONBEE_1; *baudrate = PL_BAUDRATE_38400; }
+    else if (U_sstream_find(&ss, "cu.usbserial"))  { result = DEV_CONBEE_1; *baudrate = PL_BAUDRATE_38400; }
+    else if (U_sstream_find(&ss, "ttyAMA"))        { result = DEV_RASPBEE_1; *baudrate = PL_BAUDRATE_38400; }
+    else if (U_sstream_find(&ss, "ttyAML"))        { result = DEV_RASPBEE_1; *baudrate = PL_BAUDRATE_38400; } /* Odroid */
+    else if (U_sstream_find(&ss, "ttyS"))          { result = DEV_RASPBEE_1; *baudrate = PL_BAUDRATE_38400; }
+    else if (U_sstream_find(&ss, "/serial"))       { result = DEV_RASPBEE_1; *baudrate = PL_BAUDRATE_38400; }
+
+    return result;
+}
+
 static DeviceType gcfGetDeviceType(GCF *gcf)
 {
     int ftype;
@@ -1289,26 +2917,41 @@ static DeviceType gcfGetDeviceType(GCF *gcf)
     DeviceType result;
     PL_Baudrate baudrate;
 
-    result = DEV_UNKNOWN;
     ftype = gcf->file.gcfFileType;
-    baudrate = PL_BAUDRATE_UNKNOWN;
 
-    if (gcf->devpath[0] != '\0')
+    if (gcf->devProfile)
     {
-        U_sstream_init(&ss, &gcf->devpath[0], U_strlen(&gcf->devpath[0]));
+        /* the USB identity is authoritative, only a Hive container changes it */
+        result = ftype == 60 ? DEV_HIVE : gcf->devProfile->devType;
+        gcf->devReset = gcf->devProfile->reset;
+        baudrate = gcf->devProfile->baudrate;
+
+        PL_Printf(DBG_DEBUG, "device profile %04X:%04X %s\n", gcf->devProfile->vendorId, gcf->devProfile->productId,
+                  gcf->devProfile->model ? gcf->devProfile->model : "");
+
+        /* the generic FTDI profile matches any FT230X, as before a file which isn't for ConBee I rules it out */
+        if (result == DEV_CONBEE_1 && ftype > 9)
+        {
+            result = DEV_UNKNOWN;
+            gcf->devReset = GCF_RESET_UART;
+            baudrate = PL_BAUDRATE_38400;
+        }
+
+        if (gcf->devBaudrate == PL_BAUDRATE_UNKNOWN)
+            gcf->devBaudrate = baudrate;
+
+        return result;
+    }
+
+    /* fallback for devices without USB identity, e.g. RaspBee or -d paths not found by enumeration */
+    result = gcfDeviceTypeFromPath(&gcf->devpath[0], &baudrate);
 
-        if      (U_sstream_find(&ss, "ttyACM"))        { result = DEV_CONBEE_2; baudrate = PL_BAUDRATE_115200; }
-        else if (U_sstream_find(&ss, "ConBee_II"))     { result = DEV_CONBEE_2; baudrate = PL_BAUDRATE_115200; }
-        else if (U_sstream_find(&ss, "cu.usbmodemDE")) { result = DEV_CONBEE_2; baudrate = PL_BAUDRATE_115200; }
-        else if (U_sstream_find(&ss, "ttyUSB"))        { result = DEV_CONBEE_1; baudrate = PL_BAUDRATE_38400; }
-        else if (U_sstream_find(&ss, "usb-FTDI"))      { result = DEV_CONBEE_1; baudrate = PL_BAUDRATE_38400; }
-        else if (U_sstream_find(&ss, "cu.usbserial"))  { result = DEV_CONBEE_1; baudrate = PL_BAUDRATE_38400; }
-        else if (U_sstream_find(&ss, "ttyAMA"))        { result = DEV_RASPBEE_1; baudrate = PL_BAUDRATE_38400; }
-        else if (U_sstream_find(&ss, "ttyAML"))        { result = DEV_RASPBEE_1; baudrate = PL_BAUDRATE_38400; } /* Odroid */
-        else if (U_sstream_find(&ss, "ttyS"))          { result = DEV_RASPBEE_1; baudrate = PL_BAUDRATE_38400; }
-        else if (U_sstream_find(&ss, "/serial"))       { result = DEV_RASPBEE_1; baudrate = PL_BAUDRATE_38400; }
 #ifdef _WIN32
-        else if (U_sstream_find(&ss, "COM"))
+    if (result == DEV_UNKNOWN && gcf->devpath[0] != '\0')
+    {
+        U_sstream_init(&ss, &gcf->devpath[0], U_strlen(&gcf->devpath[0]));
+
+        if (U_sstream_find(&ss, "COM"))
         {
             if (ftype == 1 && gcf->file.gcfTargetAddress == 0)
             {
@@ -1321,26 +2964,113 @@ static DeviceType gcfGetDeviceType(GCF *gcf)
                 baudrate = PL_BAUDRATE_115200;
             }
         }
-#endif
     }
+#else
+    (void)ss;
+#endif
 
     /* further detemine detive type from the GCF header */
     if      (ftype == 60) { result = DEV_HIVE; baudrate = PL_BAUDRATE_115200; }
     else if (result == DEV_CONBEE_1 && ftype > 9)                   { result = DEV_UNKNOWN; baudrate = PL_BAUDRATE_38400; }
     else if (result == DEV_RASPBEE_2 && ftype >= 30 && ftype <= 39) { result = DEV_RASPBEE_2; baudrate = PL_BAUDRATE_38400; }
 
+    if      (result == DEV_CONBEE_1)                               { gcf->devReset = GCF_RESET_FTDI; }
+    else if (result == DEV_RASPBEE_1 || result == DEV_RASPBEE_2)   { gcf->devReset = GCF_RESET_GPIO; }
+    else                                                           { gcf->devReset = GCF_RESET_UART; }
+
     if (gcf->devBaudrate == PL_BAUDRATE_UNKNOWN)
         gcf->devBaudrate = baudrate;
 
     return result;
 }
 
-static void gcfRetry(GCF *gcf)
+/* \returns 1 for the V1 (ASCII) or 3 for the V3 (BTL_MAGIC frames) bootloader protocol. */
+static unsigned gcfBootloaderGeneration(const GCF *gcf)
 {
-    PL_time_t now = PL_Time();
-    if (gcf->maxTime > now)
-    {
+    if (gcf->devProfile && gcf->devProfile->bootloader != 0)
+        return gcf->devProfile->bootloader;
+
+    return gcf->file.gcfFileType < 30 ? 1 : 3;
+}
+
+/* Delay of the first attempt to reopen the port after the device dropped off.
+
+   Once a reset to reopen time has been measured, the attempt is scheduled
+   shortly before the port is expected back instead of a fixed guess.
+ */
+static unsigned long gcfBootloaderConnectDelay(const GCF *gcf)
+{
+    PL_time_t due;
+    PL_time_t now;
+
+    if (gcf->reconnectUs == 0 || gcf->resetTimeUs == 0)
+        return BTL_CONNECT_DELAY;
+
+    now = PL_TimeUs();
+    due = gcf->resetTimeUs + gcf->reconnectUs;
+
+    if (due <= now + BTL_CONNECT_EARLY)
+        return 1;
+
+    return (unsigned long)((due - now - BTL_CONNECT_EARLY) / 1000);
+}
+
+/*! Keeps other processes like a gateway off the port for the session. */
+static GCF_Status gcfClaimPort(GCF *gcf)
+{
+    unsigned long waitMs;
+
+    if (gcf->dryRun || gcf->replay || gcf->devpath[0] == '\0')
+        return GCF_SUCCESS;
+
+    if (gcf->task != T_PROGRAM && gcf->task != T_RESET && gcf->task != T_CONNECT && gcf->task != T_PROXY &&
+        gcf->task != T_SELFTEST)
+        return GCF_SUCCESS;
+
+    waitMs = gcf->portWaitMs;
+    if (gcf->handoff && waitMs == 0)
+        waitMs = PORT_HANDOFF_WAIT;
+
+    if (PL_ClaimPort(gcf->devpath, waitMs, gcf->handoff) != 0)
+        return GCF_FAILED;
+
+    return GCF_SUCCESS;
+}
+
+/* Prints UART errors since the last retry, they often explain a failed attempt. */
+static void gcfPrintUartErrors(GCF *gcf)
+{
+    PL_UartStats uart;
+    PL_UartStats *seen;
+
+    PL_GetUartStats(&uart);
+    seen = &gcf->uartSeen;
+
+    if (uart.overrun != seen->overrun || uart.bufOverrun != seen->bufOverrun ||
+        uart.frame != seen->frame || uart.parity != seen->parity)
+    {
+        UI_Printf(gcf, "retry: uart errors in last attempt: %lu overrun, %lu buffer overrun, %lu frame, %lu parity\n",
+                  uart.overrun - seen->overrun, uart.bufOverrun - seen->bufOverrun,
+                  uart.frame - seen->frame, uart.parity - seen->parity);
+    }
+
+    *seen = uart;
+}
+
+static void gcfRetry(GCF *gcf)
+{
+    PL_time_t now = PL_Time();
+    if (gcf->maxTime > now)
+    {
         UI_Printf(gcf, "retry: %d seconds left\n", (int)(gcf->maxTime - now) / 1000);
+        gcfPrintUartErrors(gcf);
+
+        if (gcf->task == T_PROGRAM && gcf->imageIndex < UI_MAX_ROWS)
+        {
+            gcf->uiRows[gcf->imageIndex].retries++;
+            gcf->uiRows[gcf->imageIndex].startUs = 0; /* rate of the next attempt */
+        }
+        UI_SetState(gcf, UI_STATE_RETRY);
 
         gcf->state = ST_Init;
         gcf->substate = ST_Void;
@@ -1348,6 +3078,7 @@ static void gcfRetry(GCF *gcf)
     }
     else
     {
+        UI_SetState(gcf, UI_STATE_FAILED);
         PL_ShutDown();
     }
 }
@@ -1360,18 +3091,57 @@ static void gcfPrintHelp()
     "usage: GCFFlasher <options>\n"
     "options:\n"
     " -r              force device reboot without programming\n"
-    " -f <firmware>   flash firmware file\n"
+    " -f <firmware>   flash firmware file or http:// URL (cached), repeat to flash in sequence\n"
 #ifdef _WIN32
     " -d <com port>   COM port to use, e.g. COM1\n"
 #else
     " -d <device>     device number or path to use, e.g. 0, /dev/ttyUSB0 or RaspBee\n"
 #endif
-    " -c              connect and debug serial protocol\n"
+    " -c              connect and debug serial protocol, -d can be repeated\n"
+#ifndef _WIN32
+    " -p <link>       proxy device through a pty (symlinked as <link>) and debug serial protocol\n"
+#endif
 //    " -s <serial>     serial number to use\n"
     " -t <timeout>    retry until timeout (seconds) is reached\n"
     " -l              list devices\n"
+    " --json          with -l: print the devices as JSON array, one object per line\n"
+    " --ui-row <line> draw the progress rows at this terminal line, with the device name\n"
 //    " -x <loglevel>   debug log level 0, 1, 3\n"
-    " -h -?           print this help\n";
+    " -h -?           print this help\n"
+#ifndef _WIN32
+    " --dry-run       simulate -f upload against a bootloader model, -d selects the device type\n"
+    " --rtt <ms>      round trip time of the link for --dry-run (default 1)\n"
+    " --chunk <bytes> V3 data request length of the --dry-run model (default 256, max. 1024)\n"
+    " --rx-buffer <bytes> receive buffer of the --dry-run model, bytes which don't fit are lost\n"
+    " --rx-rate <kB/s> rate the --dry-run model empties its receive buffer (default line rate)\n"
+    " --pace [<kB/s>] pace writes to the device (default line rate), burst and USB packet size from the device profile\n"
+    " --usb-power-on  disable USB autosuspend of the device while flashing (Linux, root)\n"
+    " --wait <s>      wait up to <s> seconds until another process releases the device\n"
+    " --handoff       ask the process holding the device lock to release it (SIGUSR1)\n"
+    " --io <backend>  event loop I/O: poll (epoll on Linux) or uring (Linux 5.5+)\n"
+    " --io-stats      print the number of I/O syscalls on exit\n"
+    " --record <file> record the device I/O and timeouts of the session\n"
+    " --replay <file> run the session against a recording instead of the device\n"
+#endif
+    " --selftest      measure throughput, round trip latency and framing of the serial path,\n"
+#ifdef _WIN32
+    "                 -d is an adapter with TX wired to RX\n"
+#else
+    "                 -d is an adapter with TX wired to RX, without -d a pty pair is used\n"
+#endif
+    " --min-rate <kB/s> --selftest fails below this throughput on the wire (default 70% of the line rate)\n"
+    " --max-rtt <ms>  --selftest fails above this p99 round trip time (default 50)\n"
+    " --stream        read the firmware file on demand instead of loading it, for hosts with little memory\n"
+    " --max-rss <kB>  --stream and exit with an error if the peak RSS exceeds <kB>\n"
+    " --stats         print CPU time, context switches, peak RSS and event loop counters on exit\n"
+    " --stats-json    same as --stats as one line of JSON\n"
+    "\n"
+    "usage: GCFFlasher pack -o <file.gcf> -t <type> -a <address> <image>\n"
+    "       GCFFlasher pack -o <file.gcf> -x <magic> -a <address> <image>[,<type>[,<address>]] ...\n"
+    " -o <file.gcf>   output file\n"
+    " -t <type>       GCF file type, e.g. 1 (60 for containers)\n"
+    " -a <address>    target address, e.g. 0x5000\n"
+    " -x <magic>      wrap images in extended container, e.g. 0xDEC0DE03\n";
 
 
     PL_Print(usage);
@@ -1383,11 +3153,17 @@ void gcfDebugHex(GCF *gcf, const char *msg, const unsigned char *data, unsigned
     char *p;
     char buf[1024];
     unsigned i;
+    unsigned n;
+
+    /* the selftest sends thousands of frames in timed loops, it reports counters instead */
+    if (gcf->task == T_SELFTEST)
+        return;
 
     p = &buf[0];
 
-    Assert(size < (sizeof(buf) / 2) - 1);
-    for (i = 0; i < size; i++, p += 2)
+    /* larger frames are truncated */
+    n = size < (sizeof(buf) / 2) - 1 ? size : (sizeof(buf) / 2) - 1;
+    for (i = 0; i < n; i++, p += 2)
     {
         put_hex(data[i], p);
     }
@@ -1402,31 +3178,53 @@ void gcfDebugHex(GCF *gcf, const char *msg, const unsigned char *data, unsigned
 #endif
 }
 
+static int gcfStrEqual(const char *a, const char *b)
+{
+    for (; *a && *a == *b; a++, b++)
+    {
+    }
+
+    return *a == *b;
+}
+
 static GCF_Status gcfProcessCommandline(GCF *gcf)
 {
     int i;
     const char *arg;
     unsigned long arglen;
     long longval;
-    long nread;
+    double dblval;
     GCF_Status ret = GCF_FAILED;
     U_SStream ss;
+    GCF_Image *image;
 
     gcf->state = ST_Void;
     gcf->substate = ST_Void;
     gcf->devpath[0] = '\0';
     gcf->devSerialNum[0] = '\0';
     gcf->devType = DEV_UNKNOWN;
+    gcf->devProfile = 0;
+    gcf->devReset = GCF_RESET_UART;
     gcf->devBaudrate = PL_BAUDRATE_UNKNOWN;
     gcf->file.fname[0] = '\0';
     gcf->file.gcfFileType = 0;
     gcf->file.fsize = 0;
+    gcf->imageCount = 0;
     gcf->task = T_NONE;
+    gcf->monitorCount = 0;
 
     if (gcf->argc == 1)
     {
         gcf->task = T_HELP;
     }
+    else if (U_strlen(gcf->argv[1]) == 4)
+    {
+        U_sstream_init(&ss, gcf->argv[1], 4);
+        if (U_sstream_starts_with(&ss, "pack"))
+        {
+            return gcfCommandPack(gcf);
+        }
+    }
 
     for (i = 1; i < gcf->argc; i++)
     {
@@ -1446,6 +3244,19 @@ static GCF_Status gcfProcessCommandline(GCF *gcf)
                     gcf->task = T_CONNECT;
                 } break;
 
+                case 'p':
+                {
+                    if ((i + 1) == gcf->argc || gcf->argv[i + 1][0] == '-')
+                    {
+                        PL_Printf(DBG_INFO, "missing argument for parameter -p\n");
+                        return GCF_FAILED;
+                    }
+
+                    i++;
+                    gcf->task = T_PROXY;
+                    gcf->proxyLink = gcf->argv[i];
+                } break;
+
                 case 'd':
                 {
                     if ((i + 1) == gcf->argc || gcf->argv[i + 1][0] == '-')
@@ -1464,6 +3275,19 @@ static GCF_Status gcfProcessCommandline(GCF *gcf)
                         return GCF_FAILED;
                     }
 
+                    if (gcf->devpath[0] != '\0')
+                    {
+                        /* additional devices are monitored in connect mode */
+                        if (gcf->monitorCount + 1 >= MAX_CONNECT_PORTS)
+                        {
+                            PL_Printf(DBG_INFO, "too many -d arguments, max. %d\n", MAX_CONNECT_PORTS);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->monitorPaths[gcf->monitorCount++] = arg;
+                        break;
+                    }
+
                     U_memcpy(gcf->devpath, arg, arglen + 1);
                 } break;
 
@@ -1481,28 +3305,36 @@ static GCF_Status gcfProcessCommandline(GCF *gcf)
                     arg = gcf->argv[i];
 
                     arglen = U_strlen(arg);
-                    if (arglen >= sizeof(gcf->file.fname))
+                    if (arglen >= sizeof(gcf->file.fname) || gcf->imageCount == GCF_MAX_IMAGES)
                     {
                         PL_Printf(DBG_INFO, "invalid argument, %s, for parameter -f\n", arg);
                         return GCF_FAILED;
                     }
 
-                    U_memcpy(gcf->file.fname, arg, arglen + 1);
-                    nread = (long)PL_ReadFile(gcf->file.fname, gcf->file.fcontent, sizeof(gcf->file.fcontent));
-                    if (nread <= 0)
+                    image = &gcf->images[gcf->imageCount];
+
+                    /* retries parse the command line again, an URL is fetched only once */
+                    if (gcfStrEqual(image->fname, arg) && !gcfStrEqual(image->path, arg))
                     {
-                        PL_Printf(DBG_INFO, "failed to read file: %s\n", gcf->file.fname);
-                        return GCF_FAILED;
+                        gcf->imageCount++;
+                        break;
                     }
 
-                    PL_Printf(DBG_INFO, "read file success: %s (%ld bytes)\n", gcf->file.fname, nread);
-                    gcf->file.fsize = (unsigned long)nread;
+                    U_memcpy(image->fname, arg, arglen + 1);
+                    U_memcpy(image->path, arg, arglen + 1);
 
-                    if (GCF_ParseFile(&gcf->file) != 0)
+                    U_sstream_init(&ss, image->fname, arglen);
+                    if (U_sstream_starts_with(&ss, "http://") || U_sstream_starts_with(&ss, "https://"))
                     {
-                        PL_Printf(DBG_INFO, "invalid file: %s\n", gcf->file.fname);
-                        return GCF_FAILED;
+                        /* fetch into the local cache, the file name keeps the URL */
+                        if (NET_FetchCached(image->fname, &image->path[0], sizeof(image->path)) != 0)
+                        {
+                            PL_Printf(DBG_INFO, "failed to fetch file: %s\n", image->fname);
+                            return GCF_FAILED;
+                        }
                     }
+
+                    gcf->imageCount++;
                 } break;
 
                 case 'l':
@@ -1539,6 +3371,314 @@ static GCF_Status gcfProcessCommandline(GCF *gcf)
 
                 } break;
 
+                case '-':
+                {
+                    /* long options */
+                    U_sstream_init(&ss, (void*)arg, U_strlen(arg));
+
+                    if (U_sstream_starts_with(&ss, "--dry-run") && arg[9] == '\0')
+                    {
+                        gcf->dryRun = 1;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--usb-power-on") && arg[14] == '\0')
+                    {
+                        gcf->usbPowerOn = 1;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--handoff") && arg[9] == '\0')
+                    {
+                        gcf->handoff = 1;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--wait") && arg[6] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                        longval = U_sstream_get_long(&ss); /* seconds */
+
+                        if (ss.status != U_SSTREAM_OK || longval < 0 || longval > 3600)
+                        {
+                            PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->portWaitMs = (unsigned long)longval * 1000;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--selftest") && arg[10] == '\0')
+                    {
+                        gcf->task = T_SELFTEST;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--min-rate") && arg[10] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                        dblval = U_sstream_get_double(&ss); /* kB/s */
+
+                        if (ss.status != U_SSTREAM_OK || dblval <= 0 || dblval > 100000)
+                        {
+                            PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->selftestMinRate = (unsigned long)(dblval * 1000);
+                    }
+                    else if (U_sstream_starts_with(&ss, "--max-rtt") && arg[9] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                        dblval = U_sstream_get_double(&ss); /* milliseconds */
+
+                        if (ss.status != U_SSTREAM_OK || dblval <= 0 || dblval > 10000)
+                        {
+                            PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->selftestMaxRttUs = (unsigned long)(dblval * 1000);
+                    }
+                    else if (U_sstream_starts_with(&ss, "--stream") && arg[8] == '\0')
+                    {
+                        gcf->streamMode = 1;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--max-rss") && arg[9] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                        longval = U_sstream_get_long(&ss); /* kB */
+
+                        if (ss.status != U_SSTREAM_OK || longval < 1)
+                        {
+                            PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->maxRssKb = (unsigned long)longval;
+                        gcf->streamMode = 1;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--json") && arg[6] == '\0')
+                    {
+                        gcf->listJson = 1;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--stats-json") && arg[12] == '\0')
+                    {
+                        gcf->stats = 2;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--stats") && arg[7] == '\0')
+                    {
+                        gcf->stats = 1;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--io-stats") && arg[10] == '\0')
+                    {
+                        gcf->ioStats = 1;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--io") && arg[4] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        if (PL_SetIoBackend(gcf->argv[i]) != 0)
+                        {
+                            /* not fatal, the default backend works everywhere */
+                            PL_Printf(DBG_INFO, "I/O backend %s not available\n", gcf->argv[i]);
+                        }
+                    }
+                    else if (U_sstream_starts_with(&ss, "--record") && arg[8] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+#ifdef _WIN32
+                        PL_Printf(DBG_INFO, "--record isn't supported on this platform\n");
+                        return GCF_FAILED;
+#else
+                        /* opened once, retries parse the command line again and continue the recording */
+                        if (!REC_Recording() && (REC_Replaying() || REC_Open(gcf->argv[i], gcf->argc, gcf->argv) != 0))
+                        {
+                            PL_Printf(DBG_INFO, "failed to create recording %s\n", gcf->argv[i]);
+                            return GCF_FAILED;
+                        }
+#endif
+                    }
+                    else if (U_sstream_starts_with(&ss, "--replay") && arg[8] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+#ifdef _WIN32
+                        PL_Printf(DBG_INFO, "--replay isn't supported on this platform\n");
+                        return GCF_FAILED;
+#else
+                        /* replay can't be recorded, the recording would be a copy;
+                           opened once, retries continue with the next record */
+                        if (!REC_Replaying() && (REC_Recording() || REC_Replay(gcf->argv[i], PL_TimeUs()) != 0))
+                        {
+                            PL_Printf(DBG_INFO, "failed to open recording %s\n", gcf->argv[i]);
+                            return GCF_FAILED;
+                        }
+                        gcf->replay = 1;
+#endif
+                    }
+                    else if (U_sstream_starts_with(&ss, "--ui-row") && arg[8] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                        longval = U_sstream_get_long(&ss);
+
+                        if (ss.status != U_SSTREAM_OK || longval < 1 || longval > 999)
+                        {
+                            PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->uiRowLine = (unsigned)longval;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--rtt") && arg[5] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                        dblval = U_sstream_get_double(&ss); /* milliseconds */
+
+                        if (ss.status != U_SSTREAM_OK || dblval < 0 || dblval > 10000)
+                        {
+                            PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->rttUs = (unsigned long)(dblval * 1000);
+                    }
+                    else if (U_sstream_starts_with(&ss, "--chunk") && arg[7] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                        longval = U_sstream_get_long(&ss);
+
+                        if (ss.status != U_SSTREAM_OK || longval < 1 || longval > 0xFFFF)
+                        {
+                            PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->simChunkSize = (unsigned)longval;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--rx-buffer") && arg[11] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                        longval = U_sstream_get_long(&ss);
+
+                        if (ss.status != U_SSTREAM_OK || longval < 1 || longval > 0xFFFF)
+                        {
+                            PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->simRxBuffer = (unsigned)longval;
+                    }
+                    else if (U_sstream_starts_with(&ss, "--rx-rate") && arg[9] == '\0')
+                    {
+                        if ((i + 1) == gcf->argc)
+                        {
+                            PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                            return GCF_FAILED;
+                        }
+
+                        i++;
+                        U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                        dblval = U_sstream_get_double(&ss); /* kB/s */
+
+                        if (ss.status != U_SSTREAM_OK || dblval <= 0 || dblval > 100000)
+                        {
+                            PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                            return GCF_FAILED;
+                        }
+
+                        gcf->simRxRate = (unsigned long)(dblval * 1000);
+                    }
+                    else if (U_sstream_starts_with(&ss, "--pace") && arg[6] == '\0')
+                    {
+                        gcf->pace = 1;
+
+                        /* optional rate */
+                        if ((i + 1) < gcf->argc && gcf->argv[i + 1][0] >= '0' && gcf->argv[i + 1][0] <= '9')
+                        {
+                            i++;
+                            U_sstream_init(&ss, gcf->argv[i], U_strlen(gcf->argv[i]));
+                            dblval = U_sstream_get_double(&ss); /* kB/s */
+
+                            if (ss.status != U_SSTREAM_OK || dblval <= 0 || dblval > 100000)
+                            {
+                                PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                                return GCF_FAILED;
+                            }
+
+                            gcf->paceRate = (unsigned long)(dblval * 1000);
+                        }
+                    }
+                    else
+                    {
+                        PL_Printf(DBG_INFO, "unknown option: %s\n", arg);
+                        return GCF_FAILED;
+                    }
+                } break;
+
                 case 'x':
                 {
                     if ((i + 1) == gcf->argc || gcf->argv[i + 1][0] == '-')
@@ -1568,8 +3708,47 @@ static GCF_Status gcfProcessCommandline(GCF *gcf)
         }
     }
 
-    gcfGetDevices(gcf);
+    if (gcf->imageCount > 0)
+    {
+        /* a retry continues with the image which wasn't written yet */
+        if (gcf->imageIndex >= gcf->imageCount)
+            gcf->imageIndex = 0;
+
+        /* loaded after all options, so that --stream applies regardless of its position;
+           every image is checked, the current one stays loaded */
+        for (i = 0; i < (int)gcf->imageCount; i++)
+        {
+            if (i != (int)gcf->imageIndex && gcfLoadImage(gcf, &gcf->images[i]) != GCF_SUCCESS)
+                return GCF_FAILED;
+        }
+
+        if (gcfLoadImage(gcf, &gcf->images[gcf->imageIndex]) != GCF_SUCCESS)
+            return GCF_FAILED;
+    }
+
+    if (!gcf->dryRun)
+        gcfGetDevices(gcf); /* no device access in --dry-run */
+
     gcf->devType = gcfGetDeviceType(gcf);
+    gcfLoadBaudrate(gcf);
+
+    if (gcf->monitorCount > 0 && gcf->task != T_CONNECT)
+    {
+        PL_Printf(DBG_INFO, "multiple -d arguments are only supported with -c\n");
+        return GCF_FAILED;
+    }
+
+    if (gcf->dryRun && gcf->task != T_PROGRAM)
+    {
+        PL_Printf(DBG_INFO, "--dry-run requires -f\n");
+        return GCF_FAILED;
+    }
+
+    if (gcf->task == T_PROGRAM && gcf->dryRun)
+    {
+        if (gcfDryRun(gcf) != GCF_SUCCESS)
+            return GCF_FAILED;
+    }
 
     if (gcf->task == T_PROGRAM)
     {
@@ -1607,6 +3786,9 @@ static GCF_Status gcfProcessCommandline(GCF *gcf)
             gcf->devType = DEV_RASPBEE_2;
         }
 
+        if (gcf->pace && gcfSetupPacing(gcf) != GCF_SUCCESS)
+            return GCF_FAILED;
+
         gcf->state = ST_Program;
         ret = GCF_SUCCESS;
     }
@@ -1621,6 +3803,29 @@ static GCF_Status gcfProcessCommandline(GCF *gcf)
         gcf->state = ST_Connect;
         ret = GCF_SUCCESS;
     }
+    else if (gcf->task == T_PROXY)
+    {
+        if (gcf->devpath[0] == '\0')
+        {
+            PL_Printf(DBG_INFO, "missing -d argument\n");
+            return GCF_FAILED;
+        }
+
+        gcf->state = ST_Proxy;
+        ret = GCF_SUCCESS;
+    }
+    else if (gcf->task == T_SELFTEST)
+    {
+#ifdef _WIN32
+        if (gcf->devpath[0] == '\0')
+        {
+            PL_Printf(DBG_INFO, "missing -d argument, --selftest needs a loopback-wired adapter\n");
+            return GCF_FAILED;
+        }
+#endif
+        gcf->state = ST_Selftest;
+        ret = GCF_SUCCESS;
+    }
     else if (gcf->task == T_RESET)
     {
         if (gcf->devpath[0] == '\0')
@@ -1642,6 +3847,344 @@ static GCF_Status gcfProcessCommandline(GCF *gcf)
     return ret;
 }
 
+/*! Enables --pace, the burst and USB packet size are taken from the device profile.
+
+    Without profile (device type from the path or --dry-run) the first
+    profile of the device type is used.
+ */
+static GCF_Status gcfSetupPacing(GCF *gcf)
+{
+    unsigned i;
+    unsigned burst;
+    unsigned packet;
+    unsigned long rate;
+    const GCF_DeviceProfile *p;
+
+    p = gcf->devProfile;
+    for (i = 0; !p && i < sizeof(gcfDeviceProfiles) / sizeof(gcfDeviceProfiles[0]); i++)
+    {
+        if (gcfDeviceProfiles[i].devType == gcf->devType)
+            p = &gcfDeviceProfiles[i];
+    }
+
+    burst = p ? p->txBurst : PACE_BURST;
+    packet = p ? p->txPacket : 0;
+
+    rate = gcf->paceRate;
+    if (rate == 0)
+        rate = (gcf->devBaudrate != PL_BAUDRATE_UNKNOWN ? (unsigned long)gcf->devBaudrate : PL_BAUDRATE_38400) / 10;
+
+    if (PL_SetTxPacing(rate, burst, packet) != 0)
+    {
+        PL_Printf(DBG_INFO, "--pace isn't supported on this platform\n");
+        return GCF_FAILED;
+    }
+
+    PL_Printf(DBG_DEBUG, "pace writes: %lu bytes/s, burst %u bytes, packet %u bytes\n", rate, burst, packet);
+    return GCF_SUCCESS;
+}
+
+/*! Sets up the device model for --dry-run, no serial port is opened.
+
+    Without -d the device type is derived from the GCF header.
+ */
+static GCF_Status gcfDryRun(GCF *gcf)
+{
+#ifdef _WIN32
+    (void)gcf;
+    PL_Printf(DBG_INFO, "--dry-run isn't supported on this platform\n");
+    return GCF_FAILED;
+#else
+    SIM_Config cfg;
+    unsigned char ftype;
+
+    ftype = gcf->file.gcfFileType;
+
+    if (gcf->devpath[0] == '\0')
+    {
+        U_memcpy(gcf->devpath, "dry-run", 8);
+
+        if (gcf->devType == DEV_UNKNOWN)
+        {
+            if (ftype < 30 && gcf->file.gcfTargetAddress == 0x5000)
+            {
+                gcf->devType = DEV_CONBEE_2;
+                gcf->devBaudrate = PL_BAUDRATE_115200;
+            }
+            else if (ftype == 1 && gcf->file.gcfTargetAddress == 0)
+            {
+                gcf->devType = DEV_CONBEE_1;
+                gcf->devBaudrate = PL_BAUDRATE_38400;
+            }
+            else if (ftype >= 30 && ftype <= 39)
+            {
+                gcf->devType = DEV_RASPBEE_2;
+                gcf->devBaudrate = PL_BAUDRATE_38400;
+            }
+        }
+    }
+
+    if (gcf->devBaudrate == PL_BAUDRATE_UNKNOWN)
+        gcf->devBaudrate = PL_BAUDRATE_38400;
+
+    U_bzero(&cfg, sizeof(cfg));
+    cfg.bootloader = gcfBootloaderGeneration(gcf); /* same decision as in ST_BootloaderQuery */
+    cfg.baudrate = gcf->devBaudrate;
+    cfg.rttUs = gcf->rttUs;
+    cfg.hangupOnReset = gcf->devType == DEV_CONBEE_2; /* USB CDC ACM */
+    cfg.v3ChunkSize = gcf->simChunkSize;
+    cfg.rxBufferSize = gcf->simRxBuffer;
+    cfg.rxRate = gcf->simRxRate;
+    cfg.image = gcf->streamMode ? 0 : &gcf->file.fcontent[GCF_HEADER_SIZE];
+    cfg.imageSize = gcf->file.gcfFileSize;
+    cfg.imageCrc32 = gcf->file.gcfCrc32;
+    cfg.imageCrc8 = gcf->file.gcfCrc;
+    cfg.startTimeUs = PL_TimeUs();
+
+    if (gcf->replay)
+        return GCF_SUCCESS; /* the recording of a --dry-run session stands in for the model */
+
+    if (SIM_Active())
+    {
+        /* a retry, the model keeps its state and counters over all attempts */
+        SIM_SetImage(cfg.image, cfg.imageSize, cfg.imageCrc32, cfg.imageCrc8);
+        return GCF_SUCCESS;
+    }
+
+    SIM_Init(&cfg);
+
+    return GCF_SUCCESS;
+#endif
+}
+
+/*! Parses decimal or 0x prefixed hex number into \p val.
+
+    \returns 0 on success, -1 on failure.
+ */
+static int gcfParseU32(const char *str, unsigned long *val)
+{
+    unsigned ch;
+    unsigned base;
+    unsigned digits;
+    unsigned long long num;
+
+    base = 10;
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+    {
+        base = 16;
+        str += 2;
+    }
+
+    for (num = 0, digits = 0; *str; str++, digits++)
+    {
+        ch = (unsigned char)*str;
+        if      (ch >= '0' && ch <= '9')               { ch = ch - '0'; }
+        else if (base == 16 && ch >= 'a' && ch <= 'f') { ch = ch - 'a' + 10; }
+        else if (base == 16 && ch >= 'A' && ch <= 'F') { ch = ch - 'A' + 10; }
+        else    { return -1; }
+
+        num = num * base + ch;
+        if (num > 0xFFFFFFFFULL)
+            return -1;
+    }
+
+    if (digits == 0)
+        return -1;
+
+    *val = (unsigned long)num;
+    return 0;
+}
+
+/*! Parses <path>[,<type>[,<address>]] of a container image.
+
+    The separators in argv are replaced by '\0' to terminate the path.
+ */
+static int gcfParsePackImage(char *arg, PACK_Image *img)
+{
+    char *sep[2];
+    unsigned n;
+
+    img->path = arg;
+
+    for (n = 0; *arg && n < 2; arg++)
+    {
+        if (*arg == ',')
+        {
+            *arg = '\0';
+            sep[n++] = arg + 1;
+        }
+    }
+
+    if (n > 0 && gcfParseU32(sep[0], &img->type) != 0)
+        return -1;
+
+    if (n > 1 && gcfParseU32(sep[1], &img->targetAddress) != 0)
+        return -1;
+
+    return img->path[0] != '\0' ? 0 : -1;
+}
+
+/*! Implements: GCFFlasher pack -o <output> [-t <type>] [-a <address>] [-x <magic>] <image> ...
+
+    Writes the file and verifies it by reading it back through GCF_ParseFile().
+ */
+static GCF_Status gcfCommandPack(GCF *gcf)
+{
+    int i;
+    char *arg;
+    long nread;
+    int haveType;
+    PACK_Image *img;
+    PACK_Options opt;
+    PACK_Result result;
+    unsigned long val;
+
+    gcf->task = T_PACK;
+    gcf->exitCode = 1;
+    PL_ShutDown();
+
+    U_bzero(&opt, sizeof(opt));
+    haveType = 0;
+
+    for (i = 2; i < gcf->argc; i++)
+    {
+        arg = gcf->argv[i];
+
+        if (arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0')
+        {
+            if ((i + 1) == gcf->argc)
+            {
+                PL_Printf(DBG_INFO, "missing argument for parameter %s\n", arg);
+                return GCF_FAILED;
+            }
+
+            i++;
+
+            if (arg[1] == 'o')
+            {
+                opt.output = gcf->argv[i];
+                continue;
+            }
+
+            if (gcfParseU32(gcf->argv[i], &val) != 0)
+            {
+                PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                return GCF_FAILED;
+            }
+
+            if (arg[1] == 't' && val <= 0xFF)
+            {
+                opt.fileType = (unsigned char)val;
+                haveType = 1;
+            }
+            else if (arg[1] == 'a')
+            {
+                opt.targetAddress = val;
+            }
+            else if (arg[1] == 'x' && (val & 0xFFFFFF00UL) == 0xDEC0DE00UL)
+            {
+                opt.containerMagic = val;
+            }
+            else
+            {
+                PL_Printf(DBG_INFO, "invalid argument, %s, for parameter %s\n", gcf->argv[i], arg);
+                return GCF_FAILED;
+            }
+        }
+        else
+        {
+            if (opt.imageCount == PACK_MAX_IMAGES)
+            {
+                PL_Printf(DBG_INFO, "too many input files (max %d)\n", PACK_MAX_IMAGES);
+                return GCF_FAILED;
+            }
+
+            img = &opt.images[opt.imageCount];
+            img->type = 0;
+            img->targetAddress = 0xFFFFFFFFUL; /* default: GCF target address */
+
+            if (gcfParsePackImage(arg, img) != 0)
+            {
+                PL_Printf(DBG_INFO, "invalid input file argument: %s\n", arg);
+                return GCF_FAILED;
+            }
+
+            opt.imageCount++;
+        }
+    }
+
+    if (!opt.output || opt.imageCount == 0)
+    {
+        PL_Printf(DBG_INFO, "missing -o or input file argument\n");
+        return GCF_FAILED;
+    }
+
+    if (opt.containerMagic != 0)
+    {
+        if (haveType && opt.fileType != FLASH_TYPE_APP_ENCRYPTED)
+        {
+            PL_Printf(DBG_INFO, "containers (-x) require file type %d\n", FLASH_TYPE_APP_ENCRYPTED);
+            return GCF_FAILED;
+        }
+        opt.fileType = FLASH_TYPE_APP_ENCRYPTED;
+    }
+    else if (!haveType)
+    {
+        PL_Printf(DBG_INFO, "missing -t argument\n");
+        return GCF_FAILED;
+    }
+
+    for (i = 0; i < (int)opt.imageCount; i++)
+    {
+        if (opt.images[i].targetAddress == 0xFFFFFFFFUL)
+            opt.images[i].targetAddress = opt.targetAddress;
+    }
+
+    if (PACK_Write(&opt, &result) != 0)
+    {
+        PL_Printf(DBG_INFO, "failed to pack: %s\n", opt.output);
+        return GCF_FAILED;
+    }
+
+    /* round trip through the regular parser */
+    nread = U_strlen(opt.output);
+    if (nread >= (long)sizeof(gcf->file.fname))
+        nread = sizeof(gcf->file.fname) - 1;
+
+    U_memcpy(gcf->file.fname, opt.output, (unsigned long)nread);
+    gcf->file.fname[nread] = '\0';
+
+    nread = gcfReadFile(gcf, opt.output);
+    if (nread <= 0 || (unsigned long)nread != result.fileSize)
+    {
+        PL_Printf(DBG_INFO, "failed to verify %s, exceeds %d bytes?\n", opt.output, MAX_GCF_FILE_SIZE);
+        return GCF_FAILED;
+    }
+
+    gcf->file.fsize = (unsigned long)nread;
+
+    if (GCF_ParseFile(&gcf->file) != 0 ||
+        gcf->file.gcfFileType != opt.fileType ||
+        gcf->file.gcfTargetAddress != opt.targetAddress ||
+        gcf->file.gcfCrc != result.crc8 ||
+        (opt.containerMagic != 0 && gcf->file.gcfCrc32 != result.crc32))
+    {
+        PL_Printf(DBG_INFO, "failed to verify %s\n", opt.output);
+        return GCF_FAILED;
+    }
+
+    PL_Printf(DBG_INFO, "packed %s: type %u, address 0x%08lX, %lu bytes, crc8 0x%02X",
+              opt.output, opt.fileType, opt.targetAddress, result.fileSize, result.crc8);
+
+    if (opt.containerMagic != 0)
+        PL_Printf(DBG_INFO, ", %u images, crc32 0x%08lX", opt.imageCount, result.crc32);
+
+    PL_Printf(DBG_INFO, "\n");
+
+    gcf->exitCode = 0;
+    return GCF_SUCCESS;
+}
+
 static void gcfCommandResetUart()
 {
     const unsigned char cmd[] = {
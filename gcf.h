@@ -23,6 +23,7 @@ typedef enum
     EV_RASPBEE_RESET_SUCCESS = 13,
     EV_RASPBEE_RESET_FAILED = 23,
     EV_PKG_UART_RESET = 41,
+    EV_PKG_DEVICE_STATE = 42,
     EV_PL_STARTED = 100,
     EV_RX_ASCII = 50,
     EV_RX_BTL_PKG_DATA = 40,
@@ -64,10 +65,13 @@ typedef unsigned long long PL_time_t;
 #endif /* NDEBUG */
 
 GCF *GCF_Init(int argc, char *argv[]);
-void GCF_Exit(GCF *gcf);
+int GCF_Exit(GCF *gcf); /* returns the process exit code */
 
 /*! Called from platform layer when \p data has been received, \p len must be > 0. */
 void GCF_Received(GCF *gcf, const unsigned char *data, int len);
+
+/*! Called from platform layer when \p data has been received on monitor \p port (> 0), \p len must be > 0. */
+void GCF_ReceivedPort(GCF *gcf, unsigned port, const unsigned char *data, int len);
 void GCF_HandleEvent(GCF *gcf, Event event);
 
 int GCF_ParseFile(GCF_File *file);
@@ -82,6 +86,9 @@ void put_hex(unsigned char ch, char *buf);
 /*! Returns a monotonic time in milliseconds. */
 PL_time_t PL_Time();
 
+/*! Returns a monotonic time in microseconds. */
+PL_time_t PL_TimeUs(void);
+
 /*! Lets the programm sleep for \p ms milliseconds. */
 void PL_MSleep(unsigned long ms);
 
@@ -92,18 +99,36 @@ void PL_SetTimeout(unsigned long ms);
 /*! Clears an active timeout. */
 void PL_ClearTimeout(void);
 
+typedef void (*PL_TimerFunc)(void *arg);
+
+/*! Starts a one-shot timer which calls \p fn(arg) after \p us microseconds.
+
+    Any number of timers can run concurrently, PL_SetTimeout() is one of them.
+
+    \returns A handle for PL_StopTimer(), or 0 on failure.
+ */
+unsigned long PL_StartTimer(PL_time_t us, PL_TimerFunc fn, void *arg);
+
+/*! Stops a pending timer, does nothing if it already fired. */
+void PL_StopTimer(unsigned long handle);
+
 #define MAX_DEV_NAME_LENGTH 32
 #define MAX_DEV_SERIALNR_LENGTH 18
 #define MAX_DEV_PATH_LENGTH 255
+#define MAX_DEV_TOPOLOGY_LENGTH 32
 #define MAX_GCF_FILE_SIZE (1024 * 800) // 800K
+#define MAX_CONNECT_PORTS 8 /* primary device + monitor ports in connect mode (-c) */
 
 typedef struct
 {
     PL_Baudrate baudrate;
+    unsigned short vendorId; /* USB idVendor, 0 = unknown */
+    unsigned short productId;
     char name[MAX_DEV_NAME_LENGTH];
     char path[MAX_DEV_PATH_LENGTH];
     char serial[MAX_DEV_SERIALNR_LENGTH];
     char stablepath[MAX_DEV_PATH_LENGTH];
+    char topology[MAX_DEV_TOPOLOGY_LENGTH]; /* USB port path like 1-1.4.2 (bus 1, ports 1, 4, 2), empty if unknown */
 } Device;
 
 /* Fills up to \p max devices in the \p devs array.
@@ -119,6 +144,40 @@ int PL_GetDevices(Device *devs, unsigned max);
  */
 GCF_Status PL_Connect(const char *path, PL_Baudrate baudrate);
 
+/*! Changes the baudrate of the open connection without reopening it, pending input is discarded.
+
+    \returns 0 on success, -1 if not connected or the rate can't be set.
+ */
+int PL_SetBaudrate(PL_Baudrate baudrate);
+
+/*! Opens an additional serial port which is only monitored in connect mode.
+
+    Received data is passed to GCF_ReceivedPort(). The port is closed
+    together with the primary connection in PL_Disconnect().
+
+    \returns The port number (1 .. MAX_CONNECT_PORTS - 1) or -1 on failure.
+ */
+int PL_ConnectMonitor(const char *path, PL_Baudrate baudrate);
+
+/*! Creates a pseudo terminal which is transparently bridged to the connected device.
+
+    The pty slave is made available as symlink \p link for another process.
+    All bytes are forwarded in both directions, the device side is passed
+    to GCF_Received() and the pty side to GCF_ReceivedPort() for decoding.
+
+    \returns The port number of the pty or -1 on failure.
+ */
+int PL_ConnectProxy(const char *link);
+
+/*! Connects to one side of a pty pair as primary device, the other side echoes all bytes.
+
+    A stand-in for an adapter with TX wired to RX, used by --selftest.
+    The pair is closed in PL_Disconnect().
+
+    \returns GCF_SUCCESS or GCF_FAILED
+ */
+GCF_Status PL_ConnectLoopback(PL_Baudrate baudrate);
+
 /*! Closed the serial port connection. */
 void PL_Disconnect();
 
@@ -131,8 +190,110 @@ int PL_ResetFTDI(int num, const char *serialnum);
 /*! Executes a MCU reset for RaspBee I / II via GPIO17 reset pin. */
 int PL_ResetRaspBee();
 
+/*! Keeps the USB device of serial port \p path and its hubs powered.
+
+    On Linux this sets sysfs power/control to "on" (no autosuspend), so that
+    the device doesn't need to be resumed when it re-enumerates after a reset.
+    Can be called again after re-enumeration, the first seen setting is kept.
+
+    \returns 0 on success, -1 if not supported or not permitted.
+ */
+int PL_UsbPowerOn(const char *path);
+
+/*! Restores the settings changed by PL_UsbPowerOn(). */
+void PL_UsbPowerRestore(void);
+
+/*! Claims serial port \p path for this process until it exits.
+
+    On POSIX a UUCP lock file is created, PL_Connect() adds flock() and TIOCEXCL.
+    If another process holds the port, waits up to \p waitMs milliseconds for
+    its release. With \p handoff the owner of the lock file is asked to release
+    the port by SIGUSR1.
+
+    \returns 0 if the port is claimed, -1 if it's still in use.
+ */
+int PL_ClaimPort(const char *path, unsigned long waitMs, int handoff);
+
+/*! Syscall counters of the event loop. */
+typedef struct
+{
+    const char *backend; /* "epoll", "poll", "io_uring" */
+    unsigned long waits; /* epoll_wait(), poll() */
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long enters; /* io_uring_enter() */
+    unsigned long loops; /* event loop iterations */
+    unsigned long idle; /* wakeups without ready port or expired timer */
+    unsigned long long rxBytes; /* all ports */
+    unsigned long long txBytes;
+    unsigned long paceWaits; /* writes held back by PL_SetTxPacing() */
+} PL_IoStats;
+
+/*! Selects the I/O backend of the event loop: "poll" or "uring".
+
+    "poll" is epoll on Linux. Must be called before a port is opened,
+    if io_uring isn't available the current backend is kept.
+
+    \returns 0 on success, -1 if not supported.
+ */
+int PL_SetIoBackend(const char *name);
+
+void PL_GetIoStats(PL_IoStats *stats);
+
+/*! Paces writes to the primary device with a token bucket.
+
+    Up to \p burst bytes are written at once, then \p rate bytes per second.
+    Writes are cut at multiples of \p packet (USB packet size, 0 = 16 bytes),
+    except for the tail of the queued data. \p rate 0 turns pacing off.
+
+    \returns 0 on success, -1 if not supported.
+ */
+int PL_SetTxPacing(unsigned long rate, unsigned burst, unsigned packet);
+
+/*! Counters of the serial port driver (TIOCGICOUNT on Linux), summed over all
+    connections of the session. */
+typedef struct
+{
+    int supported; /* 0 if the driver doesn't report counters */
+    unsigned long rx;
+    unsigned long tx;
+    unsigned long overrun; /* UART FIFO overrun */
+    unsigned long bufOverrun; /* tty buffer overrun */
+    unsigned long frame;
+    unsigned long parity;
+    unsigned long brk;
+} PL_UartStats;
+
+void PL_GetUartStats(PL_UartStats *stats);
+
+/*! Resource usage of the process. */
+typedef struct
+{
+    unsigned long long userUs; /* CPU time */
+    unsigned long long systemUs;
+    unsigned long voluntarySwitches; /* context switches, 0 if unknown */
+    unsigned long involuntarySwitches;
+    unsigned long maxRssKb; /* peak resident set size, 0 if unknown */
+} PL_Usage;
+
+/*! \returns 0 on success, -1 if not supported. */
+int PL_GetUsage(PL_Usage *usage);
+
 int PL_ReadFile(const char *path, unsigned char *buf, unsigned long buflen);
 
+/*! Opens \p path for PL_ReadFileAt(), the file size is placed in \p size.
+
+    \returns A handle >= 0, or -1 on failure.
+ */
+int PL_OpenFile(const char *path, unsigned long *size);
+
+/*! Reads up to \p len bytes at \p offset without moving a file position, like pread().
+
+    \returns The number of bytes read, 0 at the end of the file, or -1 on failure.
+ */
+long PL_ReadFileAt(int file, unsigned long offset, unsigned char *buf, unsigned long len);
+void PL_CloseFile(int file);
+
 
 /* Terminal printing and logging */
 
@@ -162,6 +323,9 @@ void PL_Print(const char *line);
 void PL_Printf(DebugLevel level, const char *format, ...);
 
 void UI_GetWinSize(unsigned *w, unsigned *h);
+
+/*! \returns 1 if stdout is a terminal which understands cursor positioning. */
+int UI_IsTerminal(void);
 void UI_SetCursor(unsigned x, unsigned y);
 
 #endif /* GCF_H */
@@ -14,189 +14,214 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <unistd.h> /* access() */
 #include "gcf.h"
 #include "u_sstream.h"
 #include "u_mem.h"
 
 
-/*  Query USB info via udevadm
-    This works also when /dev/by-id .. is symlinks aren't available
+static int plReadSysfs(const char *path, char *buf, unsigned buflen);
 
-    udevadm info --name=/dev/ttyACM0
-*/
-static int query_udevadm(Device *dev, Device *end)
+/* Reads attribute \p name of sysfs directory \p dir, \returns 0 on success. */
+static int plSysfsAttr(const char *dir, const char *name, char *buf, unsigned buflen)
 {
-    FILE *f;
-    size_t n;
-    U_SStream ss;
-    char ch;
-    char buf[4096 * 4];
-    long udevadm_version;
-    unsigned i;
-    unsigned dev_major;
-    unsigned usb_vendor;
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path))
+        return -1;
+
+    return plReadSysfs(path, buf, buflen);
+}
+
+/* Copies \p src if it fits into \p dst, \returns 0 on success. */
+static int plCopyStr(char *dst, unsigned dstlen, const char *src)
+{
+    size_t len;
 
-    Device *dev_cur;
+    len = strlen(src);
+    if (len >= dstlen)
+        return -1;
+
+    memcpy(dst, src, len + 1);
+    return 0;
+}
+
+/* Sets the /dev/serial/by-id links of the devices, the directory is read once. */
+static void plStablePaths(Device *dev, Device *end)
+{
     DIR *dir;
+    Device *d;
     struct dirent *entry;
-    struct stat statbuf;
+    char link[MAX_DEV_PATH_LENGTH];
+    char rbuf[PATH_MAX];
+    const char *basedir = "/dev/serial/by-id";
 
-    dev_cur = dev;
-    udevadm_version = 0;
-    /* check if udevadm is available */
-    f = popen("udevadm --version", "r");
-    if (f)
+    dir = opendir(basedir);
+    if (!dir)
+        return;
+
+    while ((entry = readdir(dir)) != NULL)
     {
-        n = fread(&buf[0], 1, sizeof(buf) - 1, f);
-        if (n > 0 && n < 10)
+        if (entry->d_name[0] == '.')
+            continue;
+
+        if (snprintf(link, sizeof(link), "%s/%s", basedir, entry->d_name) >= (int)sizeof(link))
+            continue;
+
+        if (!realpath(link, rbuf))
+            continue;
+
+        for (d = dev; d < end; d++)
         {
-            buf[n] = '\0';
-            U_sstream_init(&ss, &buf[0], (unsigned)n);
-            udevadm_version = U_sstream_get_long(&ss);
-            if (ss.status != U_SSTREAM_OK)
-                udevadm_version = 0;
+            if (strcmp(d->path, rbuf) == 0)
+            {
+                plCopyStr(d->stablepath, sizeof(d->stablepath), link);
+                break;
+            }
         }
-        pclose(f);
     }
 
-    if (udevadm_version == 0)
-        return 0;
+    closedir(dir);
+}
 
-    dir = opendir("/dev");
+/* USB ids of the supported devices, the same as in gcfDeviceProfiles[] */
+static const unsigned short plUsbIds[][2] =
+{
+    { 0x1cf1, 0x0030 }, /* ConBee II */
+    { 0x0403, 0x6015 }, /* ConBee I and III, FT230X */
+    { 0x1a86, 0x7523 }  /* Hive, CH340 */
+};
+
+/* Sets the name like udev ID_USB_MODEL and /dev/serial/by-id do, from the USB product string \p product. */
+static void plModelName(Device *dev, const char *product)
+{
+    unsigned i;
+
+    if (strncmp(product, "FT230X", 6) == 0)
+        product = "ConBee"; /* ConBee I */
+
+    for (i = 0; product[i] && i < sizeof(dev->name) - 1; i++)
+        dev->name[i] = product[i] == ' ' ? '_' : product[i];
+    dev->name[i] = '\0';
+}
 
+/*  Query USB info from sysfs, without spawning processes.
+
+    /sys/class/tty/ttyACM0/device --> /sys/devices/../usb1/1-1/1-1.2/1-1.2:1.0
+
+    The USB device directory (1-1.2) has idVendor, idProduct, serial and
+    product, its name is the port path of the device.
+*/
+static int plSysfsDevices(Device *dev, Device *end)
+{
+    int i;
+    int j;
+    int count;
+    DIR *dir;
+    char *p;
+    Device *cur;
+    Device tmp;
+    unsigned vendor;
+    unsigned product;
+    struct dirent *entry;
+    char buf[64];
+    char path[PATH_MAX];
+    char usbdir[PATH_MAX];
+
+    dir = opendir("/sys/class/tty");
     if (!dir)
         return 0;
 
-    while ((entry = readdir(dir)) != NULL)
+    cur = dev;
+
+    while (cur != end && (entry = readdir(dir)) != NULL)
     {
-        if (entry->d_type != DT_CHR)
+        if (strncmp(entry->d_name, "ttyACM", 6) != 0 && strncmp(entry->d_name, "ttyUSB", 6) != 0)
             continue;
 
-        if (dev_cur == end)
-            break;
-
-        U_bzero(dev_cur, sizeof(*dev_cur));
-
-        U_sstream_init(&ss, &dev_cur->path[0], sizeof(dev_cur->path));
-        U_sstream_put_str(&ss, "/dev/");
-        U_sstream_put_str(&ss, &entry->d_name[0]);
-
-        if (stat(ss.str, &statbuf) != 0)
+        if (snprintf(path, sizeof(path), "/sys/class/tty/%s/device", entry->d_name) >= (int)sizeof(path))
             continue;
 
-        dev_major = statbuf.st_rdev >> 8;
-        if (dev_major != 166 && dev_major != 188)
+        if (!realpath(path, usbdir))
             continue;
 
-        U_sstream_init(&ss, &buf[0], sizeof(buf));
-        U_sstream_put_str(&ss, "udevadm info --name=");
-        U_sstream_put_str(&ss, "/dev/");
-        U_sstream_put_str(&ss, &entry->d_name[0]);
+        /* up from the interface (and usb-serial port) to the device */
+        buf[0] = '\0';
+        while (plSysfsAttr(usbdir, "idVendor", buf, sizeof(buf)) != 0)
+        {
+            buf[0] = '\0';
+            p = strrchr(usbdir, '/');
+            if (!p || p == usbdir)
+                break;
+            *p = '\0';
+        }
+
+        vendor = (unsigned)strtoul(buf, NULL, 16);
+        product = 0;
+        if (plSysfsAttr(usbdir, "idProduct", buf, sizeof(buf)) == 0)
+            product = (unsigned)strtoul(buf, NULL, 16);
 
-        f = popen(ss.str, "r");
-        if (f)
+        for (i = 0; i < (int)(sizeof(plUsbIds) / sizeof(plUsbIds[0])); i++)
         {
-            usb_vendor = 0;
-            dev_cur->serial[0] = '\0';
-            dev_cur->name[0] = '\0';
+            if (plUsbIds[i][0] == vendor && plUsbIds[i][1] == product)
+                break;
+        }
 
-            n = fread(&buf[0], 1, sizeof(buf) - 1, f);
-            pclose(f);
+        if (i == (int)(sizeof(plUsbIds) / sizeof(plUsbIds[0])))
+            continue; /* other USB serial adapters */
 
-            if (n > 0 && n < sizeof(buf) - 1)
-            {
-                buf[n] = '\0';
-                U_sstream_init(&ss, &buf[0], (unsigned)n);
-                while (U_sstream_find(&ss, "E: ") && U_sstream_remaining(&ss) > 8)
-                {
-                    ss.pos += 3;
-                    if (U_sstream_starts_with(&ss, "ID_USB_VENDOR_ID=") && U_sstream_find(&ss, "="))
-                    {
-                        ss.pos += 1;
-                        if      (U_sstream_starts_with(&ss, "1cf1")) { usb_vendor = 0x1cf1; }
-                        else if (U_sstream_starts_with(&ss, "0403")) { usb_vendor = 0x0403; }
-                        else if (U_sstream_starts_with(&ss, "1a86")) { usb_vendor = 0x1a86; }
-                    }
-                    else if (U_sstream_starts_with(&ss, "ID_USB_SERIAL_SHORT=") && U_sstream_find(&ss, "="))
-                    {
-                        i = 0;
-                        ss.pos += 1;
-                        dev_cur->serial[0] = '\0';
-
-                        for (;ss.pos < ss.len && i + 1 < sizeof(dev_cur->serial); ss.pos++, i++)
-                        {
-                            ch = U_sstream_peek_char(&ss);
-                            if ((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9'))
-                            {
-                                dev_cur->serial[i] = ch;
-                                dev_cur->serial[i + 1] = '\0';
-                            }
-                            else
-                            {
-                                break;
-                            }
-                        }
-                    }
-                    else if (U_sstream_starts_with(&ss, "ID_USB_MODEL=") && U_sstream_find(&ss, "="))
-                    {
-                        i = 0;
-                        ss.pos += 1;
-                        dev_cur->name[0] = '\0';
-
-                        for (;ss.pos < ss.len && i + 1 < sizeof(dev_cur->name); ss.pos++, i++)
-                        {
-                            ch = U_sstream_peek_char(&ss);
-                            if (ch == ' ' || ch == '_' || (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9'))
-                            {
-                                dev_cur->name[i] = ch;
-                                dev_cur->name[i + 1] = '\0';
-                            }
-                            else
-                            {
-                                break;
-                            }
-                        }
-
-                        {
-                            U_SStream s2;
-                            U_sstream_init(&s2, dev_cur->name, i);
-
-                            if (U_sstream_starts_with(&s2, "ConBee_III"))
-                            {
-                                dev_cur->baudrate = PL_BAUDRATE_115200;
-                            }
-                            else if (U_sstream_starts_with(&s2, "ConBee_II"))
-                            {
-                                dev_cur->baudrate = PL_BAUDRATE_115200;
-                            }
-                        }
-                    }
-                }
-            }
+        U_bzero(cur, sizeof(*cur));
+        cur->vendorId = (unsigned short)vendor;
+        cur->productId = (unsigned short)product;
 
-            if (usb_vendor == 0x1a86)
-            {
-                dev_cur->baudrate = PL_BAUDRATE_115200;
-                if (dev_cur->serial[0] == '\0')
-                {
-                    /* the CH340 chips don't have a serial? */
-                    dev_cur->serial[0] = '1';
-                    dev_cur->serial[1] = '\0';
-                }
-            }
+        plSysfsAttr(usbdir, "serial", cur->serial, sizeof(cur->serial));
+        if (plSysfsAttr(usbdir, "product", buf, sizeof(buf)) == 0)
+            plModelName(cur, buf);
 
-            if (usb_vendor && dev_cur->serial[0] && dev_cur->name[0])
+        p = strrchr(usbdir, '/');
+        plCopyStr(cur->topology, sizeof(cur->topology), p ? p + 1 : usbdir);
+
+        if (snprintf(cur->path, sizeof(cur->path), "/dev/%s", entry->d_name) >= (int)sizeof(cur->path))
+            continue;
+
+        U_memcpy(&cur->stablepath[0], &cur->path[0], sizeof(cur->path));
+
+        if (strncmp(cur->name, "ConBee_II", 9) == 0) /* and III */
+        {
+            cur->baudrate = PL_BAUDRATE_115200;
+        }
+        else if (strcmp(cur->name, "ConBee") == 0) /* FT230X */
+        {
+            cur->baudrate = PL_BAUDRATE_38400;
+        }
+        else if (vendor == 0x1a86)
+        {
+            cur->baudrate = PL_BAUDRATE_115200;
+            if (cur->serial[0] == '\0')
             {
-                U_memcpy(&dev_cur->stablepath[0], &dev_cur->path[0], sizeof(dev_cur->path));
-                dev_cur++;
+                /* the CH340 chips don't have a serial? */
+                cur->serial[0] = '1';
+                cur->serial[1] = '\0';
             }
         }
 
+        if (cur->serial[0] && cur->name[0])
+            cur++;
     }
 
     closedir(dir);
 
-    return (int)(dev_cur - dev);
+    /* readdir() order isn't stable, sort by path */
+    count = (int)(cur - dev);
+    for (i = 1; i < count; i++)
+    {
+        tmp = dev[i];
+        for (j = i; j > 0 && strcmp(dev[j - 1].path, tmp.path) > 0; j--)
+            dev[j] = dev[j - 1];
+        dev[j] = tmp;
+    }
+
+    return count;
 }
 
 /*! Fills the \p dev array with ConBee I and II devices.
@@ -216,9 +241,12 @@ int plGetLinuxUSBDevices(Device *dev, Device *end)
     int result = 0;
     char buf[MAX_DEV_PATH_LENGTH];
 
-    result = query_udevadm(dev, end);
+    result = plSysfsDevices(dev, end);
     if (result > 0)
+    {
+        plStablePaths(dev, dev + result);
         return result;
+    }
 
     Assert(sizeof(dev->stablepath) == sizeof(buf));
 
@@ -261,6 +289,8 @@ int plGetLinuxUSBDevices(Device *dev, Device *end)
             */
             serial = strstr(entry->d_name, devConBeeII) + strlen(devConBeeII) + 1;
             dev->baudrate = PL_BAUDRATE_115200;
+            dev->vendorId = 0x1cf1;
+            dev->productId = 0x0030;
 
         }
         else if (strstr(entry->d_name, devConBeeIII))
@@ -271,6 +301,8 @@ int plGetLinuxUSBDevices(Device *dev, Device *end)
             */
             serial = strstr(entry->d_name, devConBeeIII) + strlen(devConBeeIII) + 1;
             dev->baudrate = PL_BAUDRATE_115200;
+            dev->vendorId = 0x0403;
+            dev->productId = 0x6015;
 
         }
         else if (strstr(entry->d_name, devConBeeIFTDI))
@@ -281,6 +313,8 @@ int plGetLinuxUSBDevices(Device *dev, Device *end)
             */
             serial = strstr(entry->d_name, devConBeeIFTDI) + strlen(devConBeeIFTDI) + 1;
             dev->baudrate = PL_BAUDRATE_38400;
+            dev->vendorId = 0x0403;
+            dev->productId = 0x6015;
         }
 
         if (!name)
@@ -347,3 +381,165 @@ int plGetLinuxUSBDevices(Device *dev, Device *end)
 
     return result;
 }
+
+#define PL_USB_POWER_MAX 4 /* device and upstream hubs */
+
+typedef struct
+{
+    char path[PATH_MAX];   /* .../power/control */
+    char value[16];        /* content before PL_UsbPowerOn() */
+} PL_UsbPower;
+
+static unsigned usbPowerCount;
+static PL_UsbPower usbPower[PL_USB_POWER_MAX];
+
+static int plReadSysfs(const char *path, char *buf, unsigned buflen)
+{
+    FILE *f;
+    size_t n;
+
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    n = fread(buf, 1, buflen - 1, f);
+    fclose(f);
+
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' '))
+        n--;
+
+    buf[n] = '\0';
+    return n > 0 ? 0 : -1;
+}
+
+static int plWriteSysfs(const char *path, const char *value)
+{
+    FILE *f;
+    int ret;
+
+    f = fopen(path, "w");
+    if (!f)
+        return -1;
+
+    ret = fputs(value, f) < 0 ? -1 : 0;
+    if (fclose(f) != 0)
+        ret = -1;
+
+    return ret;
+}
+
+/* Sets power/control of one USB device directory to "on". */
+static int plUsbPowerOnDir(const char *dir)
+{
+    unsigned i;
+    PL_UsbPower *pw;
+    char value[16];
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s/power/control", dir) >= (int)sizeof(path))
+        return -1;
+
+    if (plReadSysfs(path, value, sizeof(value)) != 0)
+        return -1;
+
+    if (strcmp(value, "on") == 0)
+        return 0;
+
+    /* after re-enumeration the node comes back with the default,
+       keep the value seen the first time for restoring */
+    for (i = 0, pw = NULL; i < usbPowerCount; i++)
+    {
+        if (strcmp(usbPower[i].path, path) == 0)
+        {
+            pw = &usbPower[i];
+            break;
+        }
+    }
+
+    if (!pw)
+    {
+        if (usbPowerCount == PL_USB_POWER_MAX)
+            return -1;
+
+        pw = &usbPower[usbPowerCount++];
+        memcpy(pw->path, path, strlen(path) + 1);
+        memcpy(pw->value, value, strlen(value) + 1);
+    }
+
+    if (plWriteSysfs(path, "on") != 0)
+    {
+        PL_Printf(DBG_INFO, "failed to write %s (missing permissions?)\n", path);
+        return -1;
+    }
+
+    PL_Printf(DBG_DEBUG, "%s: %s --> on\n", path, value);
+    return 0;
+}
+
+/*! Disables USB autosuspend for the device behind serial port \p devpath.
+
+    The tty's sysfs node is resolved to the USB device directory, e.g.
+
+      /sys/class/tty/ttyACM0/device --> /sys/devices/../usb1/1-1/1-1.2/1-1.2:1.0
+
+    and power/control of the device (1-1.2) and its upstream hubs is set
+    to "on", so that neither has to be resumed when the device re-enumerates.
+
+    \returns 0 if the device was found and set, -1 otherwise.
+ */
+int plLinuxUsbPowerOn(const char *devpath)
+{
+    int ret;
+    unsigned n;
+    char *p;
+    const char *name;
+    char path[PATH_MAX];
+    char dir[PATH_MAX];
+
+    if (!realpath(devpath, dir))
+        return -1;
+
+    name = strrchr(dir, '/');
+    name = name ? name + 1 : dir;
+
+    if (snprintf(path, sizeof(path), "/sys/class/tty/%s/device", name) >= (int)sizeof(path))
+        return -1;
+
+    if (!realpath(path, dir))
+        return -1;
+
+    ret = -1;
+
+    for (n = 0; n < PL_USB_POWER_MAX; )
+    {
+        p = strrchr(dir, '/');
+        if (!p || p == dir)
+            break;
+
+        if (snprintf(path, sizeof(path), "%s/idVendor", dir) < (int)sizeof(path) && access(path, F_OK) == 0)
+        {
+            /* the first one is the device itself */
+            if (plUsbPowerOnDir(dir) != 0 && n == 0)
+                return -1;
+
+            if (n == 0)
+                ret = 0;
+            n++;
+        }
+
+        *p = '\0';
+    }
+
+    return ret;
+}
+
+/*! Restores power/control values changed by plLinuxUsbPowerOn(). */
+void plLinuxUsbPowerRestore(void)
+{
+    while (usbPowerCount > 0)
+    {
+        usbPowerCount--;
+        if (plWriteSysfs(usbPower[usbPowerCount].path, usbPower[usbPowerCount].value) == 0)
+            PL_Printf(DBG_DEBUG, "%s: restored %s\n", usbPower[usbPowerCount].path, usbPower[usbPowerCount].value);
+    }
+}
@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+/* io_uring backend of the event loop, included by main_posix.c.
+
+   The kernel interface is used through raw syscalls with local copies of
+   the ABI structures, neither liburing nor recent kernel headers are needed.
+   Requires Linux 5.5 (IORING_OP_LINK_TIMEOUT), if io_uring_setup() fails
+   the loop keeps using epoll.
+
+   - A read is kept posted for every open port, the data arrives with the
+     completion in a per port buffer, there is no readiness wakeup followed
+     by a read() call.
+   - PROT_Flush() only queues a write of the tx ring buffer, linked to a
+     timeout. It's submitted together with re-armed reads and the loop
+     timeout in the next io_uring_enter() call.
+   - The loop timeout is an IORING_OP_TIMEOUT which also completes with the
+     first other completion, waiting and reaping is one syscall.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#ifndef __NR_io_uring_setup
+  #define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+  #define __NR_io_uring_enter 426
+#endif
+
+#define URING_ENTRIES 32
+#define URING_WRITE_TIMEOUT 2000 /* ms, cancels a write the device doesn't drain */
+
+/* kernel ABI, see include/uapi/linux/io_uring.h */
+#define URING_OFF_SQ_RING      0ULL
+#define URING_OFF_CQ_RING      0x8000000ULL
+#define URING_OFF_SQES         0x10000000ULL
+#define URING_FEAT_SINGLE_MMAP (1U << 0)
+#define URING_ENTER_GETEVENTS  (1U << 0)
+#define URING_SQE_IO_LINK      (1U << 2)
+
+#define URING_OP_READV        1
+#define URING_OP_WRITEV       2
+#define URING_OP_TIMEOUT      11
+#define URING_OP_ASYNC_CANCEL 14
+#define URING_OP_LINK_TIMEOUT 15
+
+/* user_data of a request: kind | port << 8 | generation << 16 */
+#define URING_READ         1
+#define URING_WRITE        2
+#define URING_WRITE_TIMER  3
+#define URING_WAIT_TIMER   4
+#define URING_CANCEL       5
+#define URING_KIND(ud)     ((unsigned)(ud) & 0xFF)
+#define URING_PORT(ud)     (((unsigned)(ud) >> 8) & 0xFF)
+#define URING_GEN(ud)      ((unsigned)((ud) >> 16) & 0xFFFF)
+
+typedef struct
+{
+    unsigned head;
+    unsigned tail;
+    unsigned ringMask;
+    unsigned ringEntries;
+    unsigned flags;
+    unsigned dropped;
+    unsigned array;
+    unsigned resv1;
+    unsigned long long resv2;
+} URING_SqOffsets;
+
+typedef struct
+{
+    unsigned head;
+    unsigned tail;
+    unsigned ringMask;
+    unsigned ringEntries;
+    unsigned overflow;
+    unsigned cqes;
+    unsigned flags;
+    unsigned resv1;
+    unsigned long long resv2;
+} URING_CqOffsets;
+
+typedef struct
+{
+    unsigned sqEntries;
+    unsigned cqEntries;
+    unsigned flags;
+    unsigned sqThreadCpu;
+    unsigned sqThreadIdle;
+    unsigned features;
+    unsigned wqFd;
+    unsigned resv[3];
+    URING_SqOffsets sqOff;
+    URING_CqOffsets cqOff;
+} URING_Params;
+
+typedef struct
+{
+    unsigned char opcode;
+    unsigned char flags;
+    unsigned short ioprio;
+    int fd;
+    unsigned long long off; /* file offset, completion count of a timeout */
+    unsigned long long addr;
+    unsigned len;
+    unsigned opFlags;
+    unsigned long long userData;
+    unsigned long long pad[3];
+} URING_Sqe;
+
+typedef struct
+{
+    unsigned long long userData;
+    int res;
+    unsigned flags;
+} URING_Cqe;
+
+typedef struct
+{
+    long long sec;
+    long long nsec;
+} URING_Timespec;
+
+typedef struct
+{
+    int fd;
+    unsigned char *sqRing;
+    unsigned char *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    URING_Sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    URING_Cqe *cqes;
+    unsigned queued; /* SQEs not yet submitted */
+
+    /* posted reads, indexed by port */
+    int readFd[MAX_CONNECT_PORTS];
+    unsigned char armed[MAX_CONNECT_PORTS];
+    unsigned char done[MAX_CONNECT_PORTS];
+    int res[MAX_CONNECT_PORTS];
+    unsigned short gen[MAX_CONNECT_PORTS];
+    struct iovec rxIov[MAX_CONNECT_PORTS];
+    unsigned char rxbuf[MAX_CONNECT_PORTS][RX_BUF_SIZE];
+
+    /* the write in flight */
+    int writing;
+    unsigned writeLen;
+    struct iovec txIov[2];
+    URING_Timespec writeTs;
+    URING_Timespec waitTs;
+} PL_Uring;
+
+static PL_Uring uring;
+
+/* \returns The number of submitted requests, or -errno. */
+static int plUringEnter(unsigned submit, unsigned minComplete, unsigned flags)
+{
+    int ret;
+
+    platform.io.enters++;
+    do
+    {
+        ret = (int)syscall(__NR_io_uring_enter, uring.fd, submit, minComplete, flags, NULL, 0);
+    } while (ret < 0 && errno == EINTR && minComplete == 0);
+
+    return ret < 0 ? -errno : ret;
+}
+
+static URING_Sqe *plUringSqe(void)
+{
+    unsigned tail;
+    unsigned idx;
+    URING_Sqe *sqe;
+
+    tail = *uring.sqTail;
+    if (tail - __atomic_load_n(uring.sqHead, __ATOMIC_ACQUIRE) >= URING_ENTRIES)
+    {
+        plUringEnter(uring.queued, 0, 0); /* full, should not happen with the few requests in flight */
+        uring.queued = 0;
+    }
+
+    idx = tail & *uring.sqMask;
+    sqe = &uring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    uring.sqArray[idx] = idx;
+    __atomic_store_n(uring.sqTail, tail + 1, __ATOMIC_RELEASE);
+    uring.queued++;
+
+    return sqe;
+}
+
+static unsigned long long plUringData(unsigned kind, unsigned port)
+{
+    return kind | (port << 8) | ((unsigned long long)uring.gen[port] << 16);
+}
+
+static void plUringArmRead(unsigned port)
+{
+    URING_Sqe *sqe;
+
+    sqe = plUringSqe();
+    sqe->opcode = URING_OP_READV;
+    sqe->fd = uring.readFd[port];
+    sqe->off = ~0ULL; /* current position, required for ttys and pipes */
+    sqe->addr = (unsigned long long)(size_t)&uring.rxIov[port];
+    sqe->len = 1;
+    sqe->userData = plUringData(URING_READ, port);
+    uring.armed[port] = 1;
+}
+
+static void plUringCompleted(const URING_Cqe *cqe)
+{
+    unsigned port;
+
+    port = URING_PORT(cqe->userData);
+    if (port >= MAX_CONNECT_PORTS)
+        return;
+
+    switch (URING_KIND(cqe->userData))
+    {
+    case URING_READ:
+        if (URING_GEN(cqe->userData) != uring.gen[port])
+            break; /* port was closed meanwhile */
+
+        uring.armed[port] = 0;
+        if (cqe->res == -ECANCELED)
+            break;
+
+        uring.done[port] = 1;
+        uring.res[port] = cqe->res;
+        break;
+
+    case URING_WRITE:
+        uring.writing = 0;
+        if (cqe->res > 0)
+        {
+            platform.io.txBytes += (unsigned)cqe->res;
+            if (platform.tx_wp - platform.tx_rp > (unsigned)cqe->res)
+                platform.tx_rp += (unsigned)cqe->res;
+            else
+                platform.tx_rp = platform.tx_wp;
+        }
+        else
+        {
+            /* drop the data, otherwise the loop would retry forever */
+            PL_Printf(DBG_DEBUG, "write() failed: %s\n", strerror(cqe->res == -ECANCELED ? ETIMEDOUT : -cqe->res));
+            platform.tx_rp = platform.tx_wp;
+        }
+        break;
+
+    default: /* timers and cancel requests */
+        break;
+    }
+}
+
+static unsigned plUringReap(void)
+{
+    unsigned n;
+    unsigned head;
+
+    n = 0;
+    head = *uring.cqHead;
+    while (head != __atomic_load_n(uring.cqTail, __ATOMIC_ACQUIRE))
+    {
+        plUringCompleted(&uring.cqes[head & *uring.cqMask]);
+        head++;
+        n++;
+    }
+
+    __atomic_store_n(uring.cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+static void plUringExit(void)
+{
+    if (uring.fd <= 0)
+        return;
+
+    if (uring.sqes)
+        munmap(uring.sqes, uring.sqesSize);
+    if (uring.cqRing && uring.cqRing != uring.sqRing)
+        munmap(uring.cqRing, uring.cqRingSize);
+    if (uring.sqRing)
+        munmap(uring.sqRing, uring.sqRingSize);
+
+    close(uring.fd);
+    memset(&uring, 0, sizeof(uring));
+}
+
+/* \returns 0 if the ring is set up, -1 if io_uring isn't available. */
+static int plUringInit(void)
+{
+    int fd;
+    unsigned port;
+    URING_Params p;
+
+    if (uring.fd > 0)
+        return 0;
+
+    memset(&uring, 0, sizeof(uring));
+    memset(&p, 0, sizeof(p));
+
+    fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (fd < 0)
+    {
+        PL_Printf(DBG_DEBUG, "io_uring_setup() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    uring.fd = fd;
+    uring.sqRingSize = p.sqOff.array + p.sqEntries * sizeof(unsigned);
+    uring.cqRingSize = p.cqOff.cqes + p.cqEntries * sizeof(URING_Cqe);
+
+    if (p.features & URING_FEAT_SINGLE_MMAP)
+    {
+        if (uring.cqRingSize > uring.sqRingSize)
+            uring.sqRingSize = uring.cqRingSize;
+        uring.cqRingSize = uring.sqRingSize;
+    }
+
+    uring.sqRing = mmap(NULL, uring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, URING_OFF_SQ_RING);
+    if (uring.sqRing == MAP_FAILED)
+    {
+        uring.sqRing = NULL;
+        goto error;
+    }
+
+    if (p.features & URING_FEAT_SINGLE_MMAP)
+    {
+        uring.cqRing = uring.sqRing;
+    }
+    else
+    {
+        uring.cqRing = mmap(NULL, uring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, URING_OFF_CQ_RING);
+        if (uring.cqRing == MAP_FAILED)
+        {
+            uring.cqRing = NULL;
+            goto error;
+        }
+    }
+
+    uring.sqesSize = p.sqEntries * sizeof(URING_Sqe);
+    uring.sqes = mmap(NULL, uring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, URING_OFF_SQES);
+    if (uring.sqes == MAP_FAILED)
+    {
+        uring.sqes = NULL;
+        goto error;
+    }
+
+    uring.sqHead = (unsigned*)(uring.sqRing + p.sqOff.head);
+    uring.sqTail = (unsigned*)(uring.sqRing + p.sqOff.tail);
+    uring.sqMask = (unsigned*)(uring.sqRing + p.sqOff.ringMask);
+    uring.sqArray = (unsigned*)(uring.sqRing + p.sqOff.array);
+    uring.cqHead = (unsigned*)(uring.cqRing + p.cqOff.head);
+    uring.cqTail = (unsigned*)(uring.cqRing + p.cqOff.tail);
+    uring.cqMask = (unsigned*)(uring.cqRing + p.cqOff.ringMask);
+    uring.cqes = (URING_Cqe*)(uring.cqRing + p.cqOff.cqes);
+
+    for (port = 0; port < MAX_CONNECT_PORTS; port++)
+    {
+        uring.rxIov[port].iov_base = uring.rxbuf[port];
+        uring.rxIov[port].iov_len = RX_BUF_SIZE;
+    }
+
+    return 0;
+
+error:
+    PL_Printf(DBG_DEBUG, "io_uring mmap() failed: %s\n", strerror(errno));
+    plUringExit();
+    return -1;
+}
+
+static void plUringWatch(int fd, unsigned port)
+{
+    uring.readFd[port] = fd;
+    uring.done[port] = 0;
+    plUringArmRead(port); /* submitted with the next wait */
+}
+
+/* Cancels the requests on the file descriptor of \p port and waits until
+   they completed, the kernel must not touch the buffers after close(). */
+static void plUringUnwatch(unsigned port)
+{
+    URING_Sqe *sqe;
+
+    if (uring.armed[port])
+    {
+        sqe = plUringSqe();
+        sqe->opcode = URING_OP_ASYNC_CANCEL;
+        sqe->addr = plUringData(URING_READ, port);
+        sqe->userData = URING_CANCEL;
+    }
+
+    if (port == 0 && uring.writing)
+    {
+        sqe = plUringSqe();
+        sqe->opcode = URING_OP_ASYNC_CANCEL;
+        sqe->addr = URING_WRITE;
+        sqe->userData = URING_CANCEL;
+    }
+
+    while (uring.armed[port] || (port == 0 && uring.writing))
+    {
+        if (plUringEnter(uring.queued, 1, URING_ENTER_GETEVENTS) < 0)
+            break;
+        uring.queued = 0;
+        plUringReap();
+    }
+
+    uring.armed[port] = 0;
+    uring.done[port] = 0;
+    uring.readFd[port] = 0;
+    uring.gen[port]++;
+}
+
+/* Queues a write of the pending tx data, \returns the number of bytes. */
+static int plUringFlush(void)
+{
+    unsigned rp;
+    unsigned len;
+    unsigned n;
+    URING_Sqe *sqe;
+
+    len = platform.tx_wp - platform.tx_rp;
+    if (uring.writing || len == 0)
+        return 0;
+
+    rp = platform.tx_rp % TX_BUF_SIZE;
+    n = TX_BUF_SIZE - rp < len ? TX_BUF_SIZE - rp : len;
+
+    uring.txIov[0].iov_base = &platform.txbuf[rp];
+    uring.txIov[0].iov_len = n;
+    uring.txIov[1].iov_base = &platform.txbuf[0];
+    uring.txIov[1].iov_len = len - n;
+
+    gcfDebugHex(platform.gcf, "send", &platform.txbuf[rp], n);
+    if (len > n)
+        gcfDebugHex(platform.gcf, "send", &platform.txbuf[0], len - n);
+
+    sqe = plUringSqe();
+    sqe->opcode = URING_OP_WRITEV;
+    sqe->flags = URING_SQE_IO_LINK;
+    sqe->fd = platform.fd;
+    sqe->off = ~0ULL;
+    sqe->addr = (unsigned long long)(size_t)&uring.txIov[0];
+    sqe->len = len > n ? 2 : 1;
+    sqe->userData = URING_WRITE;
+
+    uring.writeTs.sec = URING_WRITE_TIMEOUT / 1000;
+    uring.writeTs.nsec = (URING_WRITE_TIMEOUT % 1000) * 1000000LL;
+
+    sqe = plUringSqe();
+    sqe->opcode = URING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long long)(size_t)&uring.writeTs;
+    sqe->len = 1;
+    sqe->userData = URING_WRITE_TIMER;
+
+    uring.writing = 1;
+    uring.writeLen = len;
+
+    return (int)len;
+}
+
+/* Submits queued requests and waits up to \p timeout milliseconds for completions.
+
+   \returns The number of entries placed in \p ready, or -1 on error.
+ */
+static int plUringWait(int timeout, PL_Ready *ready, unsigned max)
+{
+    int ret;
+    int n;
+    unsigned port;
+    URING_Sqe *sqe;
+
+    n = 0;
+    for (port = 0; port < MAX_CONNECT_PORTS; port++)
+    {
+        if (uring.readFd[port] != 0 && !uring.armed[port] && !uring.done[port])
+            plUringArmRead(port);
+        if (uring.done[port])
+            n++;
+    }
+
+    if (n == 0 && plUringReap() == 0 && timeout != 0)
+    {
+        if (timeout > 0)
+        {
+            uring.waitTs.sec = timeout / 1000;
+            uring.waitTs.nsec = (timeout % 1000) * 1000000LL;
+
+            sqe = plUringSqe();
+            sqe->opcode = URING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (unsigned long long)(size_t)&uring.waitTs;
+            sqe->len = 1;
+            sqe->off = 1; /* or any other completion */
+            sqe->userData = URING_WAIT_TIMER;
+        }
+
+        ret = plUringEnter(uring.queued, 1, URING_ENTER_GETEVENTS);
+    }
+    else if (uring.queued)
+    {
+        ret = plUringEnter(uring.queued, 0, 0);
+    }
+    else
+    {
+        ret = 0;
+    }
+
+    if (ret == -EINTR)
+        ret = 0;
+
+    if (ret < 0)
+    {
+        errno = -ret;
+        return -1;
+    }
+
+    uring.queued = 0;
+    plUringReap();
+
+    n = 0;
+    for (port = 0; port < MAX_CONNECT_PORTS && (unsigned)n < max; port++)
+    {
+        if (!uring.done[port])
+            continue;
+
+        uring.done[port] = 0;
+        ready[n].port = port;
+        ready[n].readable = uring.res[port] >= 0 ? 1 : 0;
+        ready[n].hangup = uring.res[port] < 0 ? 1 : 0;
+        ready[n].data = uring.rxbuf[port];
+        ready[n].nread = uring.res[port];
+        n++;
+    }
+
+    return n;
+}
@@ -138,16 +138,22 @@ static int queryFromSystemProfiler(Device *dev, Device *end)
             {
                 state = SP_STATE_DEVICE;
                 dev->baudrate = PL_BAUDRATE_115200;
+                dev->vendorId = 0x1cf1;
+                dev->productId = 0x0030;
             }
             else if (U_sstream_starts_with(&line, "ConBee III:"))
             {
                 state = SP_STATE_DEVICE;
                 dev->baudrate = PL_BAUDRATE_115200;
+                dev->vendorId = 0x0403;
+                dev->productId = 0x6015;
             }
             else if (U_sstream_starts_with(&line, "FT230X Basic UART")) /* ConBee I */
             {
                 state = SP_STATE_DEVICE;
                 dev->baudrate = PL_BAUDRATE_38400;
+                dev->vendorId = 0x0403;
+                dev->productId = 0x6015;
             }
 
             if (state == SP_STATE_DEVICE)
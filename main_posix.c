@@ -8,7 +8,12 @@
  *
  */
 
+#ifdef PL_LINUX
+  #define _GNU_SOURCE /* posix_openpt(), ptsname() */
+#endif
+
 #include <stdio.h>
+#include <stdlib.h> /* posix_openpt() */
 #include <stdarg.h> /* va_list, ... */
 #include <poll.h>
 #include <fcntl.h> /* open() */
@@ -18,32 +23,108 @@
 #include <time.h>
 #include <string.h> /* memset() */
 #include <errno.h>
+#include <signal.h>
 #include <dlfcn.h>
 #include <termios.h> /* POSIX terminal control definitions */
+#include <sys/resource.h> /* getrusage() */
+#include <sys/stat.h> /* fstat() */
+
+#ifdef PL_LINUX
+  #include <linux/serial.h> /* TIOCGICOUNT */
+  #include <sys/epoll.h>
+  #define PL_USE_EPOLL
+  #ifndef PL_NO_IO_URING
+    #define PL_USE_IO_URING
+  #endif
+#endif
 
 #include "gcf.h"
 #include "protocol.h"
+#include "rec.h"
+#include "sim.h"
+#include "timer.h"
 #include "u_mem.h"
+#include "u_strlen.h"
 
 #define RX_BUF_SIZE 1024
-#define TX_BUF_SIZE 2048
+#define TX_BUF_SIZE 4096 /* one V3 data response with worst case escaping */
+#define MAX_IDLE_WAIT 1000 /* ms, upper bound for a loop wait without timer */
+#define PL_SIM_FD -1 /* platform.fd of the --dry-run device model and --replay */
+#define PL_ICOUNT_INTERVAL 1000 /* ms, sampling of the UART counters while connected */
+#define PL_PACE_UNIT 16 /* bytes, write granularity of TX pacing without USB packet size */
 
+/* Token bucket of PL_SetTxPacing(), tokens are in byte microseconds. */
 typedef struct
 {
-    PL_time_t timer;
+    unsigned long rate; /* bytes per second, 0 = off */
+    unsigned unit; /* writes are multiples of this, except the tail */
+    unsigned long long capacity; /* burst */
+    unsigned long long tokens;
+    PL_time_t refillUs;
+    unsigned long timer;
+} PL_TxPacing;
+
+typedef struct
+{
+    TIMER_Wheel timers;
+    unsigned long timeout; /* timer handle of PL_SetTimeout() */
     int fd;
-    unsigned char running;
+    volatile sig_atomic_t running;
     unsigned char rxbuf[RX_BUF_SIZE];
     unsigned char txbuf[TX_BUF_SIZE];
     unsigned tx_rp;
     unsigned tx_wp;
+    unsigned tx_rec; /* --record: bytes up to here are recorded */
+    PL_TxPacing pace;
+    int monitorFd[MAX_CONNECT_PORTS]; /* indexed by port, [0] is unused (platform.fd) */
+
+    /* pty proxy (-p) */
+    unsigned proxyPort;
+    int proxySlaveFd; /* kept open so the master doesn't hang up while no client is attached */
+    char proxyLink[MAX_DEV_PATH_LENGTH];
+    unsigned long proxyChunks;
+    unsigned long long proxyBytes;
+    PL_time_t proxyLatencySum; /* microseconds */
+    PL_time_t proxyLatencyMin;
+    PL_time_t proxyLatencyMax;
+
+    unsigned loopbackPort; /* pty master of PL_ConnectLoopback(), echoes all bytes */
+#ifdef PL_USE_EPOLL
+    int epfd;
+#endif
+    int useUring; /* io_uring backend is active */
+    PL_IoStats io;
+    PL_UartStats uart; /* deltas of all connections */
+#ifdef PL_LINUX
+    int icountOk; /* the driver of platform.fd supports TIOCGICOUNT */
+    unsigned long icountTimer;
+    struct serial_icounter_struct icount; /* last sample */
+#endif
     GCF *gcf;
 } PL_Internal;
 
+/* A ready file descriptor as reported by plWait(). */
+typedef struct
+{
+    unsigned port; /* 0 = primary device */
+    unsigned char readable;
+    unsigned char hangup;
+    unsigned char *data; /* io_uring: the already read data */
+    int nread;
+} PL_Ready;
+
 static PL_Internal platform;
 
+#ifdef PL_USE_IO_URING
+  #include "linux_io_uring.c"
+#endif
+
+#include "posix_port_lock.c"
+
 #ifdef PL_LINUX
 int plGetLinuxUSBDevices(Device *dev, Device *end);
+int plLinuxUsbPowerOn(const char *devpath);
+void plLinuxUsbPowerRestore(void);
 
 #ifdef HAS_LIBGPIOD
 int plResetRaspBeeLibGpiod(void);
@@ -86,12 +167,158 @@ static int plSetupPort(int fd, int baudrate)
     return 0;
 }
 
+/* Registers \p fd for read events of \p port in the event loop. */
+static void plWatchFd(int fd, unsigned port)
+{
+#ifdef PL_USE_IO_URING
+    if (platform.useUring)
+    {
+        plUringWatch(fd, port);
+        return;
+    }
+#endif
+#ifdef PL_USE_EPOLL
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = port;
+    if (epoll_ctl(platform.epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        PL_Printf(DBG_DEBUG, "epoll_ctl() failed: %s\n", strerror(errno));
+    }
+#else
+    (void)fd;
+    (void)port;
+#endif
+}
+
+static void plUnwatchFd(int fd, unsigned port)
+{
+#ifdef PL_USE_IO_URING
+    if (platform.useUring)
+    {
+        plUringUnwatch(port);
+        return;
+    }
+#endif
+#ifdef PL_USE_EPOLL
+    epoll_ctl(platform.epfd, EPOLL_CTL_DEL, fd, NULL);
+#else
+    (void)fd;
+#endif
+    (void)port;
+}
+
+/* Waits up to \p timeout milliseconds for ready file descriptors.
+
+   \returns The number of entries placed in \p ready, or -1 on error.
+ */
+static int plWait(int timeout, PL_Ready *ready, unsigned max)
+{
+    int i;
+    int n;
+#ifdef PL_USE_EPOLL
+    struct epoll_event events[MAX_CONNECT_PORTS];
+#endif
+
+#ifdef PL_USE_IO_URING
+    if (platform.useUring)
+        return plUringWait(timeout, ready, max);
+#endif
+
+    platform.io.waits++;
+
+#ifdef PL_USE_EPOLL
+    if (max > MAX_CONNECT_PORTS)
+        max = MAX_CONNECT_PORTS;
+
+    n = epoll_wait(platform.epfd, events, (int)max, timeout);
+
+    for (i = 0; i < n; i++)
+    {
+        ready[i].port = events[i].data.u32;
+        ready[i].readable = (events[i].events & EPOLLIN) ? 1 : 0;
+        ready[i].hangup = (events[i].events & (EPOLLHUP | EPOLLERR)) ? 1 : 0;
+        ready[i].data = NULL;
+    }
+#else
+    unsigned port;
+    unsigned nfds;
+    struct pollfd fds[MAX_CONNECT_PORTS];
+    unsigned ports[MAX_CONNECT_PORTS];
+
+    nfds = 0;
+    for (port = 0; port < MAX_CONNECT_PORTS; port++)
+    {
+        fds[nfds].fd = port == 0 ? platform.fd : platform.monitorFd[port];
+        if (fds[nfds].fd == 0)
+            continue;
+
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        ports[nfds] = port;
+        nfds++;
+    }
+
+    n = poll(fds, nfds, timeout);
+
+    if (n > 0)
+    {
+        n = 0;
+        for (i = 0; i < (int)nfds && (unsigned)n < max; i++)
+        {
+            if (fds[i].revents == 0)
+                continue;
+
+            ready[n].port = ports[i];
+            ready[n].readable = (fds[i].revents & POLLIN) ? 1 : 0;
+            ready[n].hangup = (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) ? 1 : 0;
+            ready[n].data = NULL;
+            n++;
+        }
+    }
+#endif
+
+    if (n < 0 && errno == EINTR)
+        n = 0;
+
+    return n;
+}
+
+/* Returns a monotonic timestamps in microseconds */
+PL_time_t PL_TimeUs(void)
+{
+    PL_time_t res;
+    struct timespec ts;
+
+    if (SIM_Active())
+        return SIM_TimeUs();
+
+    if (REC_Replaying())
+        return REC_TimeUs();
+
+    res = 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    {
+        res = (PL_time_t)ts.tv_sec * 1000000;
+        res += (PL_time_t)ts.tv_nsec / 1000;
+    }
+
+    return res;
+}
+
 /* Returns a monotonic timestamps in milliseconds */
 PL_time_t PL_Time()
 {
     PL_time_t res;
     struct timespec ts;
 
+    if (SIM_Active())
+        return SIM_TimeUs() / 1000;
+
+    if (REC_Replaying())
+        return REC_TimeUs() / 1000;
+
     res = 0;
     if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
     {
@@ -104,6 +331,18 @@ PL_time_t PL_Time()
 
 void PL_MSleep(unsigned long ms)
 {
+    if (SIM_Active())
+    {
+        SIM_Sleep(ms);
+        return;
+    }
+
+    if (REC_Replaying())
+    {
+        REC_Sleep(ms);
+        return;
+    }
+
     while (ms > 0)
     {
         usleep(1000);
@@ -111,10 +350,11 @@ void PL_MSleep(unsigned long ms)
     }
 }
 
-int PL_ResetFTDI(int num, const char *serialnum)
+static int plResetFTDI(void)
 {
-    (void)num;
-    (void)serialnum;
+    if (SIM_Active())
+        return SIM_Reset();
+
 #ifdef HAS_LIBGPIOD
     return plResetFtdiLibGpiod();
 #endif
@@ -126,14 +366,44 @@ int PL_ResetFTDI(int num, const char *serialnum)
     return -1;
 }
 
-int PL_ResetRaspBee()
+int PL_ResetFTDI(int num, const char *serialnum)
+{
+    int result;
+
+    (void)num;
+    (void)serialnum;
+
+    if (REC_Replaying())
+        return REC_ReplayResult(REC_RESET);
+
+    result = plResetFTDI();
+    REC_AddResult(REC_RESET, result);
+    return result;
+}
+
+static int plResetRaspBee(void)
 {
+    if (SIM_Active())
+        return SIM_Reset();
+
 #ifdef HAS_LIBGPIOD
     return plResetRaspBeeLibGpiod();
 #endif
     return -1;
 }
 
+int PL_ResetRaspBee()
+{
+    int result;
+
+    if (REC_Replaying())
+        return REC_ReplayResult(REC_RESET);
+
+    result = plResetRaspBee();
+    REC_AddResult(REC_RESET, result);
+    return result;
+}
+
 void PL_Print(const char *line)
 {
     ssize_t n = write(STDOUT_FILENO, line, strlen(line));
@@ -158,7 +428,82 @@ void PL_Printf(DebugLevel level, const char *format, ...)
     va_end (args);
 }
 
-GCF_Status PL_Connect(const char *path, PL_Baudrate baudrate)
+#ifdef PL_LINUX
+/* Adds the counter deltas since the last sample, new errors are traced. */
+static void plSampleICount(void)
+{
+    struct serial_icounter_struct now;
+    struct serial_icounter_struct *last;
+    unsigned long overrun;
+    unsigned long bufOverrun;
+    unsigned long frame;
+    unsigned long parity;
+
+    if (!platform.icountOk || platform.fd <= 0 || ioctl(platform.fd, TIOCGICOUNT, &now) != 0)
+        return;
+
+    last = &platform.icount;
+    overrun = (unsigned long)(now.overrun - last->overrun);
+    bufOverrun = (unsigned long)(now.buf_overrun - last->buf_overrun);
+    frame = (unsigned long)(now.frame - last->frame);
+    parity = (unsigned long)(now.parity - last->parity);
+
+    platform.uart.rx += (unsigned long)(now.rx - last->rx);
+    platform.uart.tx += (unsigned long)(now.tx - last->tx);
+    platform.uart.overrun += overrun;
+    platform.uart.bufOverrun += bufOverrun;
+    platform.uart.frame += frame;
+    platform.uart.parity += parity;
+    platform.uart.brk += (unsigned long)(now.brk - last->brk);
+
+    if (overrun || bufOverrun || frame || parity)
+    {
+        PL_Printf(DBG_INFO, "uart errors: +%lu overrun, +%lu buffer overrun, +%lu frame, +%lu parity\n",
+                  overrun, bufOverrun, frame, parity);
+    }
+
+    *last = now;
+}
+
+static void plICountTimerFired(void *arg)
+{
+    (void)arg;
+    plSampleICount();
+    platform.icountTimer = PL_StartTimer((PL_time_t)PL_ICOUNT_INTERVAL * 1000, plICountTimerFired, NULL);
+}
+
+/* Takes the baseline of a new connection, ptys and some USB drivers don't have counters. */
+static void plStartICount(void)
+{
+    platform.icountOk = ioctl(platform.fd, TIOCGICOUNT, &platform.icount) == 0;
+    if (!platform.icountOk)
+    {
+        PL_Printf(DBG_DEBUG, "TIOCGICOUNT not supported: %s\n", strerror(errno));
+        return;
+    }
+
+    platform.uart.supported = 1;
+    platform.icountTimer = PL_StartTimer((PL_time_t)PL_ICOUNT_INTERVAL * 1000, plICountTimerFired, NULL);
+}
+
+static void plStopICount(void)
+{
+    plSampleICount();
+    PL_StopTimer(platform.icountTimer);
+    platform.icountTimer = 0;
+    platform.icountOk = 0;
+}
+#endif /* PL_LINUX */
+
+void PL_GetUartStats(PL_UartStats *stats)
+{
+#ifdef PL_LINUX
+    plSampleICount();
+#endif
+    *stats = platform.uart;
+}
+
+static GCF_Status plConnect(const char *path, PL_Baudrate baudrate)
 {
     PL_Printf(DBG_DEBUG, "PL_Connect\n");
 
@@ -170,9 +515,22 @@ GCF_Status PL_Connect(const char *path, PL_Baudrate baudrate)
         return GCF_SUCCESS;
     }
 
+    if (SIM_Active())
+    {
+        if (SIM_Connect() != 0)
+            return GCF_FAILED;
+
+        platform.fd = PL_SIM_FD;
+        platform.tx_rp = 0;
+        platform.tx_wp = 0;
+        platform.tx_rec = 0;
+        return GCF_SUCCESS;
+    }
+
     platform.fd = open(path, O_CLOEXEC | O_RDWR /*| O_NONBLOCK*/);
     platform.tx_rp = 0;
     platform.tx_wp = 0;
+    platform.tx_rec = 0;
 
     if (platform.fd < 0)
     {
@@ -181,6 +539,17 @@ GCF_Status PL_Connect(const char *path, PL_Baudrate baudrate)
         return GCF_FAILED;
     }
 
+    /* the UUCP lock from PL_ClaimPort() doesn't stop processes which only use flock() */
+    if (flock(platform.fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        PL_Printf(DBG_INFO, "device %s is locked by another process\n", path);
+        close(platform.fd);
+        platform.fd = 0;
+        return GCF_FAILED;
+    }
+
+    ioctl(platform.fd, TIOCEXCL);
+
     if (baudrate == PL_BAUDRATE_38400)
     {
         baudrate1 = B38400;
@@ -206,96 +575,592 @@ GCF_Status PL_Connect(const char *path, PL_Baudrate baudrate)
     }
 
     plSetupPort(platform.fd, baudrate1);
+    plWatchFd(platform.fd, 0);
+#ifdef PL_LINUX
+    plStartICount();
+#endif
 
     PL_Printf(DBG_DEBUG, "connected to %s, baudrate: %d\n", path, baudrate);
 
     return GCF_SUCCESS;
 }
 
-void PL_Disconnect()
+GCF_Status PL_Connect(const char *path, PL_Baudrate baudrate)
 {
-    PL_Printf(DBG_DEBUG, "PL_Disconnect\n");
-    if (platform.fd != 0)
+    GCF_Status result;
+
+    if (REC_Replaying())
     {
-        close(platform.fd);
-        platform.fd = 0;
+        if (REC_ReplayResult(REC_CONNECT) != 0)
+            return GCF_FAILED;
+
+        if (platform.fd == 0)
+        {
+            platform.fd = PL_SIM_FD;
+            platform.tx_rp = 0;
+            platform.tx_wp = 0;
+            platform.tx_rec = 0;
+        }
+        return GCF_SUCCESS;
     }
-    platform.tx_rp = 0;
-    platform.tx_wp = 0;
-    GCF_HandleEvent(platform.gcf, EV_DISCONNECTED);
+
+    result = plConnect(path, baudrate);
+    REC_AddResult(REC_CONNECT, result == GCF_SUCCESS ? 0 : -1);
+    return result;
 }
 
-void PL_ShutDown()
+int PL_SetBaudrate(PL_Baudrate baudrate)
 {
-    PL_Printf(DBG_DEBUG, "shutdown\n");
-    platform.running = 0;
+    speed_t speed;
+    struct termios options;
+
+    if (platform.fd == PL_SIM_FD)
+        return 0; /* the device model and --replay have no line */
+
+    if (platform.fd == 0)
+        return -1;
+
+    speed = baudrate == PL_BAUDRATE_115200 ? B115200 : B38400;
+
+    if (tcgetattr(platform.fd, &options) != 0)
+        return -1;
+
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+
+    if (tcsetattr(platform.fd, TCSANOW, &options) != 0)
+        return -1;
+
+    tcflush(platform.fd, TCIFLUSH); /* garbage received at the old rate */
+    PL_Printf(DBG_DEBUG, "baudrate: %d\n", baudrate);
+
+    return 0;
 }
 
-int PL_ReadFile(const char *path, unsigned char *buf, unsigned long buflen)
+int PL_ConnectMonitor(const char *path, PL_Baudrate baudrate)
 {
     int fd;
-    int ret;
-
-    Assert(path && buf && buflen >= MAX_GCF_FILE_SIZE);
-
-    ret = -1;
-    fd = open(path, O_RDONLY);
+    int port;
 
-    if (fd == -1)
+    for (port = 1; port < MAX_CONNECT_PORTS; port++)
     {
-        PL_Printf(DBG_DEBUG, "failed to open %s, err: %s\n", path, strerror(errno));
-        return ret;
+        if (platform.monitorFd[port] == 0)
+            break;
     }
 
-    ret = (int)read(fd, buf, buflen);
-    if (ret == -1)
-    {
-        PL_Printf(DBG_DEBUG, "failed to read %s, err: %s\n", path, strerror(errno));
-    }
+    if (port == MAX_CONNECT_PORTS)
+        return -1;
 
-    if (close(fd) == -1)
+    fd = open(path, O_CLOEXEC | O_RDWR);
+    if (fd < 0)
     {
-        PL_Printf(DBG_DEBUG, "failed to close %s, err: %s\n", path, strerror(errno));
+        PL_Printf(DBG_DEBUG, "failed to open device %s\n", path);
+        return -1;
     }
 
-    return ret;
-}
+    plSetupPort(fd, baudrate == PL_BAUDRATE_115200 ? B115200 : B38400);
+    platform.monitorFd[port] = fd;
+    plWatchFd(fd, (unsigned)port);
 
-void PL_SetTimeout(unsigned long ms)
-{
-    platform.timer = PL_Time() + ms;
-}
+    PL_Printf(DBG_DEBUG, "monitor %s as port %d, baudrate: %d\n", path, port, baudrate);
 
-void PL_ClearTimeout(void)
-{
-    platform.timer = 0;
+    return port;
 }
 
-int PL_GetDevices(Device *devs, unsigned max)
+int PL_ConnectProxy(const char *link)
 {
-    int result = 0;
+    int fd;
+    int port;
+    const char *slave;
+    struct termios options;
 
-    U_bzero(devs, sizeof(*devs) * max);
+    if (platform.fd == 0 || platform.proxyPort != 0)
+        return -1;
 
-#ifdef PL_LINUX
-    result = plGetLinuxUSBDevices(devs, devs + max);
-#endif
+    for (port = 1; port < MAX_CONNECT_PORTS; port++)
+    {
+        if (platform.monitorFd[port] == 0)
+            break;
+    }
 
-#ifdef PL_MAC
-    result = plGetMacOSUSBDevices(devs, devs + max);
-#endif
+    if (port == MAX_CONNECT_PORTS || U_strlen(link) >= sizeof(platform.proxyLink))
+        return -1;
 
-    return result;
-}
+    fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0 || (slave = ptsname(fd)) == NULL)
+    {
+        PL_Printf(DBG_INFO, "failed to create pty: %s\n", strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
 
-int PROT_Write(const unsigned char *data, unsigned len)
-{
-    int result;
-    unsigned i;
+    platform.proxySlaveFd = open(slave, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (platform.proxySlaveFd < 0)
+    {
+        PL_Printf(DBG_INFO, "failed to open pty %s: %s\n", slave, strerror(errno));
+        platform.proxySlaveFd = 0;
+        close(fd);
+        return -1;
+    }
 
-    result = 0;
-    for (i = 0; i < len; i++)
-        result += PROT_Putc(data[i]);
+    /* the client expects a raw serial port */
+    if (tcgetattr(platform.proxySlaveFd, &options) == 0)
+    {
+        cfmakeraw(&options);
+        tcsetattr(platform.proxySlaveFd, TCSANOW, &options);
+    }
+
+    unlink(link); /* stale link of a previous run */
+    if (symlink(slave, link) != 0)
+    {
+        PL_Printf(DBG_INFO, "failed to create link %s: %s\n", link, strerror(errno));
+        close(platform.proxySlaveFd);
+        platform.proxySlaveFd = 0;
+        close(fd);
+        return -1;
+    }
+
+    U_memcpy(platform.proxyLink, link, U_strlen(link) + 1);
+    platform.monitorFd[port] = fd;
+    platform.proxyPort = (unsigned)port;
+    platform.proxyChunks = 0;
+    platform.proxyBytes = 0;
+    platform.proxyLatencySum = 0;
+    platform.proxyLatencyMin = 0;
+    platform.proxyLatencyMax = 0;
+    plWatchFd(fd, (unsigned)port);
+
+    PL_Printf(DBG_DEBUG, "proxy pty %s linked as %s\n", slave, link);
+
+    return port;
+}
+
+GCF_Status PL_ConnectLoopback(PL_Baudrate baudrate)
+{
+    int fd;
+    int port;
+    char slave[MAX_DEV_PATH_LENGTH];
+    const char *name;
+
+    if (platform.fd != 0 || platform.loopbackPort != 0)
+        return GCF_FAILED;
+
+    for (port = 1; port < MAX_CONNECT_PORTS; port++)
+    {
+        if (platform.monitorFd[port] == 0)
+            break;
+    }
+
+    if (port == MAX_CONNECT_PORTS)
+        return GCF_FAILED;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0 || (name = ptsname(fd)) == NULL ||
+        U_strlen(name) >= sizeof(slave))
+    {
+        PL_Printf(DBG_INFO, "failed to create pty: %s\n", strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return GCF_FAILED;
+    }
+
+    U_memcpy(slave, name, U_strlen(name) + 1);
+
+    /* the slave is opened like a serial port, raw mode means no echo on the slave side */
+    if (plConnect(slave, baudrate) != GCF_SUCCESS)
+    {
+        close(fd);
+        return GCF_FAILED;
+    }
+
+    platform.monitorFd[port] = fd;
+    platform.loopbackPort = (unsigned)port;
+    plWatchFd(fd, (unsigned)port);
+
+    PL_Printf(DBG_DEBUG, "loopback pty %s as port %d\n", slave, port);
+
+    return GCF_SUCCESS;
+}
+
+/* Writes all \p len bytes to \p fd, returns 0 on success. */
+static int plWriteAll(int fd, const unsigned char *data, unsigned len)
+{
+    int n;
+    unsigned pos;
+
+    for (pos = 0; pos < len;)
+    {
+        platform.io.writes++;
+        n = (int)write(fd, &data[pos], len - pos);
+        if (n > 0)
+        {
+            pos += (unsigned)n;
+            platform.io.txBytes += (unsigned)n;
+        }
+        else if (n == -1 && errno == EINTR)
+            continue;
+        else
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Forwards data read on one side of the proxy to the other side.
+
+   The latency is measured from the wakeup of the event loop until the
+   data is handed over to the other file descriptor.
+ */
+static void plProxyForward(unsigned port, const unsigned char *data, unsigned len, PL_time_t wakeup)
+{
+    int fd;
+    PL_time_t latency;
+
+    fd = port == 0 ? platform.monitorFd[platform.proxyPort] : platform.fd;
+
+    if (fd == 0 || plWriteAll(fd, data, len) != 0)
+    {
+        PL_Printf(DBG_DEBUG, "proxy forward failed: %s\n", strerror(errno));
+        return;
+    }
+
+    latency = PL_TimeUs() - wakeup;
+    if (platform.proxyChunks == 0 || latency < platform.proxyLatencyMin)
+        platform.proxyLatencyMin = latency;
+    if (latency > platform.proxyLatencyMax)
+        platform.proxyLatencyMax = latency;
+
+    platform.proxyLatencySum += latency;
+    platform.proxyBytes += len;
+    platform.proxyChunks++;
+}
+
+static void plCloseMonitor(unsigned port)
+{
+    if (platform.monitorFd[port] != 0)
+    {
+        plUnwatchFd(platform.monitorFd[port], port);
+        close(platform.monitorFd[port]);
+        platform.monitorFd[port] = 0;
+    }
+
+    if (port != 0 && port == platform.proxyPort)
+    {
+        if (platform.proxyChunks > 0)
+        {
+            PL_Printf(DBG_INFO, "proxy: %lu chunks, %llu bytes, forward latency min/avg/max: %llu/%llu/%llu us\n",
+                      platform.proxyChunks, platform.proxyBytes,
+                      platform.proxyLatencyMin, platform.proxyLatencySum / platform.proxyChunks, platform.proxyLatencyMax);
+        }
+
+        close(platform.proxySlaveFd);
+        unlink(platform.proxyLink);
+        platform.proxySlaveFd = 0;
+        platform.proxyPort = 0;
+    }
+
+    if (port != 0 && port == platform.loopbackPort)
+        platform.loopbackPort = 0;
+}
+
+void PL_Disconnect()
+{
+    unsigned port;
+
+    PL_Printf(DBG_DEBUG, "PL_Disconnect\n");
+    if (platform.fd == PL_SIM_FD)
+    {
+        if (SIM_Active())
+            SIM_Disconnect();
+        platform.fd = 0;
+    }
+    else if (platform.fd != 0)
+    {
+        plUnwatchFd(platform.fd, 0);
+#ifdef PL_LINUX
+        plStopICount();
+#endif
+        ioctl(platform.fd, TIOCNXCL);
+        close(platform.fd);
+        platform.fd = 0;
+    }
+
+    for (port = 1; port < MAX_CONNECT_PORTS; port++)
+        plCloseMonitor(port);
+
+    platform.tx_rp = 0;
+    platform.tx_wp = 0;
+    platform.tx_rec = 0;
+    PL_StopTimer(platform.pace.timer);
+    platform.pace.timer = 0;
+    platform.pace.tokens = platform.pace.capacity;
+    GCF_HandleEvent(platform.gcf, EV_DISCONNECTED);
+}
+
+void PL_ShutDown()
+{
+    PL_Printf(DBG_DEBUG, "shutdown\n");
+    platform.running = 0;
+}
+
+int PL_ReadFile(const char *path, unsigned char *buf, unsigned long buflen)
+{
+    int fd;
+    int ret;
+
+    Assert(path && buf && buflen >= MAX_GCF_FILE_SIZE);
+
+    ret = -1;
+    fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        PL_Printf(DBG_DEBUG, "failed to open %s, err: %s\n", path, strerror(errno));
+        return ret;
+    }
+
+    ret = (int)read(fd, buf, buflen);
+    if (ret == -1)
+    {
+        PL_Printf(DBG_DEBUG, "failed to read %s, err: %s\n", path, strerror(errno));
+    }
+
+    if (close(fd) == -1)
+    {
+        PL_Printf(DBG_DEBUG, "failed to close %s, err: %s\n", path, strerror(errno));
+    }
+
+    return ret;
+}
+
+int PL_OpenFile(const char *path, unsigned long *size)
+{
+    int fd;
+    struct stat st;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        PL_Printf(DBG_DEBUG, "failed to open %s, err: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+
+    *size = (unsigned long)st.st_size;
+    return fd;
+}
+
+long PL_ReadFileAt(int file, unsigned long offset, unsigned char *buf, unsigned long len)
+{
+    ssize_t n;
+
+    do
+    {
+        n = pread(file, buf, len, (off_t)offset);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+        PL_Printf(DBG_DEBUG, "failed to read at %lu, err: %s\n", offset, strerror(errno));
+
+    return (long)n;
+}
+
+void PL_CloseFile(int file)
+{
+    if (file >= 0)
+        close(file);
+}
+
+static void plTimeoutFired(void *arg)
+{
+    (void)arg;
+    platform.timeout = 0;
+    REC_Add(REC_TIMEOUT, 0, 0);
+    GCF_HandleEvent(platform.gcf, EV_TIMEOUT);
+}
+
+void PL_SetTimeout(unsigned long ms)
+{
+    PL_StopTimer(platform.timeout);
+    platform.timeout = PL_StartTimer((PL_time_t)ms * 1000, plTimeoutFired, NULL);
+}
+
+void PL_ClearTimeout(void)
+{
+    PL_StopTimer(platform.timeout);
+    platform.timeout = 0;
+}
+
+unsigned long PL_StartTimer(PL_time_t us, PL_TimerFunc fn, void *arg)
+{
+    return TIMER_Start(&platform.timers, PL_TimeUs() + us, fn, arg);
+}
+
+void PL_StopTimer(unsigned long handle)
+{
+    if (handle != 0)
+        TIMER_Stop(&platform.timers, handle);
+}
+
+int PL_UsbPowerOn(const char *path)
+{
+    if (SIM_Active() || REC_Replaying())
+        return -1;
+
+#ifdef PL_LINUX
+    return plLinuxUsbPowerOn(path);
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+void PL_UsbPowerRestore(void)
+{
+#ifdef PL_LINUX
+    plLinuxUsbPowerRestore();
+#endif
+}
+
+int PL_SetIoBackend(const char *name)
+{
+    unsigned port;
+
+    if (platform.fd != 0)
+        return -1;
+
+    for (port = 1; port < MAX_CONNECT_PORTS; port++)
+    {
+        if (platform.monitorFd[port] != 0)
+            return -1;
+    }
+
+    if (strcmp(name, "poll") == 0)
+    {
+#ifdef PL_USE_IO_URING
+        plUringExit();
+#endif
+        platform.useUring = 0;
+        return 0;
+    }
+
+#ifdef PL_USE_IO_URING
+    if (strcmp(name, "uring") == 0)
+    {
+        if (plUringInit() != 0)
+            return -1;
+
+        platform.useUring = 1;
+        return 0;
+    }
+#endif
+
+    return -1;
+}
+
+void PL_GetIoStats(PL_IoStats *stats)
+{
+    *stats = platform.io;
+#ifdef PL_USE_EPOLL
+    stats->backend = platform.useUring ? "io_uring" : "epoll";
+#else
+    stats->backend = "poll";
+#endif
+}
+
+int PL_GetUsage(PL_Usage *usage)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return -1;
+
+    usage->userUs = (unsigned long long)ru.ru_utime.tv_sec * 1000000 + (unsigned long long)ru.ru_utime.tv_usec;
+    usage->systemUs = (unsigned long long)ru.ru_stime.tv_sec * 1000000 + (unsigned long long)ru.ru_stime.tv_usec;
+    usage->voluntarySwitches = (unsigned long)ru.ru_nvcsw;
+    usage->involuntarySwitches = (unsigned long)ru.ru_nivcsw;
+#ifdef PL_MAC
+    usage->maxRssKb = (unsigned long)ru.ru_maxrss / 1024; /* bytes on macOS */
+#else
+    usage->maxRssKb = (unsigned long)ru.ru_maxrss;
+#endif
+#ifdef PL_LINUX
+    {
+        /* ru_maxrss keeps the peak of the forking shell across execve(), VmHWM starts with the program */
+        int fd;
+        ssize_t n;
+        char *p;
+        unsigned long kb;
+        char buf[2048];
+
+        fd = open("/proc/self/status", O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            n = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+            buf[n > 0 ? n : 0] = '\0';
+
+            p = strstr(buf, "VmHWM:");
+            if (p)
+            {
+                p += 6;
+                while (*p == ' ' || *p == '\t')
+                    p++;
+
+                kb = 0;
+                while (*p >= '0' && *p <= '9')
+                    kb = kb * 10 + (unsigned long)(*p++ - '0');
+
+                if (kb != 0)
+                    usage->maxRssKb = kb;
+            }
+        }
+    }
+#endif
+    return 0;
+}
+
+int PL_GetDevices(Device *devs, unsigned max)
+{
+    int result = 0;
+
+    U_bzero(devs, sizeof(*devs) * max);
+
+    if (SIM_Active())
+    {
+        REC_AddDevices(devs, 0);
+        return 0;
+    }
+
+    if (REC_Replaying())
+        return REC_ReplayDevices(devs, max);
+
+#ifdef PL_LINUX
+    result = plGetLinuxUSBDevices(devs, devs + max);
+#endif
+
+#ifdef PL_MAC
+    result = plGetMacOSUSBDevices(devs, devs + max);
+#endif
+
+    REC_AddDevices(devs, result);
+    return result;
+}
+
+int PROT_Write(const unsigned char *data, unsigned len)
+{
+    int result;
+    unsigned i;
+
+    result = 0;
+    for (i = 0; i < len; i++)
+        result += PROT_Putc(data[i]);
 
     PROT_Flush();
 
@@ -316,32 +1181,43 @@ int PROT_Putc(unsigned char ch)
     return 1;
 }
 
-int PROT_Flush()
+/* Writes up to 512 pending bytes, but not more than \p max, \returns the number of bytes written. */
+static int plFlushChunk(unsigned max)
 {
     int n;
     unsigned pos;
     unsigned len;
     unsigned char buf[512];
 
-    if (platform.fd == 0)
-    {
-        platform.tx_wp = 0;
-        platform.tx_rp = 0;
-        GCF_HandleEvent(platform.gcf, EV_DISCONNECTED);
-        return -1;
-    }
-
-    for (len = 0; len < sizeof(buf); len++)
+    for (len = 0; len < sizeof(buf) && len < max; len++)
     {
         if ((platform.tx_wp % TX_BUF_SIZE) == ((platform.tx_rp + len) % TX_BUF_SIZE))
             break;
         buf[len] = platform.txbuf[(platform.tx_rp + len) % TX_BUF_SIZE];
     }
 
+    if (len == 0)
+        return 0;
+
     gcfDebugHex(platform.gcf, "send", &buf[0], len);
 
+    if (platform.fd == PL_SIM_FD)
+    {
+        if (REC_Replaying())
+        {
+            REC_ReplayTx(&buf[0], len);
+        }
+        else
+        {
+            SIM_Write(&buf[0], len);
+        }
+        platform.tx_rp += len;
+        return (int)len;
+    }
+
     for (pos = 0; pos < len;)
     {
+        platform.io.writes++;
         n = (int)write(platform.fd, &buf[pos], len - pos);
         if (n == -1)
         {
@@ -361,19 +1237,166 @@ int PROT_Flush()
     }
 
     platform.tx_rp += pos;
+    platform.io.txBytes += pos;
 
     return (int)pos;
 }
 
+/* Records the queued bytes, before any backend splits them into writes. */
+static void plRecordTx(void)
+{
+    unsigned n;
+
+    if ((int)(platform.tx_rp - platform.tx_rec) > 0)
+        platform.tx_rec = platform.tx_rp; /* oldest overwritten */
+
+    while (platform.tx_rec != platform.tx_wp)
+    {
+        n = TX_BUF_SIZE - platform.tx_rec % TX_BUF_SIZE; /* up to the end of the ring */
+        if (platform.tx_wp - platform.tx_rec < n)
+            n = platform.tx_wp - platform.tx_rec;
+
+        REC_Add(REC_TX, &platform.txbuf[platform.tx_rec % TX_BUF_SIZE], n);
+        platform.tx_rec += n;
+    }
+}
+
+int PL_SetTxPacing(unsigned long rate, unsigned burst, unsigned packet)
+{
+    PL_TxPacing *pace = &platform.pace;
+
+    PL_StopTimer(pace->timer);
+    U_bzero(pace, sizeof(*pace));
+
+    if (rate == 0 || REC_Replaying())
+        return 0; /* timers of the replay don't run on their own */
+
+    pace->rate = rate;
+    pace->unit = packet ? packet : PL_PACE_UNIT;
+    if (burst < pace->unit)
+        burst = pace->unit;
+
+    pace->capacity = (unsigned long long)burst * 1000000;
+    pace->tokens = pace->capacity;
+    pace->refillUs = PL_TimeUs();
+    return 0;
+}
+
+static void plPaceTimerFired(void *arg)
+{
+    (void)arg;
+    platform.pace.timer = 0;
+    PROT_Flush();
+}
+
+/* Writes as many queued bytes as the token bucket allows, the rest is
+   written by a timer when enough tokens are available. */
+static int plPacedFlush(void)
+{
+    int n;
+    int result;
+    unsigned len;
+    unsigned need;
+    PL_time_t now;
+    PL_TxPacing *pace = &platform.pace;
+
+    if (pace->timer)
+        return 0; /* the timer flushes */
+
+    now = PL_TimeUs();
+    if (now - pace->refillUs >= pace->capacity / pace->rate)
+        pace->tokens = pace->capacity;
+    else
+        pace->tokens += (now - pace->refillUs) * pace->rate;
+
+    if (pace->tokens > pace->capacity)
+        pace->tokens = pace->capacity;
+    pace->refillUs = now;
+
+    result = 0;
+    while (platform.tx_wp != platform.tx_rp)
+    {
+        len = platform.tx_wp - platform.tx_rp;
+        need = len < pace->unit ? len : pace->unit;
+
+        if (pace->tokens < (unsigned long long)need * 1000000)
+        {
+            pace->timer = PL_StartTimer((need * 1000000ULL - pace->tokens + pace->rate - 1) / pace->rate, plPaceTimerFired, NULL);
+            platform.io.paceWaits++;
+            break;
+        }
+
+        if (len > pace->tokens / 1000000)
+        {
+            len = (unsigned)(pace->tokens / 1000000);
+            len -= len % pace->unit; /* whole USB packets */
+        }
+
+        n = plFlushChunk(len);
+        if (n <= 0)
+            break;
+
+        pace->tokens -= (unsigned long long)n * 1000000;
+        result += n;
+    }
+
+    return result;
+}
+
+int PROT_Flush()
+{
+    int n;
+    int result;
+
+    if (platform.fd == 0)
+    {
+        platform.tx_wp = 0;
+        platform.tx_rec = 0;
+        platform.tx_rp = 0;
+        GCF_HandleEvent(platform.gcf, EV_DISCONNECTED);
+        return -1;
+    }
+
+    if (REC_Recording())
+        plRecordTx();
+
+    if (platform.pace.rate)
+        return plPacedFlush(); /* also with io_uring, writes are small and spread */
+
+#ifdef PL_USE_IO_URING
+    if (platform.useUring && platform.fd != PL_SIM_FD)
+        return plUringFlush(); /* submitted with the next wait */
+#endif
+
+    /* frames can be larger than one chunk */
+    result = 0;
+    while ((n = plFlushChunk(TX_BUF_SIZE)) > 0)
+        result += n;
+
+    return result;
+}
+
 void UI_GetWinSize(unsigned *w, unsigned *h)
 {
     struct winsize size;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
+
+    /* not a terminal, e.g. output redirected to a file */
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_col == 0 || size.ws_row == 0)
+    {
+        *w = 80;
+        *h = 24;
+        return;
+    }
 
     *w = size.ws_col;
     *h = size.ws_row;
 }
 
+int UI_IsTerminal(void)
+{
+    return isatty(STDOUT_FILENO) ? 1 : 0;
+}
+
 /*  Unicode box drawing chars
     https://en.wikipedia.org/wiki/Box-drawing_character
 */
@@ -385,64 +1408,269 @@ void UI_SetCursor(unsigned x, unsigned y)
     PL_Print(buf);
 }
 
-static int PL_Loop(GCF *gcf)
+/* SIGINT and SIGTERM end the main loop, so that ports, locks and links are cleaned up. */
+static void plSignalHandler(int sig)
 {
-    int ret;
-    int nread;
-    struct pollfd fds;
+    (void)sig;
+    platform.running = 0;
+}
 
-    memset(&platform, 0, sizeof(platform));
-    platform.gcf = gcf;
+/* Returns the time in milliseconds until the next timer expires, bounded by MAX_IDLE_WAIT.
 
-    platform.running = 1;
+   The wait is rounded up, so a timer is never checked before its deadline.
+ */
+static int plWaitTimeout(void)
+{
+    PL_time_t now;
+    PL_time_t next;
 
-    fds.events = POLLIN;
+    /* pending tx data, io_uring writes complete in the wait, paced writes by timer */
+    if (platform.fd && platform.tx_rp != platform.tx_wp && !platform.useUring && !platform.pace.timer)
+        return 0;
 
-    GCF_HandleEvent(gcf, EV_PL_STARTED);
+    if (TIMER_NextExpiry(&platform.timers, &next) == 0)
+        return MAX_IDLE_WAIT;
+
+    now = PL_TimeUs();
+    if (next <= now)
+        return 0;
+
+    if (next - now > MAX_IDLE_WAIT * 1000)
+        return MAX_IDLE_WAIT;
+
+    return (int)((next - now + 999) / 1000);
+}
+
+/* Main loop of --dry-run, instead of waiting the virtual clock jumps to the next event. */
+static void plSimLoop(GCF *gcf)
+{
+    int hangup;
+    unsigned n;
+    PL_time_t next;
+    PL_time_t timer;
 
     while (platform.running)
     {
-        /* when no device is connected, poll STDIN, to get poll() timeout */
-        fds.fd = platform.fd != 0 ? platform.fd : STDIN_FILENO;
+        if (platform.fd && platform.tx_rp != platform.tx_wp && !platform.pace.timer)
+        {
+            PROT_Flush();
+            continue;
+        }
 
-        ret = poll(&fds, 1, 5);
+        n = SIM_Poll(platform.rxbuf, sizeof(platform.rxbuf), &hangup);
+        if (n > 0)
+        {
+            REC_Add(REC_RX, platform.rxbuf, n);
+            GCF_Received(gcf, platform.rxbuf, (int)n);
+            continue;
+        }
 
-        if (ret < 0)
+        if (hangup)
         {
-            PL_Printf(DBG_DEBUG, "poll error: %s\n", strerror(errno));
+            REC_Add(REC_HANGUP, 0, 0);
+            PL_Disconnect();
+            continue;
+        }
+
+        if (TIMER_NextExpiry(&platform.timers, &timer) == 0)
+            timer = 0;
+
+        if (SIM_NextEvent(&next) == 0 || (timer != 0 && timer < next))
+            next = timer;
+
+        if (next == 0)
+        {
+            PL_Printf(DBG_INFO, "dry-run: no more events\n");
+            platform.running = 0;
             break;
         }
 
-        if (ret == 0)
+        SIM_AdvanceTo(next);
+        TIMER_Advance(&platform.timers, PL_TimeUs());
+    }
+}
+
+/* Main loop of --replay, recorded device events are passed in order.
+
+   Timers don't fire on their own, a recorded timeout is only passed if
+   the state machine has set one which expired by then.
+ */
+static void plReplayLoop(GCF *gcf)
+{
+    unsigned n;
+    REC_Type type;
+    PL_time_t deadline;
+
+    while (platform.running)
+    {
+        if (REC_NextEvent(&type, platform.rxbuf, sizeof(platform.rxbuf), &n) == 0)
+        {
+            PL_Printf(DBG_INFO, "replay: end of recording\n");
+            platform.running = 0;
+            break;
+        }
+
+        if (type == REC_RX)
+        {
+            if (platform.fd == 0)
+                REC_Divergence("rx while not connected");
+            else
+                GCF_Received(gcf, platform.rxbuf, (int)n);
+        }
+        else if (type == REC_HANGUP)
         {
-            if (platform.timer != 0)
+            if (platform.fd == 0)
+                REC_Divergence("hangup while not connected");
+            else
+                PL_Disconnect();
+        }
+        else if (type == REC_TIMEOUT)
+        {
+            if (platform.timeout == 0)
             {
-                if (platform.timer < PL_Time())
-                {
-                    platform.timer = 0;
-                    GCF_HandleEvent(gcf, EV_TIMEOUT);
-                }
+                REC_Divergence("timeout while none is set");
             }
+            else
+            {
+                if (TIMER_NextExpiry(&platform.timers, &deadline) && deadline > PL_TimeUs())
+                    REC_Divergence("timeout before its deadline");
 
-            continue;
+                PL_ClearTimeout();
+                GCF_HandleEvent(gcf, EV_TIMEOUT);
+            }
         }
 
-        if (fds.revents & (POLLHUP | POLLERR | POLLNVAL) && platform.fd != 0)
+        if (platform.fd && platform.tx_rp != platform.tx_wp)
+            PROT_Flush();
+    }
+}
+
+static int PL_Loop(GCF *gcf)
+{
+    int i;
+    int n;
+    int fd;
+    int nread;
+    unsigned char *data;
+    PL_time_t wakeup;
+    PL_Ready ready[MAX_CONNECT_PORTS];
+    struct sigaction sa;
+
+    memset(&platform, 0, sizeof(platform));
+    platform.gcf = gcf;
+    TIMER_Init(&platform.timers, PL_TimeUs());
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = plSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+#ifdef PL_USE_EPOLL
+    platform.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (platform.epfd == -1)
+    {
+        PL_Printf(DBG_INFO, "failed to create epoll instance: %s\n", strerror(errno));
+        return 0;
+    }
+#endif
+
+#if defined(PL_USE_IO_URING) && defined(PL_IO_URING_DEFAULT)
+    PL_SetIoBackend("uring"); /* falls back to epoll */
+#endif
+
+    platform.running = 1;
+
+    GCF_HandleEvent(gcf, EV_PL_STARTED);
+
+    if (SIM_Active())
+        plSimLoop(gcf);
+    else if (REC_Replaying())
+        plReplayLoop(gcf);
+
+    while (platform.running)
+    {
+        /* one wait for all ports, the timeout is derived from the timer deadline */
+        n = plWait(plWaitTimeout(), ready, MAX_CONNECT_PORTS);
+
+        if (n < 0)
         {
-            PL_Disconnect();
-            continue;
+            PL_Printf(DBG_DEBUG, "poll error: %s\n", strerror(errno));
+            break;
         }
 
-        if (fds.revents & POLLIN)
+        wakeup = platform.proxyPort ? PL_TimeUs() : 0;
+
+        platform.io.loops++;
+        if (n == 0 && plWaitTimeout() != 0)
+            platform.io.idle++; /* neither data nor a due timer, e.g. MAX_IDLE_WAIT */
+
+        for (i = 0; i < n && platform.running; i++)
         {
-            nread = (int)read(fds.fd, platform.rxbuf, sizeof(platform.rxbuf));
+            fd = ready[i].port == 0 ? platform.fd : platform.monitorFd[ready[i].port];
+
+            if (fd == 0)
+                continue; /* closed by an earlier event */
 
-            if (nread > 0)
+            nread = -1;
+            data = ready[i].data;
+
+            if (ready[i].readable)
             {
-                GCF_Received(gcf, platform.rxbuf, nread);
+                if (data)
+                {
+                    nread = ready[i].nread;
+                }
+                else
+                {
+                    platform.io.reads++;
+                    data = platform.rxbuf;
+                    nread = (int)read(fd, data, sizeof(platform.rxbuf));
+                }
+
+                if (nread > 0)
+                {
+                    platform.io.rxBytes += (unsigned)nread;
+
+                    if (ready[i].port == 0)
+                        REC_Add(REC_RX, data, (unsigned)nread);
+
+                    if (ready[i].port != 0 && ready[i].port == platform.loopbackPort)
+                    {
+                        if (plWriteAll(fd, data, (unsigned)nread) != 0)
+                            PL_Printf(DBG_DEBUG, "loopback echo failed: %s\n", strerror(errno));
+                        continue;
+                    }
+
+                    /* forward first, decoding for the log comes after */
+                    if (platform.proxyPort != 0 && (ready[i].port == 0 || ready[i].port == platform.proxyPort))
+                        plProxyForward(ready[i].port, data, (unsigned)nread, wakeup);
+
+                    if (ready[i].port == 0)
+                        GCF_Received(gcf, data, nread);
+                    else
+                        GCF_ReceivedPort(gcf, ready[i].port, data, nread);
+                    continue;
+                }
+            }
+
+            if (ready[i].hangup || (ready[i].readable && nread == 0))
+            {
+                if (ready[i].port == 0)
+                {
+                    REC_Add(REC_HANGUP, 0, 0);
+                    PL_Disconnect();
+                }
+                else
+                {
+                    PL_Printf(DBG_INFO, "[%u] disconnected\n", ready[i].port);
+                    plCloseMonitor(ready[i].port);
+                }
             }
         }
 
+        TIMER_Advance(&platform.timers, PL_TimeUs());
+
         if (platform.fd && platform.tx_rp != platform.tx_wp)
         {
             PROT_Flush();
@@ -450,6 +1678,14 @@ static int PL_Loop(GCF *gcf)
     }
 
     PL_Disconnect();
+    plReleasePort();
+
+#ifdef PL_USE_IO_URING
+    plUringExit();
+#endif
+#ifdef PL_USE_EPOLL
+    close(platform.epfd);
+#endif
 
     return 1;
 }
@@ -463,7 +1699,5 @@ int main(int argc, char *argv[])
 
     PL_Loop(gcf);
 
-    GCF_Exit(gcf);
-
-    return 0;
+    return GCF_Exit(gcf);
 }
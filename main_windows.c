@@ -30,6 +30,7 @@
 #include <string.h>
 
 #include "gcf.h"
+#include "timer.h"
 #include "u_sstream.h"
 #include "u_strlen.h"
 
@@ -41,11 +42,12 @@
 
 typedef struct
 {
-    PL_time_t timer;
+    TIMER_Wheel timers;
+    unsigned long timeout; /* timer handle of PL_SetTimeout() */
     HANDLE fd;
     uint8_t running;
     uint8_t rxbuf[64];
-    uint8_t txbuf[2048];
+    uint8_t txbuf[4096]; /* one V3 data response with worst case escaping */
     size_t txpos;
 
     LARGE_INTEGER frequency;
@@ -72,6 +74,21 @@ PL_time_t PL_Time()
     return GetTickCount();
 }
 
+/*! Returns a monotonic time in microseconds. */
+PL_time_t PL_TimeUs(void)
+{
+    if (platform.frequencyValid)
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        /* split to avoid overflow of now * 10^6 */
+        return (now.QuadPart / platform.frequency.QuadPart) * 1000000LL +
+               ((now.QuadPart % platform.frequency.QuadPart) * 1000000LL) / platform.frequency.QuadPart;
+    }
+
+    return (PL_time_t)GetTickCount() * 1000;
+}
+
 /*! Lets the programm sleep for \p ms milliseconds. */
 void PL_MSleep(unsigned long ms)
 {
@@ -79,16 +96,36 @@ void PL_MSleep(unsigned long ms)
 }
 
 
+static void plTimeoutFired(void *arg)
+{
+    (void)arg;
+    platform.timeout = 0;
+    GCF_HandleEvent(platform.gcf, EV_TIMEOUT);
+}
+
 /*! Sets a timeout \p ms in milliseconds, after which a \c EV_TIMOUT event is generated. */
 void PL_SetTimeout(unsigned long ms)
 {
-    platform.timer = PL_Time() + ms;
+    PL_StopTimer(platform.timeout);
+    platform.timeout = PL_StartTimer((PL_time_t)ms * 1000, plTimeoutFired, NULL);
 }
 
 /*! Clears an active timeout. */
 void PL_ClearTimeout(void)
 {
-    platform.timer = 0;
+    PL_StopTimer(platform.timeout);
+    platform.timeout = 0;
+}
+
+unsigned long PL_StartTimer(PL_time_t us, PL_TimerFunc fn, void *arg)
+{
+    return TIMER_Start(&platform.timers, PL_TimeUs() + us, fn, arg);
+}
+
+void PL_StopTimer(unsigned long handle)
+{
+    if (handle != 0)
+        TIMER_Stop(&platform.timers, handle);
 }
 
 /* Fills up to \p max devices in the \p devs array.
@@ -281,6 +318,9 @@ static int GetComPort(const char *enumerator, Device *devs, size_t max)
             continue;
         }
 
+        dev->vendorId = (unsigned short)vid;
+        dev->productId = (unsigned short)pid;
+
         /*** check device name (only ConBee II and ConBee III) ********************/
         /* for ConBee III this happens when enumerator == "USB" */
         PropertyKey = DEVPKEY_Device_BusReportedDeviceDesc;
@@ -499,6 +539,43 @@ Exit1:
     return GCF_FAILED;
 }
 
+int PL_SetBaudrate(PL_Baudrate baudrate)
+{
+    DCB dcb;
+
+    if (platform.fd == INVALID_HANDLE_VALUE)
+        return -1;
+
+    ZeroMemory(&dcb, sizeof(dcb));
+    dcb.DCBlength = sizeof(dcb);
+    if (GetCommState(platform.fd, &dcb) == FALSE)
+        return -1;
+
+    dcb.BaudRate = baudrate == PL_BAUDRATE_38400 ? CBR_38400 : CBR_115200;
+    if (SetCommState(platform.fd, &dcb) == FALSE)
+        return -1;
+
+    PurgeComm(platform.fd, PURGE_RXCLEAR); /* garbage received at the old rate */
+    PL_Printf(DBG_DEBUG, "baudrate: %d\n", (int)baudrate);
+
+    return 0;
+}
+
+/*! Monitor ports in connect mode aren't supported on Windows yet. */
+int PL_ConnectMonitor(const char *path, PL_Baudrate baudrate)
+{
+    (void)path;
+    (void)baudrate;
+    return -1;
+}
+
+/*! The pty proxy is POSIX only. */
+int PL_ConnectProxy(const char *link)
+{
+    (void)link;
+    return -1;
+}
+
 /*! Closed the serial port connection. */
 void PL_Disconnect()
 {
@@ -612,6 +689,73 @@ err_close:
     return -1;
 }
 
+int PL_UsbPowerOn(const char *path)
+{
+    (void)path;
+    return -1;
+}
+
+void PL_UsbPowerRestore(void)
+{
+}
+
+int PL_ClaimPort(const char *path, unsigned long waitMs, int handoff)
+{
+    /* COM ports are opened without sharing, a busy port fails in PL_Connect() */
+    (void)path;
+    (void)waitMs;
+    (void)handoff;
+    return 0;
+}
+
+int PL_SetIoBackend(const char *name)
+{
+    (void)name;
+    return -1;
+}
+
+int PL_SetTxPacing(unsigned long rate, unsigned burst, unsigned packet)
+{
+    (void)burst;
+    (void)packet;
+    return rate == 0 ? 0 : -1;
+}
+
+void PL_GetIoStats(PL_IoStats *stats)
+{
+    ZeroMemory(stats, sizeof(*stats));
+    stats->backend = "win32";
+}
+
+GCF_Status PL_ConnectLoopback(PL_Baudrate baudrate)
+{
+    (void)baudrate;
+    return GCF_FAILED; /* no pty */
+}
+
+void PL_GetUartStats(PL_UartStats *stats)
+{
+    ZeroMemory(stats, sizeof(*stats)); /* not supported */
+}
+
+int PL_GetUsage(PL_Usage *usage)
+{
+    FILETIME creation;
+    FILETIME exit;
+    FILETIME kernel;
+    FILETIME user;
+
+    ZeroMemory(usage, sizeof(*usage));
+
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return -1;
+
+    /* 100 ns units, context switches and RSS aren't reported */
+    usage->userUs = (((unsigned long long)user.dwHighDateTime << 32) | user.dwLowDateTime) / 10;
+    usage->systemUs = (((unsigned long long)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) / 10;
+    return 0;
+}
+
 /*! Executes a MCU reset for RaspBee I / II via GPIO17 reset pin. */
 int PL_ResetRaspBee()
 {
@@ -651,6 +795,68 @@ int PL_ReadFile(const char *path, unsigned char *buf, unsigned long buflen)
 }
 
 
+#define PL_MAX_FILES 2
+
+static HANDLE plFiles[PL_MAX_FILES];
+
+int PL_OpenFile(const char *path, unsigned long *size)
+{
+    int i;
+    HANDLE hFile;
+    LARGE_INTEGER fsize;
+
+    for (i = 0; i < PL_MAX_FILES; i++)
+    {
+        if (plFiles[i] == NULL)
+            break;
+    }
+
+    if (i == PL_MAX_FILES)
+        return -1;
+
+    hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+        return -1;
+
+    if (!GetFileSizeEx(hFile, &fsize))
+    {
+        CloseHandle(hFile);
+        return -1;
+    }
+
+    plFiles[i] = hFile;
+    *size = (unsigned long)fsize.QuadPart;
+    return i;
+}
+
+long PL_ReadFileAt(int file, unsigned long offset, unsigned char *buf, unsigned long len)
+{
+    DWORD nread = 0;
+    OVERLAPPED ov;
+
+    if (file < 0 || file >= PL_MAX_FILES || plFiles[file] == NULL)
+        return -1;
+
+    ZeroMemory(&ov, sizeof(ov));
+    ov.Offset = (DWORD)offset;
+
+    if (!ReadFile(plFiles[file], buf, (DWORD)len, &nread, &ov))
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+
+    return (long)nread;
+}
+
+void PL_CloseFile(int file)
+{
+    if (file >= 0 && file < PL_MAX_FILES && plFiles[file] != NULL)
+    {
+        CloseHandle(plFiles[file]);
+        plFiles[file] = NULL;
+    }
+}
+
 void PL_Print(const char *line)
 {
     printf("%s", line);
@@ -679,6 +885,11 @@ void UI_GetWinSize(unsigned *w, unsigned *h)
     *h = 60;
 }
 
+int UI_IsTerminal(void)
+{
+    return 0; /* no escape sequences (PL_NO_ESCASCII), progress as plain lines */
+}
+
 void UI_SetCursor(unsigned x, unsigned y)
 {
     (void)x;
@@ -755,6 +966,7 @@ static void PL_Loop(GCF *gcf)
 
     platform.running = 1;
     platform.frequencyValid = QueryPerformanceFrequency(&platform.frequency);
+    TIMER_Init(&platform.timers, PL_TimeUs());
 
     GCF_HandleEvent(gcf, EV_PL_STARTED);
 
@@ -764,16 +976,7 @@ static void PL_Loop(GCF *gcf)
         if (platform.fd == INVALID_HANDLE_VALUE)
         {
             Sleep(20);
-
-            if (platform.timer != 0)
-            {
-                if (platform.timer < PL_Time())
-                {
-                    platform.timer = 0;
-                    GCF_HandleEvent(gcf, EV_TIMEOUT);
-                }
-            }
-
+            TIMER_Advance(&platform.timers, PL_TimeUs());
             continue;
         }
 
@@ -791,19 +994,13 @@ static void PL_Loop(GCF *gcf)
         }
         else if (NoBytesRead == 0)
         {
-            if (platform.timer != 0)
-            {
-                if (platform.timer < PL_Time())
-                {
-                    platform.timer = 0;
-                    GCF_HandleEvent(gcf, EV_TIMEOUT);
-                }
-            }
-            else
-            {
+            PL_time_t next;
+
+            if (TIMER_NextExpiry(&platform.timers, &next) == 0)
                 Sleep(4);
-            }
         }
+
+        TIMER_Advance(&platform.timers, PL_TimeUs());
     }
 }
 
@@ -815,7 +1012,5 @@ int main(int argc, char **argv)
 
     PL_Loop(gcf);
 
-    GCF_Exit(gcf);
-
-    return 0;
+    return GCF_Exit(gcf);
 }
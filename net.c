@@ -1,5 +1,902 @@
-//
-// Created by mpi on 27.11.23.
-//
+/*
+ * Copyright (c) 2023-2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
 
+/* This file implements fetching firmware files by HTTP into a local
+   content-addressed cache.
+
+   <cache>/objects/<sha256>.gcf   file content, named by its SHA-256
+   <cache>/urls/<sha256 of url>   cache entry: object, etag, last-modified, expiry
+ */
+
+#ifndef APP_VERSION /* provided by CMakeLists.txt */
+#define APP_VERSION "v0.0.0-beta"
+#endif
+
+#include "gcf.h"
 #include "net.h"
+
+#ifdef _WIN32
+
+int NET_CacheDir(char *path, unsigned pathlen)
+{
+    (void)path;
+    (void)pathlen;
+    return -1;
+}
+
+int NET_CacheGet(const char *name, const char *key, char *value, unsigned valuelen)
+{
+    (void)name;
+    (void)key;
+    (void)value;
+    (void)valuelen;
+    return -1;
+}
+
+int NET_CacheSet(const char *name, const char *key, const char *value)
+{
+    (void)name;
+    (void)key;
+    (void)value;
+    return -1;
+}
+
+int NET_FetchCached(const char *url, char *path, unsigned pathlen)
+{
+    (void)url;
+    (void)path;
+    (void)pathlen;
+    PL_Printf(DBG_INFO, "firmware URLs aren't supported on this platform\n");
+    return -1;
+}
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+
+#include "u_sha256.h"
+#include "u_sstream.h"
+#include "u_strlen.h"
+#include "u_mem.h"
+
+#define NET_TIMEOUT 10 /* seconds for connect, send and receive */
+#define NET_MAX_HEADER 8192
+#define NET_MAX_FRESHNESS (24 * 3600) /* cap for heuristic freshness */
+#define NET_HEX_SIZE (U_SHA256_DIGEST_SIZE * 2 + 1)
+
+typedef struct
+{
+    char object[NET_HEX_SIZE]; /* SHA-256 of the content */
+    char etag[128];
+    char modified[64]; /* Last-Modified as sent by the server */
+    long long expires; /* unix time until the entry is fresh */
+} NET_CacheEntry;
+
+typedef struct
+{
+    int fd;
+    unsigned pos;
+    unsigned len;
+    unsigned char buf[4096];
+} NET_Conn;
+
+typedef struct
+{
+    int status;
+    int chunked;
+    long long contentLength; /* -1 if unknown */
+    long long maxAge;        /* -1 if not specified */
+    int noCache;
+    char etag[128];
+    char modified[64];
+} NET_Response;
+
+static int netLower(int ch)
+{
+    return (ch >= 'A' && ch <= 'Z') ? ch - 'A' + 'a' : ch;
+}
+
+/* Case insensitive check if \p str starts with \p prefix. */
+static int netStartsWith(const char *str, const char *prefix)
+{
+    for (; *prefix; str++, prefix++)
+    {
+        if (netLower(*str) != netLower(*prefix))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int netMkdir(const char *path)
+{
+    if (mkdir(path, 0755) == 0 || errno == EEXIST)
+        return 0;
+
+    PL_Printf(DBG_DEBUG, "failed to create %s: %s\n", path, strerror(errno));
+    return -1;
+}
+
+int NET_CacheDir(char *path, unsigned pathlen)
+{
+    U_SStream ss;
+    const char *env;
+    char sub[MAX_DEV_PATH_LENGTH];
+
+    U_sstream_init(&ss, path, pathlen);
+
+    if ((env = getenv("GCF_CACHE_DIR")) != NULL && env[0])
+    {
+        U_sstream_put_str(&ss, env);
+    }
+    else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0])
+    {
+        U_sstream_put_str(&ss, env);
+        if (netMkdir(path) != 0)
+            return -1;
+        U_sstream_put_str(&ss, "/gcfflasher");
+    }
+    else if ((env = getenv("HOME")) != NULL && env[0])
+    {
+        U_sstream_put_str(&ss, env);
+        U_sstream_put_str(&ss, "/.cache");
+        if (netMkdir(path) != 0)
+            return -1;
+        U_sstream_put_str(&ss, "/gcfflasher");
+    }
+    else
+    {
+        U_sstream_put_str(&ss, "/tmp/gcfflasher");
+    }
+
+    if (ss.status != U_SSTREAM_OK || netMkdir(path) != 0)
+        return -1;
+
+    U_sstream_init(&ss, sub, sizeof(sub));
+    U_sstream_put_str(&ss, path);
+    U_sstream_put_str(&ss, "/objects");
+    if (ss.status != U_SSTREAM_OK || netMkdir(sub) != 0)
+        return -1;
+
+    U_sstream_init(&ss, sub, sizeof(sub));
+    U_sstream_put_str(&ss, path);
+    U_sstream_put_str(&ss, "/urls");
+    if (ss.status != U_SSTREAM_OK || netMkdir(sub) != 0)
+        return -1;
+
+    return 0;
+}
+
+/* Parses an IMF-fixdate like "Sun, 06 Nov 1994 08:49:37 GMT" to unix time, 0 on error. */
+static long long netParseHttpDate(const char *str)
+{
+    int i;
+    long day;
+    long month;
+    long year;
+    long h, m, s;
+    long long days;
+    U_SStream ss;
+    static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    U_sstream_init(&ss, (void*)str, U_strlen(str));
+    if (!U_sstream_find(&ss, ", "))
+        return 0;
+
+    ss.pos += 2;
+    day = U_sstream_get_long(&ss);
+    U_sstream_skip_whitespace(&ss);
+
+    month = 0;
+    for (i = 0; i < 12; i++)
+    {
+        if (ss.len - ss.pos >= 3 && U_sstream_str(&ss)[0] == months[i * 3] &&
+            U_sstream_str(&ss)[1] == months[i * 3 + 1] && U_sstream_str(&ss)[2] == months[i * 3 + 2])
+        {
+            month = i + 1;
+            ss.pos += 3;
+            break;
+        }
+    }
+
+    year = U_sstream_get_long(&ss);
+    h = U_sstream_get_long(&ss);
+    ss.pos += U_sstream_peek_char(&ss) == ':' ? 1 : 0;
+    m = U_sstream_get_long(&ss);
+    ss.pos += U_sstream_peek_char(&ss) == ':' ? 1 : 0;
+    s = U_sstream_get_long(&ss);
+
+    if (ss.status != U_SSTREAM_OK || month == 0 || day < 1 || day > 31 || year < 1970)
+        return 0;
+
+    /* days from civil, http://howardhinnant.github.io/date_algorithms.html */
+    year -= month <= 2 ? 1 : 0;
+    {
+        long era = year / 400;
+        long yoe = year - era * 400;
+        long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        days = (long long)era * 146097 + doe - 719468;
+    }
+
+    return days * 86400 + h * 3600 + m * 60 + s;
+}
+
+static void netEntryPath(const char *dir, const char *url, char *path, unsigned pathlen)
+{
+    U_Sha256 sha;
+    U_SStream ss;
+    unsigned char digest[U_SHA256_DIGEST_SIZE];
+    char hex[NET_HEX_SIZE];
+
+    U_sha256_init(&sha);
+    U_sha256_update(&sha, url, U_strlen(url));
+    U_sha256_final(&sha, digest);
+    U_sha256_hex(digest, hex);
+
+    U_sstream_init(&ss, path, pathlen);
+    U_sstream_put_str(&ss, dir);
+    U_sstream_put_str(&ss, "/urls/");
+    U_sstream_put_str(&ss, hex);
+}
+
+static void netObjectPath(const char *dir, const char *hex, char *path, unsigned pathlen)
+{
+    U_SStream ss;
+
+    U_sstream_init(&ss, path, pathlen);
+    U_sstream_put_str(&ss, dir);
+    U_sstream_put_str(&ss, "/objects/");
+    U_sstream_put_str(&ss, hex);
+    U_sstream_put_str(&ss, ".gcf");
+}
+
+/* Copies the remainder of a "key value\n" line. */
+static void netCopyValue(const char *src, char *dst, unsigned dstlen)
+{
+    unsigned i;
+
+    for (i = 0; src[i] && src[i] != '\r' && src[i] != '\n' && i + 1 < dstlen; i++)
+        dst[i] = src[i];
+
+    dst[i] = '\0';
+}
+
+static int netReadEntry(const char *path, NET_CacheEntry *entry)
+{
+    FILE *f;
+    U_SStream ss;
+    char line[256];
+
+    U_bzero(entry, sizeof(*entry));
+
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if      (netStartsWith(line, "object "))   { netCopyValue(&line[7], entry->object, sizeof(entry->object)); }
+        else if (netStartsWith(line, "etag "))     { netCopyValue(&line[5], entry->etag, sizeof(entry->etag)); }
+        else if (netStartsWith(line, "modified ")) { netCopyValue(&line[9], entry->modified, sizeof(entry->modified)); }
+        else if (netStartsWith(line, "expires "))
+        {
+            U_sstream_init(&ss, &line[8], U_strlen(&line[8]));
+            entry->expires = U_sstream_get_long(&ss);
+        }
+    }
+
+    fclose(f);
+
+    return U_strlen(entry->object) == NET_HEX_SIZE - 1 ? 0 : -1;
+}
+
+static int netWriteEntry(const char *path, const NET_CacheEntry *entry)
+{
+    FILE *f;
+    char tmp[MAX_DEV_PATH_LENGTH + 16];
+
+    snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+
+    f = fopen(tmp, "w");
+    if (!f)
+        return -1;
+
+    fprintf(f, "object %s\n", entry->object);
+    if (entry->etag[0])
+        fprintf(f, "etag %s\n", entry->etag);
+    if (entry->modified[0])
+        fprintf(f, "modified %s\n", entry->modified);
+    fprintf(f, "expires %lld\n", entry->expires);
+
+    if (fclose(f) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* \returns The length of the key if \p line is "<key> <value>", else 0. */
+static unsigned netKeyMatch(const char *line, const char *key)
+{
+    unsigned i;
+
+    for (i = 0; key[i]; i++)
+    {
+        if (line[i] != key[i])
+            return 0;
+    }
+
+    return line[i] == ' ' ? i : 0;
+}
+
+static int netCachePath(const char *name, char *path, unsigned pathlen)
+{
+    U_SStream ss;
+    char dir[MAX_DEV_PATH_LENGTH];
+
+    if (NET_CacheDir(dir, sizeof(dir)) != 0)
+        return -1;
+
+    U_sstream_init(&ss, path, pathlen);
+    U_sstream_put_str(&ss, dir);
+    U_sstream_put_str(&ss, "/");
+    U_sstream_put_str(&ss, name);
+
+    return ss.status == U_SSTREAM_OK ? 0 : -1;
+}
+
+int NET_CacheGet(const char *name, const char *key, char *value, unsigned valuelen)
+{
+    FILE *f;
+    unsigned n;
+    int ret;
+    char path[MAX_DEV_PATH_LENGTH];
+    char line[256];
+
+    if (key[0] == '\0' || netCachePath(name, path, sizeof(path)) != 0)
+        return -1;
+
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    ret = -1;
+    while (fgets(line, sizeof(line), f))
+    {
+        n = netKeyMatch(line, key);
+        if (n > 0)
+        {
+            netCopyValue(&line[n + 1], value, valuelen);
+            ret = 0;
+            break;
+        }
+    }
+
+    fclose(f);
+    return ret;
+}
+
+int NET_CacheSet(const char *name, const char *key, const char *value)
+{
+    FILE *in;
+    FILE *out;
+    char path[MAX_DEV_PATH_LENGTH];
+    char tmp[MAX_DEV_PATH_LENGTH + 16];
+    char line[256];
+
+    if (key[0] == '\0' || U_strlen(key) + U_strlen(value) + 2 >= sizeof(line) ||
+        netCachePath(name, path, sizeof(path)) != 0)
+        return -1;
+
+    snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+
+    out = fopen(tmp, "w");
+    if (!out)
+        return -1;
+
+    /* other keys are copied, the file is replaced atomically */
+    in = fopen(path, "r");
+    if (in)
+    {
+        while (fgets(line, sizeof(line), in))
+        {
+            if (netKeyMatch(line, key) == 0 && line[0] != '\n')
+                fputs(line, out);
+        }
+        fclose(in);
+    }
+
+    if (value[0])
+        fprintf(out, "%s %s\n", key, value);
+
+    if (fclose(out) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int netConnect(const char *host, const char *port)
+{
+    int fd;
+    int ret;
+    struct timeval tv;
+    struct addrinfo hints;
+    struct addrinfo *res;
+    struct addrinfo *ai;
+
+    U_bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    ret = getaddrinfo(host, port, &hints, &res);
+    if (ret != 0)
+    {
+        PL_Printf(DBG_INFO, "failed to resolve %s: %s\n", host, gai_strerror(ret));
+        return -1;
+    }
+
+    fd = -1;
+    tv.tv_sec = NET_TIMEOUT;
+    tv.tv_usec = 0;
+
+    for (ai = res; ai; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd == -1)
+            continue;
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+
+    if (fd == -1)
+        PL_Printf(DBG_INFO, "failed to connect %s:%s\n", host, port);
+
+    return fd;
+}
+
+static int netFill(NET_Conn *conn)
+{
+    ssize_t n;
+
+    do
+    {
+        n = recv(conn->fd, conn->buf, sizeof(conn->buf), 0);
+    } while (n == -1 && errno == EINTR);
+
+    if (n <= 0)
+        return -1;
+
+    conn->pos = 0;
+    conn->len = (unsigned)n;
+    return 0;
+}
+
+/* Reads a CRLF terminated line (chunk size lines), returns length or -1. */
+static int netReadLine(NET_Conn *conn, char *line, unsigned max)
+{
+    unsigned i;
+    char ch;
+
+    for (i = 0; ;)
+    {
+        if (conn->pos == conn->len && netFill(conn) != 0)
+            return -1;
+
+        ch = (char)conn->buf[conn->pos++];
+        if (ch == '\n')
+            break;
+
+        if (ch != '\r' && i + 1 < max)
+            line[i++] = ch;
+    }
+
+    line[i] = '\0';
+    return (int)i;
+}
+
+/* Reads the response header and leaves body bytes in conn->buf. */
+static int netReadHeader(NET_Conn *conn, NET_Response *rsp)
+{
+    unsigned i;
+    unsigned len;
+    U_SStream ss;
+    char *line;
+    char *end;
+    static char hdr[NET_MAX_HEADER];
+
+    len = 0;
+    end = NULL;
+    while (!end)
+    {
+        if (netFill(conn) != 0)
+            return -1;
+
+        for (i = 0; i < conn->len; i++)
+        {
+            if (len + 1 >= sizeof(hdr))
+                return -1;
+
+            hdr[len++] = (char)conn->buf[i];
+            if (len >= 4 && hdr[len - 4] == '\r' && hdr[len - 3] == '\n' && hdr[len - 2] == '\r' && hdr[len - 1] == '\n')
+            {
+                end = &hdr[len];
+                conn->pos = i + 1;
+                break;
+            }
+        }
+    }
+
+    *end = '\0';
+
+    U_bzero(rsp, sizeof(*rsp));
+    rsp->contentLength = -1;
+    rsp->maxAge = -1;
+
+    /* HTTP/1.1 200 OK */
+    if (!netStartsWith(hdr, "HTTP/1.") || len < 12)
+        return -1;
+
+    U_sstream_init(&ss, &hdr[9], 3);
+    rsp->status = (int)U_sstream_get_long(&ss);
+
+    for (line = hdr; line < end;)
+    {
+        for (i = 0; line[i] && line[i] != '\n'; i++)
+        {}
+
+        if      (netStartsWith(line, "content-length:"))              { U_sstream_init(&ss, &line[15], i - 15); rsp->contentLength = U_sstream_get_long(&ss); }
+        else if (netStartsWith(line, "transfer-encoding: chunked"))   { rsp->chunked = 1; }
+        else if (netStartsWith(line, "etag: "))                       { netCopyValue(&line[6], rsp->etag, sizeof(rsp->etag)); }
+        else if (netStartsWith(line, "last-modified: "))              { netCopyValue(&line[15], rsp->modified, sizeof(rsp->modified)); }
+        else if (netStartsWith(line, "cache-control:"))
+        {
+            U_sstream_init(&ss, &line[14], i - 14);
+            if (U_sstream_find(&ss, "max-age="))
+            {
+                ss.pos += 8;
+                rsp->maxAge = U_sstream_get_long(&ss);
+            }
+
+            U_sstream_init(&ss, &line[14], i - 14);
+            if (U_sstream_find(&ss, "no-cache"))
+                rsp->noCache = 1;
+
+            U_sstream_init(&ss, &line[14], i - 14);
+            if (U_sstream_find(&ss, "no-store"))
+                rsp->noCache = 1;
+        }
+
+        line += i + 1;
+    }
+
+    return 0;
+}
+
+/* Streams the response body into \p fd while hashing it, returns the size or -1. */
+static long netReadBody(NET_Conn *conn, const NET_Response *rsp, int fd, U_Sha256 *sha)
+{
+    long total;
+    unsigned n;
+    long long chunk;
+    char line[64];
+
+    total = 0;
+    chunk = rsp->chunked ? 0 : rsp->contentLength;
+
+    for (;;)
+    {
+        if (rsp->chunked && chunk == 0)
+        {
+            if (total > 0 && netReadLine(conn, line, sizeof(line)) < 0) /* CRLF after chunk data */
+                return -1;
+
+            if (netReadLine(conn, line, sizeof(line)) < 0)
+                return -1;
+
+            chunk = 0;
+            for (n = 0; line[n]; n++)
+            {
+                int ch = netLower(line[n]);
+                if      (ch >= '0' && ch <= '9') chunk = chunk * 16 + (ch - '0');
+                else if (ch >= 'a' && ch <= 'f') chunk = chunk * 16 + (ch - 'a' + 10);
+                else break;
+            }
+
+            if (chunk == 0)
+                break; /* last chunk, trailers are ignored */
+        }
+        else if (chunk == 0)
+        {
+            break; /* Content-Length reached */
+        }
+
+        if (conn->pos == conn->len && netFill(conn) != 0)
+        {
+            if (rsp->chunked || rsp->contentLength >= 0)
+                return -1; /* truncated */
+            break; /* body delimited by connection close */
+        }
+
+        n = conn->len - conn->pos;
+        if (chunk > 0 && (long long)n > chunk)
+            n = (unsigned)chunk;
+
+        if (total + (long)n > MAX_GCF_FILE_SIZE)
+        {
+            PL_Printf(DBG_INFO, "file too large\n");
+            return -1;
+        }
+
+        if (write(fd, &conn->buf[conn->pos], n) != (ssize_t)n)
+            return -1;
+
+        U_sha256_update(sha, &conn->buf[conn->pos], n);
+        conn->pos += n;
+        total += (long)n;
+        if (chunk > 0)
+            chunk -= n;
+    }
+
+    return total;
+}
+
+static long long netFreshUntil(const NET_Response *rsp, long long now)
+{
+    long long modified;
+
+    if (rsp->noCache)
+        return now;
+
+    if (rsp->maxAge >= 0)
+        return now + rsp->maxAge;
+
+    /* heuristic freshness of 10% since last modification (RFC 9111, 4.2.2) */
+    modified = netParseHttpDate(rsp->modified);
+    if (modified > 0 && modified < now)
+    {
+        if ((now - modified) / 10 > NET_MAX_FRESHNESS)
+            return now + NET_MAX_FRESHNESS;
+        return now + (now - modified) / 10;
+    }
+
+    return now;
+}
+
+int NET_FetchCached(const char *url, char *path, unsigned pathlen)
+{
+    int fd;
+    int ret;
+    int haveEntry;
+    long size;
+    long long now;
+    unsigned i;
+    const char *p;
+    const char *urlpath;
+    U_SStream ss;
+    U_Sha256 sha;
+    NET_Conn *conn;
+    NET_Response rsp;
+    NET_CacheEntry entry;
+    struct stat st;
+    unsigned char digest[U_SHA256_DIGEST_SIZE];
+    char host[128];
+    char port[8];
+    char dir[MAX_DEV_PATH_LENGTH];
+    char entryPath[MAX_DEV_PATH_LENGTH];
+    char tmp[MAX_DEV_PATH_LENGTH];
+    char req[1024];
+    static NET_Conn connLocal;
+
+    if (!netStartsWith(url, "http://"))
+    {
+        PL_Printf(DBG_INFO, "unsupported URL %s, only http:// is supported\n", url);
+        return -1;
+    }
+
+    if (NET_CacheDir(dir, sizeof(dir)) != 0)
+    {
+        PL_Printf(DBG_INFO, "no usable cache directory\n");
+        return -1;
+    }
+
+    now = (long long)time(NULL);
+    netEntryPath(dir, url, entryPath, sizeof(entryPath));
+    haveEntry = netReadEntry(entryPath, &entry) == 0;
+
+    if (haveEntry)
+    {
+        netObjectPath(dir, entry.object, path, pathlen);
+        if (stat(path, &st) != 0)
+        {
+            haveEntry = 0; /* object was removed */
+        }
+        else if (entry.expires > now)
+        {
+            PL_Printf(DBG_DEBUG, "cache hit %s\n", path);
+            return 0;
+        }
+    }
+
+    /* split http://host[:port]/path */
+    p = url + 7;
+    for (i = 0; *p && *p != ':' && *p != '/' && i + 1 < sizeof(host); i++, p++)
+        host[i] = *p;
+    host[i] = '\0';
+
+    port[0] = '8';
+    port[1] = '0';
+    port[2] = '\0';
+    if (*p == ':')
+    {
+        for (i = 0, p++; *p >= '0' && *p <= '9' && i + 1 < sizeof(port); i++, p++)
+            port[i] = *p;
+        port[i] = '\0';
+    }
+
+    urlpath = *p == '/' ? p : "/";
+    if (host[0] == '\0' || (*p != '/' && *p != '\0'))
+    {
+        PL_Printf(DBG_INFO, "invalid URL %s\n", url);
+        return -1;
+    }
+
+    U_sstream_init(&ss, req, sizeof(req));
+    U_sstream_put_str(&ss, "GET ");
+    U_sstream_put_str(&ss, urlpath);
+    U_sstream_put_str(&ss, " HTTP/1.1\r\nHost: ");
+    U_sstream_put_str(&ss, host);
+    if (port[0] != '8' || port[1] != '0' || port[2] != '\0')
+    {
+        U_sstream_put_str(&ss, ":");
+        U_sstream_put_str(&ss, port);
+    }
+    U_sstream_put_str(&ss, "\r\nUser-Agent: GCFFlasher/" APP_VERSION "\r\nConnection: close\r\n");
+    if (haveEntry && entry.etag[0])
+    {
+        U_sstream_put_str(&ss, "If-None-Match: ");
+        U_sstream_put_str(&ss, entry.etag);
+        U_sstream_put_str(&ss, "\r\n");
+    }
+    if (haveEntry && entry.modified[0])
+    {
+        U_sstream_put_str(&ss, "If-Modified-Since: ");
+        U_sstream_put_str(&ss, entry.modified);
+        U_sstream_put_str(&ss, "\r\n");
+    }
+    U_sstream_put_str(&ss, "\r\n");
+
+    if (ss.status != U_SSTREAM_OK)
+    {
+        PL_Printf(DBG_INFO, "URL too long\n");
+        return -1;
+    }
+
+    conn = &connLocal;
+    conn->pos = 0;
+    conn->len = 0;
+    conn->fd = netConnect(host, port);
+    if (conn->fd == -1)
+        return -1;
+
+    ret = -1;
+    fd = -1;
+    tmp[0] = '\0';
+
+    if (send(conn->fd, req, ss.pos, 0) != (ssize_t)ss.pos)
+    {
+        PL_Printf(DBG_INFO, "failed to send request: %s\n", strerror(errno));
+        goto out;
+    }
+
+    if (netReadHeader(conn, &rsp) != 0)
+    {
+        PL_Printf(DBG_INFO, "invalid HTTP response from %s\n", host);
+        goto out;
+    }
+
+    if (rsp.status == 304 && haveEntry)
+    {
+        PL_Printf(DBG_DEBUG, "cache revalidated %s\n", path);
+        if (rsp.etag[0])
+            netCopyValue(rsp.etag, entry.etag, sizeof(entry.etag));
+        entry.expires = netFreshUntil(&rsp, now);
+        netWriteEntry(entryPath, &entry);
+        ret = 0;
+        goto out;
+    }
+
+    if (rsp.status != 200)
+    {
+        PL_Printf(DBG_INFO, "HTTP status %d for %s\n", rsp.status, url);
+        goto out;
+    }
+
+    i = (unsigned)snprintf(tmp, sizeof(tmp), "%s/objects/.download.%ld", dir, (long)getpid());
+    if (i >= sizeof(tmp))
+    {
+        tmp[0] = '\0';
+        PL_Printf(DBG_INFO, "cache directory path too long: %s\n", dir);
+        goto out;
+    }
+
+    fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        PL_Printf(DBG_INFO, "failed to create %s: %s\n", tmp, strerror(errno));
+        goto out;
+    }
+
+    U_sha256_init(&sha);
+    size = netReadBody(conn, &rsp, fd, &sha);
+    if (close(fd) != 0 || size <= 0)
+    {
+        fd = -1;
+        PL_Printf(DBG_INFO, "failed to download %s\n", url);
+        goto out;
+    }
+    fd = -1;
+
+    U_sha256_final(&sha, digest);
+    U_bzero(&entry, sizeof(entry));
+    U_sha256_hex(digest, entry.object);
+    netObjectPath(dir, entry.object, path, pathlen);
+
+    /* identical content of another URL is already there */
+    if (stat(path, &st) == 0)
+        unlink(tmp);
+    else if (rename(tmp, path) != 0)
+        goto out;
+
+    tmp[0] = '\0';
+    netCopyValue(rsp.etag, entry.etag, sizeof(entry.etag));
+    netCopyValue(rsp.modified, entry.modified, sizeof(entry.modified));
+    entry.expires = netFreshUntil(&rsp, now);
+    netWriteEntry(entryPath, &entry);
+
+    PL_Printf(DBG_DEBUG, "downloaded %s (%ld bytes) to %s\n", url, size, path);
+    ret = 0;
+
+out:
+    if (fd != -1)
+        close(fd);
+    if (tmp[0])
+        unlink(tmp);
+    close(conn->fd);
+
+    return ret;
+}
+
+#endif /* _WIN32 */
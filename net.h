@@ -1,8 +1,49 @@
-//
-// Created by mpi on 27.11.23.
-//
+/*
+ * Copyright (c) 2023-2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
 
 #ifndef GCFFLASHER_NET_H
 #define GCFFLASHER_NET_H
 
-#endif //GCFFLASHER_NET_H
+/*! Returns the local cache directory, creating it if needed.
+
+    $GCF_CACHE_DIR, $XDG_CACHE_HOME/gcfflasher or $HOME/.cache/gcfflasher.
+
+    \returns 0 on success, -1 on failure.
+ */
+int NET_CacheDir(char *path, unsigned pathlen);
+
+/*! Small key value store <cache>/<name>, e.g. settings per device serial number.
+
+    Keys and values must not contain whitespace.
+
+    \returns 0 if \p key was found and copied to \p value, -1 otherwise.
+ */
+int NET_CacheGet(const char *name, const char *key, char *value, unsigned valuelen);
+
+/*! Sets \p key to \p value, an empty \p value removes the key.
+
+    \returns 0 on success, -1 on failure.
+ */
+int NET_CacheSet(const char *name, const char *key, const char *value);
+
+/*! Fetches a firmware file by HTTP/1.1 into the local content-addressed cache.
+
+    Files are stored under <cache>/objects/<sha256>.gcf, identical content
+    fetched from different URLs is only stored once. A fresh cache entry is
+    used without any network I/O, a stale one is revalidated with
+    If-None-Match / If-Modified-Since.
+
+    \param url - http://host[:port]/path
+    \param path - receives the path of the cached file.
+    \returns 0 on success, -1 on failure.
+ */
+int NET_FetchCached(const char *url, char *path, unsigned pathlen);
+
+#endif /* GCFFLASHER_NET_H */
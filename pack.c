@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+/* This file implements writing GCF files from raw binaries (pack command).
+
+   Plain file:
+
+     GCF header (14 bytes, see GCF_ParseFile())
+     u8[] data
+
+   Container (file type 60):
+
+     GCF header (14 bytes)
+     u32 magic          0xDEC0DExx
+     u32 total_size     == GCF header file size
+     image_1 .. image_N
+     u32 crc32          over everything from magic to the last image
+
+     image:
+       u32 image_size       size of data incl. padding
+       u32 image_type
+       u32 target_address
+       u32 plain_image_size
+       u32 plain_crc32
+       u8[] data (4-byte aligned)
+
+   The header checksum (Dallas CRC-8) covers all bytes after the GCF header.
+
+   Everything is written in one pass: headers are written as placeholders,
+   the input data is streamed through the checksum functions, and at the end
+   the headers are patched in place. The checksums over the patched headers
+   are merged with the data checksums by CRC_Xxx_Combine(), so no byte is
+   read twice.
+ */
+
+#include <stdio.h>
+
+#include "buffer_helper.h"
+#include "crc.h"
+#include "gcf.h"
+#include "pack.h"
+
+#define GCF_MAGIC 0xCAFEFEED
+#define GCF_HEADER_SIZE 14
+#define PACK_CONTAINER_HEADER_SIZE 8
+#define PACK_IMAGE_HEADER_SIZE 20
+#define PACK_BUFFER_SIZE (64 * 1024)
+
+typedef struct
+{
+    long offset;                /* file offset of image header */
+    unsigned long plainSize;
+    unsigned long plainCrc32;
+    unsigned long dataSize;     /* incl. padding */
+    unsigned long dataCrc32;    /* incl. padding */
+    unsigned char dataCrc8;     /* incl. padding */
+} PACK_ImageInfo;
+
+static unsigned char packBuf[PACK_BUFFER_SIZE];
+
+/*! Streams one input file to \p out and fills checksums and sizes in \p info. */
+static int packStreamFile(FILE *out, const char *path, unsigned align, PACK_ImageInfo *info)
+{
+    FILE *in;
+    size_t n;
+    unsigned pad;
+    unsigned long crc32;
+
+    in = fopen(path, "rb");
+    if (!in)
+    {
+        PL_Printf(DBG_INFO, "failed to open input file: %s\n", path);
+        return -1;
+    }
+
+    info->plainSize = 0;
+    info->dataCrc8 = 0;
+    crc32 = 0;
+
+    for (;;)
+    {
+        n = fread(packBuf, 1, sizeof(packBuf), in);
+        if (n == 0)
+            break;
+
+        crc32 = CRC_Crc32(crc32, packBuf, n);
+        info->dataCrc8 = CRC_Dallas8(info->dataCrc8, packBuf, n);
+        info->plainSize += n;
+
+        if (fwrite(packBuf, 1, n, out) != n)
+        {
+            PL_Printf(DBG_INFO, "failed to write output file\n");
+            fclose(in);
+            return -1;
+        }
+
+        if (info->plainSize > 0xFFFFFFFFUL - GCF_HEADER_SIZE - 64)
+        {
+            PL_Printf(DBG_INFO, "input file too large: %s\n", path);
+            fclose(in);
+            return -1;
+        }
+    }
+
+    if (ferror(in))
+    {
+        PL_Printf(DBG_INFO, "failed to read input file: %s\n", path);
+        fclose(in);
+        return -1;
+    }
+
+    fclose(in);
+
+    info->plainCrc32 = crc32;
+    info->dataSize = info->plainSize;
+
+    pad = align ? (align - (info->plainSize % align)) % align : 0;
+    if (pad)
+    {
+        packBuf[0] = packBuf[1] = packBuf[2] = packBuf[3] = 0;
+        if (fwrite(packBuf, 1, pad, out) != pad)
+        {
+            PL_Printf(DBG_INFO, "failed to write output file\n");
+            return -1;
+        }
+
+        crc32 = CRC_Crc32(crc32, packBuf, pad);
+        info->dataCrc8 = CRC_Dallas8(info->dataCrc8, packBuf, pad);
+        info->dataSize += pad;
+    }
+
+    info->dataCrc32 = crc32;
+
+    return 0;
+}
+
+static int packPatch(FILE *out, long offset, const unsigned char *data, unsigned len)
+{
+    if (fseek(out, offset, SEEK_SET) != 0 || fwrite(data, 1, len, out) != len)
+    {
+        PL_Printf(DBG_INFO, "failed to write output file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int packWrite(FILE *out, const PACK_Options *opt, PACK_Result *result)
+{
+    unsigned i;
+    unsigned char *p;
+    unsigned long u32;
+    unsigned long size;
+    unsigned long crc32;
+    unsigned char crc8;
+    unsigned char header[GCF_HEADER_SIZE];
+    unsigned char chdr[PACK_CONTAINER_HEADER_SIZE];
+    unsigned char ihdr[PACK_IMAGE_HEADER_SIZE];
+    unsigned char trailer[4];
+    PACK_ImageInfo info[PACK_MAX_IMAGES];
+
+    /* placeholders, patched when sizes and checksums are known */
+    for (i = 0; i < sizeof(header); i++)
+        header[i] = 0;
+
+    if (fwrite(header, 1, GCF_HEADER_SIZE, out) != GCF_HEADER_SIZE)
+    {
+        PL_Printf(DBG_INFO, "failed to write output file\n");
+        return -1;
+    }
+
+    if (opt->containerMagic == 0)
+    {
+        if (packStreamFile(out, opt->images[0].path, 0, &info[0]) != 0)
+            return -1;
+
+        size = info[0].dataSize;
+        crc8 = info[0].dataCrc8;
+        result->crc32 = info[0].plainCrc32;
+    }
+    else
+    {
+        if (fwrite(header, 1, PACK_CONTAINER_HEADER_SIZE, out) != PACK_CONTAINER_HEADER_SIZE)
+        {
+            PL_Printf(DBG_INFO, "failed to write output file\n");
+            return -1;
+        }
+
+        size = PACK_CONTAINER_HEADER_SIZE;
+
+        for (i = 0; i < opt->imageCount; i++)
+        {
+            info[i].offset = (long)(GCF_HEADER_SIZE + size);
+
+            if (fwrite(header, 1, PACK_IMAGE_HEADER_SIZE, out) != PACK_IMAGE_HEADER_SIZE)
+            {
+                PL_Printf(DBG_INFO, "failed to write output file\n");
+                return -1;
+            }
+
+            if (packStreamFile(out, opt->images[i].path, 4, &info[i]) != 0)
+                return -1;
+
+            size += PACK_IMAGE_HEADER_SIZE + info[i].dataSize;
+        }
+
+        size += sizeof(trailer);
+
+        p = &chdr[0];
+        p = put_u32_le(p, &opt->containerMagic);
+        p = put_u32_le(p, &size);
+
+        crc32 = CRC_Crc32(0, chdr, sizeof(chdr));
+        crc8 = CRC_Dallas8(0, chdr, sizeof(chdr));
+
+        for (i = 0; i < opt->imageCount; i++)
+        {
+            p = &ihdr[0];
+            p = put_u32_le(p, &info[i].dataSize);
+            p = put_u32_le(p, &opt->images[i].type);
+            p = put_u32_le(p, &opt->images[i].targetAddress);
+            p = put_u32_le(p, &info[i].plainSize);
+            p = put_u32_le(p, &info[i].plainCrc32);
+
+            if (packPatch(out, info[i].offset, ihdr, sizeof(ihdr)) != 0)
+                return -1;
+
+            crc32 = CRC_Crc32Combine(crc32, CRC_Crc32(0, ihdr, sizeof(ihdr)), sizeof(ihdr));
+            crc32 = CRC_Crc32Combine(crc32, info[i].dataCrc32, info[i].dataSize);
+            crc8 = CRC_Dallas8Combine(crc8, CRC_Dallas8(0, ihdr, sizeof(ihdr)), sizeof(ihdr));
+            crc8 = CRC_Dallas8Combine(crc8, info[i].dataCrc8, info[i].dataSize);
+        }
+
+        put_u32_le(trailer, &crc32);
+        crc8 = CRC_Dallas8(crc8, trailer, sizeof(trailer));
+
+        if (packPatch(out, GCF_HEADER_SIZE, chdr, sizeof(chdr)) != 0)
+            return -1;
+
+        if (fseek(out, 0, SEEK_END) != 0 || fwrite(trailer, 1, sizeof(trailer), out) != sizeof(trailer))
+        {
+            PL_Printf(DBG_INFO, "failed to write output file\n");
+            return -1;
+        }
+
+        result->crc32 = info[0].plainCrc32;
+    }
+
+    p = &header[0];
+    u32 = GCF_MAGIC;
+    p = put_u32_le(p, &u32);
+    p = put_u8_le(p, &opt->fileType);
+    p = put_u32_le(p, &opt->targetAddress);
+    p = put_u32_le(p, &size);
+    p = put_u8_le(p, &crc8);
+
+    if (packPatch(out, 0, header, sizeof(header)) != 0)
+        return -1;
+
+    result->fileSize = GCF_HEADER_SIZE + size;
+    result->crc8 = crc8;
+
+    return 0;
+}
+
+int PACK_Write(const PACK_Options *opt, PACK_Result *result)
+{
+    int ret;
+    FILE *out;
+
+    if (opt->imageCount == 0 || opt->imageCount > PACK_MAX_IMAGES)
+        return -1;
+
+    if (opt->containerMagic == 0 && opt->imageCount != 1)
+    {
+        PL_Printf(DBG_INFO, "multiple input files require a container (-x)\n");
+        return -1;
+    }
+
+    out = fopen(opt->output, "wb");
+    if (!out)
+    {
+        PL_Printf(DBG_INFO, "failed to create output file: %s\n", opt->output);
+        return -1;
+    }
+
+    ret = packWrite(out, opt, result);
+
+    if (fclose(out) != 0 && ret == 0)
+    {
+        PL_Printf(DBG_INFO, "failed to write output file: %s\n", opt->output);
+        ret = -1;
+    }
+
+    if (ret != 0)
+        remove(opt->output);
+
+    return ret;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#ifndef GCFFLASHER_PACK_H
+#define GCFFLASHER_PACK_H
+
+#define PACK_MAX_IMAGES 8
+
+typedef struct
+{
+    const char *path;
+    unsigned long type;
+    unsigned long targetAddress;
+} PACK_Image;
+
+typedef struct
+{
+    const char *output;
+    unsigned char fileType;
+    unsigned long targetAddress;
+    unsigned long containerMagic; /* 0 = plain file, else 0xDEC0DExx container */
+    unsigned imageCount;
+    PACK_Image images[PACK_MAX_IMAGES];
+} PACK_Options;
+
+typedef struct
+{
+    unsigned long fileSize;     /* total size incl. 14-byte header */
+    unsigned char crc8;         /* GCF header checksum */
+    unsigned long crc32;        /* plain CRC32 of the first image */
+} PACK_Result;
+
+/*! Writes a GCF file from raw binaries in a single pass.
+
+    The inputs are streamed to the output while all checksums are
+    calculated, header fields are patched in place at the end.
+
+    \returns 0 on success, -1 on failure.
+ */
+int PACK_Write(const PACK_Options *opt, PACK_Result *result);
+
+#endif /* GCFFLASHER_PACK_H */
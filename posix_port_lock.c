@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+/* Exclusive use of the serial port, included by main_posix.c.
+
+   Three mechanisms are honored, since gateways use different ones:
+
+   - UUCP lock file PL_LOCK_DIR/LCK..<name> with the pid of the owner,
+     the ASCII (HDB) format is also readable for lock files of QSerialPort.
+     It's kept for the whole session, so that nobody takes the port while
+     the device re-enumerates after a reset.
+   - flock() on the open port.
+   - TIOCEXCL, further open() calls fail with EBUSY.
+
+   While another process holds the port PL_ClaimPort() sleeps on inotify
+   events: removal of files in the lock directory and close of the device
+   node. With handoff the owner of the lock file gets SIGUSR1, a cooperating
+   gateway closes the port and removes its lock file, then waits until the
+   lock file of the flasher is gone before it reopens the port.
+ */
+
+#include <sys/file.h> /* flock() */
+#include <limits.h> /* PATH_MAX */
+
+#ifdef PL_LINUX
+  #include <sys/inotify.h>
+#endif
+
+#ifndef PL_LOCK_DIR
+  #define PL_LOCK_DIR "/var/lock"
+#endif
+
+#define PL_LOCK_RECHECK 1000 /* ms, also recheck without inotify events (stale locks, no inotify) */
+
+typedef struct
+{
+    int locked; /* lock file of this process exists */
+    char devpath[MAX_DEV_PATH_LENGTH]; /* resolved device node */
+    char lockfile[MAX_DEV_PATH_LENGTH];
+} PL_PortLock;
+
+static PL_PortLock portLock;
+
+/* Resolves symlinks like /dev/serial/by-id/.. and derives the lock file name. */
+static int plLockPaths(const char *path, char *devpath, char *lockfile)
+{
+    unsigned i;
+    unsigned len;
+    const char *name;
+    char real[PATH_MAX];
+
+    if (realpath(path, real) == NULL)
+    {
+        len = U_strlen(path);
+        if (len >= sizeof(real))
+            return -1;
+        U_memcpy(real, path, len + 1);
+    }
+
+    len = U_strlen(real);
+    if (len >= MAX_DEV_PATH_LENGTH)
+        return -1;
+
+    U_memcpy(devpath, real, len + 1);
+
+    name = real;
+    for (i = 0; i < len; i++)
+    {
+        if (real[i] == '/')
+            name = &real[i + 1];
+    }
+
+    if (*name == '\0')
+        return -1;
+
+    len = (unsigned)snprintf(lockfile, MAX_DEV_PATH_LENGTH, PL_LOCK_DIR "/LCK..%s", name);
+    return len < MAX_DEV_PATH_LENGTH ? 0 : -1;
+}
+
+/* \returns The pid in lock file \p lockfile, 0 if there is none. */
+static int plLockOwner(const char *lockfile)
+{
+    int fd;
+    int pid;
+    ssize_t n;
+    char buf[32];
+    char *p;
+
+    fd = open(lockfile, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if (n <= 0)
+        return 0;
+
+    buf[n] = '\0';
+    p = buf;
+    while (*p == ' ')
+        p++;
+
+    pid = 0;
+    while (*p >= '0' && *p <= '9' && pid < 4194304)
+        pid = pid * 10 + (*p++ - '0');
+
+    return pid;
+}
+
+/* Tries to create the UUCP lock file, stale files of dead processes are removed.
+
+   \returns 0 on success or if lock files aren't usable here, else the pid of the owner.
+ */
+static int plLockCreate(const char *lockfile)
+{
+    int fd;
+    int pid;
+    int retry;
+    char buf[16];
+
+    for (retry = 0; retry < 2; retry++)
+    {
+        fd = open(lockfile, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0)
+        {
+            snprintf(buf, sizeof(buf), "%10d\n", (int)getpid());
+            if (write(fd, buf, 11) != 11)
+            {
+                close(fd);
+                unlink(lockfile);
+                return 0;
+            }
+            close(fd);
+            portLock.locked = 1;
+            return 0;
+        }
+
+        if (errno != EEXIST)
+        {
+            /* no lock directory or no permission, flock() and TIOCEXCL still apply */
+            PL_Printf(DBG_DEBUG, "lock file %s not created: %s\n", lockfile, strerror(errno));
+            return 0;
+        }
+
+        pid = plLockOwner(lockfile);
+        if (pid == (int)getpid())
+            return 0;
+
+        if (pid > 0 && (kill(pid, 0) == 0 || errno == EPERM))
+            return pid;
+
+        PL_Printf(DBG_DEBUG, "remove stale lock file %s\n", lockfile);
+        unlink(lockfile);
+    }
+
+    return -1;
+}
+
+/* Checks flock() and TIOCEXCL of other processes with a short open of the device.
+
+   \returns 0 if the device isn't held, -1 otherwise.
+ */
+static int plPortHeld(const char *devpath)
+{
+    int fd;
+    int ret;
+
+    fd = open(devpath, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return errno == EBUSY ? -1 : 0; /* not present is not held */
+
+    ret = flock(fd, LOCK_EX | LOCK_NB) == 0 ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+/* Prints the process which holds the port. */
+static void plPrintOwner(const char *path, int pid)
+{
+    char comm[64];
+
+    comm[0] = '\0';
+#ifdef PL_LINUX
+    {
+        int fd;
+        ssize_t n;
+        char procpath[32];
+
+        snprintf(procpath, sizeof(procpath), "/proc/%d/comm", pid);
+        fd = open(procpath, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            n = read(fd, comm, sizeof(comm) - 1);
+            close(fd);
+            comm[n > 0 ? n - 1 : 0] = '\0'; /* strip newline */
+        }
+    }
+#endif
+
+    if (pid > 0)
+        PL_Printf(DBG_INFO, "port %s is used by pid %d %s\n", path, pid, comm);
+    else
+        PL_Printf(DBG_INFO, "port %s is used by another process\n", path);
+}
+
+/* \returns 0 if the port is claimed, otherwise the pid of the owner or -1. */
+static int plTryClaim(void)
+{
+    int pid;
+
+    if (!portLock.locked)
+    {
+        pid = plLockCreate(portLock.lockfile);
+        if (pid != 0)
+            return pid;
+    }
+
+    return plPortHeld(portLock.devpath);
+}
+
+static void plReleasePort(void)
+{
+    if (portLock.locked)
+    {
+        unlink(portLock.lockfile);
+        portLock.locked = 0;
+    }
+}
+
+int PL_ClaimPort(const char *path, unsigned long waitMs, int handoff)
+{
+    int pid;
+    int signaled;
+    int timeout;
+    PL_time_t now;
+    PL_time_t end;
+    struct pollfd pfd;
+    char buf[1024];
+
+    if (SIM_Active() || REC_Replaying())
+        return 0;
+
+    if (portLock.locked)
+        return 0; /* held since the first claim, also over retries */
+
+    if (plLockPaths(path, portLock.devpath, portLock.lockfile) != 0)
+        return 0;
+
+    pid = plTryClaim();
+    if (pid == 0)
+        return 0;
+
+    plPrintOwner(path, pid);
+    if (waitMs == 0)
+        return -1;
+
+    pfd.fd = -1;
+    pfd.events = POLLIN;
+#ifdef PL_LINUX
+    pfd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (pfd.fd >= 0)
+    {
+        inotify_add_watch(pfd.fd, PL_LOCK_DIR, IN_DELETE | IN_MOVED_FROM);
+        inotify_add_watch(pfd.fd, portLock.devpath, IN_CLOSE_WRITE | IN_CLOSE_NOWRITE);
+    }
+#endif
+
+    signaled = 0;
+    end = PL_Time() + waitMs;
+
+    for (;;)
+    {
+        if (handoff && pid > 0 && !signaled)
+        {
+            PL_Printf(DBG_INFO, "ask pid %d to release %s\n", pid, path);
+            kill(pid, SIGUSR1);
+            signaled = 1;
+        }
+
+        now = PL_Time();
+        if (now >= end || !platform.running)
+            break;
+
+        timeout = end - now > PL_LOCK_RECHECK ? PL_LOCK_RECHECK : (int)(end - now);
+
+        if (pfd.fd >= 0)
+        {
+            if (poll(&pfd, 1, timeout) > 0)
+            {
+                while (read(pfd.fd, buf, sizeof(buf)) > 0)
+                {
+                }
+            }
+        }
+        else
+        {
+            PL_MSleep(250);
+        }
+
+        pid = plTryClaim();
+        if (pid == 0)
+            break;
+    }
+
+    if (pfd.fd >= 0)
+        close(pfd.fd);
+
+    if (pid != 0)
+    {
+        PL_Printf(DBG_INFO, "port %s wasn't released\n", path);
+        return -1;
+    }
+
+    PL_Printf(DBG_INFO, "port %s released after %lu ms\n", path, (unsigned long)(PL_Time() - (end - waitMs)));
+    return 0;
+}
@@ -124,9 +124,9 @@ nextTurn:
                   crcvalid = 1;
                }
 
-               if (crcvalid)
+               if (crcvalid && rx->bufpos > 2)
                {
-
+                 /* the frame is passed in place, see PROT_Packet() */
                  PROT_Packet(&rx->buf[0], rx->bufpos - 2);
                }
             }
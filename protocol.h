@@ -11,16 +11,24 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#define PROT_MAX_FRAME_SIZE 256 /* received frame incl. checksum */
+
 typedef struct {
     unsigned bufpos;
     unsigned short crc;
     unsigned char escaped;
-    unsigned char buf[256];
+    unsigned char buf[PROT_MAX_FRAME_SIZE];
 } PROT_RxState;
 
 /* Platform independent declarations. */
 void PROT_SendFlagged(const unsigned char *data, unsigned len);
 void PROT_ReceiveFlagged(PROT_RxState *rx, const unsigned char *data, unsigned len);
+
+/*! Called by PROT_ReceiveFlagged() for every valid frame.
+
+    \p data points into the PROT_RxState buffer and is only valid until the
+    function returns, \p len is > 0.
+ */
 void PROT_Packet(const unsigned char *data, unsigned len);
 
 /*! Platform specific declarations.
@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+/* This file implements the session recorder and replay driver.
+
+   File format, little endian:
+
+     u8[8] magic "GCFREC1\n"
+     record:
+       u8  type       REC_Type
+       u32 delta      microseconds since the previous record
+       u16 length
+       u8[] data
+
+   REC_TX, REC_RX   raw bytes, long chunks are split
+   REC_CONNECT,
+   REC_RESET        i8 result, 0 = success
+   REC_DEVICES      per device: u16 vendor id, u16 product id, u32 baudrate,
+                    name, path, serial and stable path, each NUL terminated
+   REC_ARGS         command line, NUL separated
+
+   Host calls happen in response to device side events at the same virtual
+   time, so their records directly follow the event which caused them.
+   Writes are compared as byte stream, the chunking doesn't matter.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "gcf.h"
+#include "buffer_helper.h"
+#include "u_mem.h"
+#include "u_strlen.h"
+#include "rec.h"
+
+#define REC_MAGIC "GCFREC1\n"
+#define REC_MAGIC_SIZE 8
+#define REC_HEADER_SIZE 7
+#define REC_MAX_DATA 0xFFFF
+#define REC_MAX_PRINTED 10 /* divergences, all of them are counted */
+
+typedef struct
+{
+    FILE *fp;
+    int recording;
+    int replaying;
+    PL_time_t last;      /* time of the previous record */
+
+    /* replay */
+    PL_time_t now;       /* virtual time in microseconds */
+    int loaded;          /* 1 = current record is valid, -1 = end of file */
+    REC_Type type;
+    PL_time_t at;
+    unsigned len;
+    unsigned pos;        /* compared bytes of REC_TX */
+    unsigned long records;
+    unsigned long divergences;
+    PL_time_t startTime;
+    clock_t cpuStart;
+    unsigned char data[REC_MAX_DATA];
+} REC_Internal;
+
+static REC_Internal rec;
+
+static void recWrite(REC_Type type, const unsigned char *data, unsigned len)
+{
+    PL_time_t now;
+    unsigned long delta;
+    unsigned short length;
+    unsigned char hdr[REC_HEADER_SIZE];
+
+    now = PL_TimeUs();
+    delta = now - rec.last > 0xFFFFFFFFUL ? 0xFFFFFFFFUL : (unsigned long)(now - rec.last);
+    rec.last = now;
+    length = (unsigned short)len;
+
+    hdr[0] = (unsigned char)type;
+    put_u16_le(put_u32_le(&hdr[1], &delta), &length);
+
+    if (fwrite(hdr, sizeof(hdr), 1, rec.fp) != 1 || (len && fwrite(data, len, 1, rec.fp) != 1))
+    {
+        PL_Printf(DBG_INFO, "record: write failed, recording stopped\n");
+        fclose(rec.fp);
+        rec.fp = 0;
+        rec.recording = 0;
+    }
+}
+
+int REC_Open(const char *path, int argc, char *argv[])
+{
+    int i;
+    unsigned n;
+    unsigned len;
+
+    U_bzero(&rec, sizeof(rec));
+
+    rec.fp = fopen(path, "wb");
+    if (!rec.fp)
+        return -1;
+
+    if (fwrite(REC_MAGIC, REC_MAGIC_SIZE, 1, rec.fp) != 1)
+    {
+        fclose(rec.fp);
+        rec.fp = 0;
+        return -1;
+    }
+
+    rec.recording = 1;
+    rec.last = PL_TimeUs();
+
+    for (i = 0, len = 0; i < argc; i++)
+    {
+        n = U_strlen(argv[i]) + 1;
+        if (len + n > REC_MAX_DATA)
+            break;
+        U_memcpy(&rec.data[len], argv[i], n);
+        len += n;
+    }
+
+    recWrite(REC_ARGS, rec.data, len);
+
+    return 0;
+}
+
+int REC_Recording(void)
+{
+    return rec.recording;
+}
+
+void REC_Add(REC_Type type, const unsigned char *data, unsigned len)
+{
+    unsigned n;
+
+    if (!rec.recording)
+        return;
+
+    do
+    {
+        n = len > REC_MAX_DATA ? REC_MAX_DATA : len;
+        recWrite(type, data, n);
+        data += n;
+        len -= n;
+    }
+    while (len && rec.recording);
+}
+
+void REC_AddResult(REC_Type type, int result)
+{
+    unsigned char ch;
+
+    ch = (unsigned char)(result == 0 ? 0 : 0xFF);
+    REC_Add(type, &ch, 1);
+}
+
+static unsigned recPutStr(unsigned char *p, const char *str, unsigned max)
+{
+    unsigned n;
+
+    for (n = 0; n < max - 1 && str[n]; n++)
+        p[n] = (unsigned char)str[n];
+    p[n] = '\0';
+    return n + 1;
+}
+
+void REC_AddDevices(const Device *devs, int count)
+{
+    int i;
+    unsigned len;
+    unsigned long baudrate;
+    unsigned char *p;
+
+    if (!rec.recording)
+        return;
+
+    for (i = 0, len = 0; i < count; i++)
+    {
+        /* worst case size of one device */
+        if (len + 8 + MAX_DEV_NAME_LENGTH + MAX_DEV_SERIALNR_LENGTH + 2 * MAX_DEV_PATH_LENGTH > REC_MAX_DATA)
+            break;
+
+        p = &rec.data[len];
+        baudrate = (unsigned long)devs[i].baudrate;
+        p = put_u16_le(p, &devs[i].vendorId);
+        p = put_u16_le(p, &devs[i].productId);
+        p = put_u32_le(p, &baudrate);
+        p += recPutStr(p, devs[i].name, MAX_DEV_NAME_LENGTH);
+        p += recPutStr(p, devs[i].path, MAX_DEV_PATH_LENGTH);
+        p += recPutStr(p, devs[i].serial, MAX_DEV_SERIALNR_LENGTH);
+        p += recPutStr(p, devs[i].stablepath, MAX_DEV_PATH_LENGTH);
+        len = (unsigned)(p - &rec.data[0]);
+    }
+
+    recWrite(REC_DEVICES, rec.data, len);
+}
+
+void REC_Close(void)
+{
+    if (rec.fp)
+        fclose(rec.fp);
+
+    rec.fp = 0;
+    rec.recording = 0;
+}
+
+/* Loads the next record if the current one was consumed.
+
+   \returns 1 if a record is available, 0 at the end.
+ */
+static int recLoad(void)
+{
+    unsigned long delta;
+    unsigned short length;
+    unsigned char hdr[REC_HEADER_SIZE];
+
+    if (rec.loaded != 0)
+        return rec.loaded == 1;
+
+    if (fread(hdr, sizeof(hdr), 1, rec.fp) != 1)
+    {
+        rec.loaded = -1;
+        return 0;
+    }
+
+    get_u16_le(get_u32_le(&hdr[1], &delta), &length);
+
+    if (length && fread(rec.data, length, 1, rec.fp) != 1)
+    {
+        PL_Printf(DBG_INFO, "replay: truncated recording\n");
+        rec.loaded = -1;
+        return 0;
+    }
+
+    rec.type = (REC_Type)hdr[0];
+    rec.at += delta;
+    rec.len = length;
+    rec.pos = 0;
+    rec.loaded = 1;
+    rec.records++;
+    return 1;
+}
+
+static void recConsume(void)
+{
+    if (rec.loaded == 1)
+        rec.loaded = 0;
+}
+
+static const char *recTypeName(REC_Type type)
+{
+    switch (type)
+    {
+    case REC_RX:      return "rx";
+    case REC_TIMEOUT: return "timeout";
+    case REC_HANGUP:  return "hangup";
+    case REC_TX:      return "write";
+    case REC_CONNECT: return "connect";
+    case REC_RESET:   return "reset";
+    case REC_DEVICES: return "device list";
+    case REC_ARGS:    return "arguments";
+    }
+
+    return "unknown";
+}
+
+void REC_Divergence(const char *what)
+{
+    rec.divergences++;
+
+    if (rec.divergences <= REC_MAX_PRINTED)
+    {
+        PL_Printf(DBG_INFO, "replay: divergence at %lu.%03lu s: %s\n",
+                  (unsigned long)((rec.now - rec.startTime) / 1000000),
+                  (unsigned long)((rec.now - rec.startTime) / 1000 % 1000), what);
+    }
+}
+
+/* Reports a recorded host call which didn't happen and skips it. */
+static void recMissing(void)
+{
+    char buf[64];
+
+    sprintf(buf, "recorded %s didn't happen", recTypeName(rec.type));
+    REC_Divergence(buf);
+    recConsume();
+}
+
+int REC_Replay(const char *path, unsigned long long startTimeUs)
+{
+    unsigned i;
+    char magic[REC_MAGIC_SIZE];
+
+    U_bzero(&rec, sizeof(rec));
+
+    rec.fp = fopen(path, "rb");
+    if (!rec.fp)
+        return -1;
+
+    if (fread(magic, sizeof(magic), 1, rec.fp) != 1)
+        magic[0] = '\0';
+
+    for (i = 0; i < REC_MAGIC_SIZE; i++)
+    {
+        if (magic[i] != REC_MAGIC[i])
+        {
+            fclose(rec.fp);
+            rec.fp = 0;
+            return -1;
+        }
+    }
+
+    rec.replaying = 1;
+    rec.startTime = startTimeUs;
+    rec.now = startTimeUs;
+    rec.at = startTimeUs;
+    rec.cpuStart = clock();
+
+    if (recLoad() && rec.type == REC_ARGS)
+    {
+        PL_Printf(DBG_INFO, "replay: recorded session:");
+        for (i = 0; i < rec.len; i += U_strlen((const char*)&rec.data[i]) + 1)
+            PL_Printf(DBG_INFO, " %s", &rec.data[i]);
+        PL_Printf(DBG_INFO, "\n");
+        recConsume();
+    }
+
+    return 0;
+}
+
+int REC_Replaying(void)
+{
+    return rec.replaying;
+}
+
+unsigned long long REC_TimeUs(void)
+{
+    return rec.now;
+}
+
+void REC_Sleep(unsigned long ms)
+{
+    rec.now += (PL_time_t)ms * 1000;
+}
+
+int REC_NextEvent(REC_Type *type, unsigned char *buf, unsigned max, unsigned *len)
+{
+    while (recLoad())
+    {
+        if (rec.type != REC_RX && rec.type != REC_TIMEOUT && rec.type != REC_HANGUP)
+        {
+            recMissing();
+            continue;
+        }
+
+        if (rec.at > rec.now)
+            rec.now = rec.at;
+
+        *type = rec.type;
+        *len = 0;
+
+        if (rec.type == REC_RX)
+        {
+            if (rec.len > max)
+                REC_Divergence("rx chunk larger than the receive buffer");
+
+            *len = rec.len < max ? rec.len : max;
+            U_memcpy(buf, rec.data, *len);
+        }
+
+        recConsume();
+        return 1;
+    }
+
+    return 0;
+}
+
+int REC_ReplayResult(REC_Type type)
+{
+    int result;
+    char buf[64];
+
+    if (!recLoad() || rec.type != type)
+    {
+        sprintf(buf, "%s isn't in the recording", recTypeName(type));
+        REC_Divergence(buf);
+        return -1;
+    }
+
+    result = rec.len > 0 && rec.data[0] == 0 ? 0 : -1;
+    recConsume();
+    return result;
+}
+
+static unsigned recGetStr(const unsigned char *p, const unsigned char *end, char *str, unsigned max)
+{
+    unsigned n;
+
+    for (n = 0; &p[n] < end && p[n]; n++)
+    {
+        if (n < max - 1)
+            str[n] = (char)p[n];
+    }
+
+    str[n < max - 1 ? n : max - 1] = '\0';
+    return &p[n] < end ? n + 1 : n;
+}
+
+int REC_ReplayDevices(Device *devs, unsigned max)
+{
+    unsigned n;
+    unsigned long baudrate;
+    const unsigned char *p;
+    const unsigned char *end;
+
+    if (!recLoad() || rec.type != REC_DEVICES)
+    {
+        REC_Divergence("device list isn't in the recording");
+        return 0;
+    }
+
+    p = &rec.data[0];
+    end = &rec.data[rec.len];
+
+    for (n = 0; n < max && p + 8 <= end; n++)
+    {
+        p = get_u16_le(p, &devs[n].vendorId);
+        p = get_u16_le(p, &devs[n].productId);
+        p = get_u32_le(p, &baudrate);
+        devs[n].baudrate = (PL_Baudrate)baudrate;
+        p += recGetStr(p, end, devs[n].name, MAX_DEV_NAME_LENGTH);
+        p += recGetStr(p, end, devs[n].path, MAX_DEV_PATH_LENGTH);
+        p += recGetStr(p, end, devs[n].serial, MAX_DEV_SERIALNR_LENGTH);
+        p += recGetStr(p, end, devs[n].stablepath, MAX_DEV_PATH_LENGTH);
+    }
+
+    recConsume();
+    return (int)n;
+}
+
+void REC_ReplayTx(const unsigned char *data, unsigned len)
+{
+    char buf[80];
+    unsigned long offset;
+
+    offset = 0;
+    while (len > 0)
+    {
+        if (!recLoad() || rec.type != REC_TX)
+        {
+            sprintf(buf, "write of %u bytes isn't in the recording", len);
+            REC_Divergence(buf);
+            return;
+        }
+
+        for (; len > 0 && rec.pos < rec.len; len--, data++, offset++, rec.pos++)
+        {
+            if (*data != rec.data[rec.pos])
+            {
+                sprintf(buf, "written byte %02X differs from recorded %02X (offset %lu)",
+                        *data, rec.data[rec.pos], offset);
+                REC_Divergence(buf);
+                rec.pos = rec.len; /* one report per write */
+                len = 0;
+                break;
+            }
+        }
+
+        if (rec.pos == rec.len)
+            recConsume();
+    }
+}
+
+int REC_Report(void)
+{
+    char buf[64];
+    double cpu;
+    unsigned long left;
+
+    if (!rec.replaying)
+        return 0;
+
+    cpu = (double)(clock() - rec.cpuStart) / CLOCKS_PER_SEC;
+
+    for (left = 0; recLoad(); left++)
+    {
+        if (left == 0)
+        {
+            sprintf(buf, "recording continues with %s", recTypeName(rec.type));
+            REC_Divergence(buf);
+        }
+        recConsume();
+    }
+
+    PL_Printf(DBG_INFO, "replay: %lu records, %lu not replayed, %lu divergences, session %.3f s, cpu %.3f ms\n",
+              rec.records, left, rec.divergences,
+              (double)(rec.now - rec.startTime) / 1000000.0, cpu * 1000.0);
+
+    fclose(rec.fp);
+    rec.fp = 0;
+    rec.replaying = 0;
+
+    return rec.divergences == 0 ? 0 : -1;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#ifndef GCFFLASHER_REC_H
+#define GCFFLASHER_REC_H
+
+/* Recording and deterministic replay of a session (--record, --replay).
+
+   The recording contains everything the state machine gets from the
+   outside world for the primary device: received chunks with their
+   boundaries, timeouts, hangups and the results of connect, reset and
+   device enumeration. Host writes are recorded as well.
+
+   In replay the platform layer runs on a virtual clock which jumps to
+   the time of the next recorded RX, timeout or hangup and passes it to
+   GCF_Received() / GCF_HandleEvent(). Connect, reset and enumeration
+   return the recorded results, writes are compared with the recorded
+   bytes. Every difference is reported as divergence.
+ */
+
+typedef enum
+{
+    /* device side events, driven by the replay loop */
+    REC_RX = 1,
+    REC_TIMEOUT = 2,
+    REC_HANGUP = 3,
+    /* results of host calls, consumed by the call */
+    REC_TX = 10,
+    REC_CONNECT = 11,
+    REC_RESET = 12,
+    REC_DEVICES = 13,
+    /* information */
+    REC_ARGS = 20
+} REC_Type;
+
+/*! Starts recording to \p path, the command line is stored for reference.
+
+    \returns 0 on success, -1 if the file can't be created.
+ */
+int REC_Open(const char *path, int argc, char *argv[]);
+int REC_Recording(void);
+
+/*! Adds a record with the current time, does nothing if not recording. */
+void REC_Add(REC_Type type, const unsigned char *data, unsigned len);
+void REC_AddResult(REC_Type type, int result);
+void REC_AddDevices(const Device *devs, int count);
+
+/*! Finishes the recording or replay. */
+void REC_Close(void);
+
+/*! Starts the replay of \p path, the virtual clock starts at \p startTimeUs.
+
+    \returns 0 on success, -1 if the file isn't a valid recording.
+ */
+int REC_Replay(const char *path, unsigned long long startTimeUs);
+int REC_Replaying(void);
+
+/*! Virtual time in microseconds. */
+unsigned long long REC_TimeUs(void);
+void REC_Sleep(unsigned long ms);
+
+/*! Fetches the next device side event and advances the clock to its time.
+
+    Data of REC_RX is copied to \p buf.
+
+    \returns 1 for an event, 0 at the end of the recording.
+ */
+int REC_NextEvent(REC_Type *type, unsigned char *buf, unsigned max, unsigned *len);
+
+/*! \returns The recorded result of a connect or reset call. */
+int REC_ReplayResult(REC_Type type);
+int REC_ReplayDevices(Device *devs, unsigned max);
+
+/*! Compares host writes with the recorded bytes. */
+void REC_ReplayTx(const unsigned char *data, unsigned len);
+
+void REC_Divergence(const char *what);
+
+/*! Prints the replay summary.
+
+    \returns 0 if the session behaved like the recorded one, -1 otherwise.
+ */
+int REC_Report(void);
+
+#endif /* GCFFLASHER_REC_H */
@@ -0,0 +1,901 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+/* This file implements the device model for --dry-run.
+
+   The model has three parts:
+
+   1) A serial link per direction which is busy for 10 bit times per byte
+      at the configured baudrate, plus half the round trip time as latency.
+
+   2) The firmware, which only understands the write parameter command
+      for the watchdog timeout (UART reset) and resets when it expires.
+
+   3) The bootloader, V1 (ASCII "GET" page requests, raw data) or
+      V3 (BTL_MAGIC frames with data requests), which compares every
+      received byte with the image. Without image in memory (--stream)
+      the CRC-8 of the received data is compared at the end instead.
+
+   Optionally the device has a small receive buffer which is emptied at
+   a fixed rate (--rx-buffer, --rx-rate). Bytes which arrive faster than
+   that and don't fit are dropped, like an overrun of a USB CDC endpoint
+   or UART FIFO. The host only notices by timeouts.
+
+   Host writes and device events are queued with their virtual time and
+   processed in order by SIM_AdvanceTo(). Timing constants of the device
+   are estimates, they are kept small compared to the link time.
+ */
+
+#include "gcf.h"
+#include "buffer_helper.h"
+#include "crc.h"
+#include "u_mem.h"
+#include "sim.h"
+
+#define SIM_BTL_MAGIC              0x81
+#define SIM_BTL_ID_REQUEST         0x02
+#define SIM_BTL_ID_RESPONSE        0x82
+#define SIM_BTL_FW_UPDATE_REQUEST  0x03
+#define SIM_BTL_FW_UPDATE_RESPONSE 0x83
+#define SIM_BTL_FW_DATA_REQUEST    0x04
+#define SIM_BTL_FW_DATA_RESPONSE   0x84
+
+#define SIM_FR_END   0xC0
+#define SIM_FR_ESC   0xDB
+#define SIM_T_FR_END 0xDC
+#define SIM_T_FR_ESC 0xDD
+
+#define SIM_V1_PAGESIZE 256
+
+#define SIM_BOOT_US         50000   /* reset until the bootloader runs */
+#define SIM_ENUMERATE_US    800000  /* USB re-enumeration until the port can be opened again */
+#define SIM_PAGE_WRITE_US   2000    /* V1 flash page write */
+#define SIM_V1_VALIDATE_US  1000000 /* V1 CRC check of the written image */
+#define SIM_V3_VERIFY_US    1500000 /* V3 signature and CRC check */
+#define SIM_BTL_ABORT_US    2000000 /* bootloader drops an upload without host data for this long */
+
+#define SIM_IN_CHUNKS      64
+#define SIM_IN_CHUNK_SIZE  1024
+#define SIM_OUT_CHUNKS     32
+#define SIM_OUT_CHUNK_SIZE 96
+#define SIM_FRAME_SIZE     1100
+
+typedef enum
+{
+    SIM_APP,
+    SIM_OFF,
+    SIM_V1_IDLE,
+    SIM_V1_HEADER,
+    SIM_V1_DATA,
+    SIM_V3_IDLE,
+    SIM_V3_DATA,
+    SIM_DONE
+} SIM_State;
+
+typedef struct
+{
+    PL_time_t at; /* arrival at the device */
+    unsigned len;
+    unsigned char data[SIM_IN_CHUNK_SIZE];
+} SIM_InChunk;
+
+typedef struct
+{
+    PL_time_t at; /* arrival at the host */
+    unsigned len;
+    unsigned char hangup;
+    unsigned char data[SIM_OUT_CHUNK_SIZE];
+} SIM_OutChunk;
+
+typedef struct
+{
+    int active;
+    SIM_Config cfg;
+    PL_time_t now;         /* microseconds */
+    SIM_State state;
+    int connected;         /* host has the port opened */
+    PL_time_t presentAt;   /* port can be opened from this time */
+    PL_time_t resetAt;     /* 0 = no reset pending */
+    PL_time_t bootAt;      /* 0 = not booting */
+    PL_time_t hostTxFree;  /* host --> device link idle from this time */
+    PL_time_t devTxFree;   /* device --> host link idle from this time */
+    PL_time_t inAt;        /* arrival of the last host data */
+
+    unsigned inRp;
+    unsigned inWp;
+    SIM_InChunk in[SIM_IN_CHUNKS];
+    unsigned outRp;
+    unsigned outWp;
+    SIM_OutChunk out[SIM_OUT_CHUNKS];
+
+    /* device receive */
+    unsigned framePos;
+    unsigned char escaped;
+    unsigned char frame[SIM_FRAME_SIZE];
+    unsigned long syncWord;    /* last four raw bytes, V1 commands */
+    unsigned char header[10];  /* V1 header */
+    unsigned headerPos;
+    unsigned long size;        /* announced by the host */
+    unsigned long offset;      /* received image bytes */
+    unsigned pageFill;
+    unsigned long mismatches;
+    unsigned char crc8;        /* of the received image bytes */
+
+    /* receive buffer model */
+    unsigned long long rxLevel;  /* in byte microseconds */
+    PL_time_t rxLevelAt;
+    unsigned long rxDropped;
+    unsigned long rxOverruns;    /* writes which lost bytes */
+
+    /* statistics */
+    unsigned long long hostBytes;
+    unsigned long long devBytes;
+    unsigned long escapes;
+    unsigned long roundTrips;
+    int devSpoke;
+    PL_time_t uploadStart;
+    PL_time_t doneAt;
+    unsigned uploads;          /* completed uploads */
+    unsigned long long payloadDone;
+    PL_time_t uploadUs;        /* sum of completed uploads */
+} SIM_Internal;
+
+static SIM_Internal sim;
+
+void SIM_Init(const SIM_Config *cfg)
+{
+    U_bzero(&sim, sizeof(sim));
+    sim.cfg = *cfg;
+    sim.active = 1;
+    sim.now = cfg->startTimeUs;
+    sim.rxLevelAt = cfg->startTimeUs;
+    sim.state = SIM_APP;
+
+    if (sim.cfg.baudrate == 0)
+        sim.cfg.baudrate = 38400;
+
+    if (sim.cfg.v3ChunkSize == 0)
+        sim.cfg.v3ChunkSize = 256;
+
+    if (sim.cfg.rxRate == 0)
+        sim.cfg.rxRate = sim.cfg.baudrate / 10;
+}
+
+void SIM_SetImage(const unsigned char *image, unsigned long size, unsigned long crc32, unsigned char crc8)
+{
+    sim.cfg.image = image;
+    sim.cfg.imageSize = size;
+    sim.cfg.imageCrc32 = crc32;
+    sim.cfg.imageCrc8 = crc8;
+}
+
+int SIM_Active(void)
+{
+    return sim.active;
+}
+
+unsigned long long SIM_TimeUs(void)
+{
+    return sim.now;
+}
+
+/* Microseconds to transfer \p len bytes (8N1) on the link. */
+static PL_time_t simLinkTime(unsigned long len)
+{
+    return ((PL_time_t)len * 10 * 1000000 + sim.cfg.baudrate - 1) / sim.cfg.baudrate;
+}
+
+static void simQueueOut(PL_time_t delay, const unsigned char *data, unsigned len, int hangup)
+{
+    PL_time_t start;
+    SIM_OutChunk *chunk;
+
+    if (sim.outWp - sim.outRp == SIM_OUT_CHUNKS)
+    {
+        PL_Printf(DBG_DEBUG, "dry-run: device output queue full\n");
+        return;
+    }
+
+    chunk = &sim.out[sim.outWp % SIM_OUT_CHUNKS];
+    Assert(len <= sizeof(chunk->data));
+
+    start = sim.now + delay;
+    if (start < sim.devTxFree)
+        start = sim.devTxFree;
+
+    sim.devTxFree = start + simLinkTime(len);
+    sim.devBytes += len;
+
+    chunk->at = sim.devTxFree + sim.cfg.rttUs / 2;
+    chunk->len = len;
+    chunk->hangup = (unsigned char)hangup;
+    if (len)
+        U_memcpy(chunk->data, data, len);
+
+    sim.outWp++;
+}
+
+static void simSendRaw(PL_time_t delay, const char *str)
+{
+    unsigned len;
+
+    for (len = 0; str[len]; len++)
+        ;
+
+    simQueueOut(delay, (const unsigned char*)str, len, 0);
+}
+
+/* Sends a frame with the checksum used in protocol.c. */
+static void simSendFrame(PL_time_t delay, const unsigned char *data, unsigned len)
+{
+    unsigned i;
+    unsigned n;
+    unsigned char c;
+    unsigned short crc;
+    unsigned char crcbuf[2];
+    unsigned char buf[SIM_OUT_CHUNK_SIZE];
+
+    crc = 0;
+    for (i = 0; i < len; i++)
+        crc += data[i];
+
+    crc = (unsigned short)(~crc + 1);
+    crcbuf[0] = crc & 0xFF;
+    crcbuf[1] = (crc >> 8) & 0xFF;
+
+    n = 0;
+    buf[n++] = SIM_FR_END;
+
+    for (i = 0; i < len + 2; i++)
+    {
+        c = i < len ? data[i] : crcbuf[i - len];
+
+        if (c == SIM_FR_END || c == SIM_FR_ESC)
+        {
+            buf[n++] = SIM_FR_ESC;
+            buf[n++] = c == SIM_FR_END ? SIM_T_FR_END : SIM_T_FR_ESC;
+        }
+        else
+        {
+            buf[n++] = c;
+        }
+    }
+
+    buf[n++] = SIM_FR_END;
+    Assert(n <= sizeof(buf));
+
+    simQueueOut(delay, buf, n, 0);
+}
+
+static void simCompare(const unsigned char *data, unsigned long offset, unsigned len)
+{
+    unsigned i;
+
+    if (!sim.cfg.image)
+    {
+        /* bytes arrive in order, checked with the last one */
+        sim.crc8 = CRC_Dallas8(offset == 0 ? 0 : sim.crc8, data, len);
+        if (offset + len >= sim.cfg.imageSize && sim.crc8 != sim.cfg.imageCrc8)
+            sim.mismatches++;
+        return;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        if (offset + i >= sim.cfg.imageSize || sim.cfg.image[offset + i] != data[i])
+            sim.mismatches++;
+    }
+}
+
+static void simUploadDone(void)
+{
+    sim.state = SIM_DONE;
+    sim.doneAt = sim.out[(sim.outWp - 1) % SIM_OUT_CHUNKS].at;
+    sim.uploads++;
+    sim.payloadDone += sim.offset;
+    sim.uploadUs += sim.doneAt - sim.uploadStart;
+}
+
+static void simV3SendId(PL_time_t delay, unsigned long appCrc)
+{
+    unsigned char *p;
+    unsigned char buf[10];
+    unsigned long version;
+
+    version = 0x00000300;
+    p = buf;
+    *p++ = SIM_BTL_MAGIC;
+    *p++ = SIM_BTL_ID_RESPONSE;
+    p = put_u32_le(p, &version);
+    p = put_u32_le(p, &appCrc);
+
+    simSendFrame(delay, buf, (unsigned)(p - buf));
+}
+
+static void simV3SendDataRequest(PL_time_t delay)
+{
+    unsigned char *p;
+    unsigned char buf[8];
+    unsigned short length;
+
+    length = (unsigned short)sim.cfg.v3ChunkSize;
+    if (sim.size - sim.offset < length)
+        length = (unsigned short)(sim.size - sim.offset);
+
+    p = buf;
+    *p++ = SIM_BTL_MAGIC;
+    *p++ = SIM_BTL_FW_DATA_REQUEST;
+    p = put_u32_le(p, &sim.offset);
+    p = put_u16_le(p, &length);
+
+    simSendFrame(delay, buf, (unsigned)(p - buf));
+}
+
+static void simFrame(const unsigned char *frame, unsigned len)
+{
+    unsigned long offset;
+    unsigned short length;
+    unsigned char rsp[8];
+
+    if (sim.state == SIM_APP)
+    {
+        if (len >= 9 && frame[0] == 0x0B && frame[7] == 0x26) /* write parameter: watchdog timeout */
+        {
+            rsp[0] = 0x0B;
+            rsp[1] = frame[1];
+            rsp[2] = 0x00;
+            rsp[3] = 0x08;
+            rsp[4] = 0x00;
+            rsp[5] = 0x01;
+            rsp[6] = 0x00;
+            rsp[7] = 0x26;
+            simSendFrame(0, rsp, 8);
+
+            sim.resetAt = sim.now + (frame[8] ? frame[8] : 1) * (PL_time_t)1000000;
+        }
+        return;
+    }
+
+    if (len < 2 || frame[0] != SIM_BTL_MAGIC)
+        return;
+
+    /* after an upload the bootloader keeps running and accepts the next one */
+    if (frame[1] == SIM_BTL_ID_REQUEST && (sim.state == SIM_V3_IDLE || sim.state == SIM_DONE))
+    {
+        simV3SendId(0, 0);
+    }
+    else if (frame[1] == SIM_BTL_FW_UPDATE_REQUEST && len >= 11 && (sim.state == SIM_V3_IDLE || sim.state == SIM_DONE))
+    {
+        get_u32_le(&frame[2], &sim.size);
+
+        rsp[0] = SIM_BTL_MAGIC;
+        rsp[1] = SIM_BTL_FW_UPDATE_RESPONSE;
+        rsp[2] = 0x00;
+        simSendFrame(0, rsp, 3);
+
+        sim.state = SIM_V3_DATA;
+        sim.offset = 0;
+        sim.uploadStart = sim.now;
+        simV3SendDataRequest(0);
+    }
+    else if (frame[1] == SIM_BTL_FW_DATA_RESPONSE && len >= 9 && sim.state == SIM_V3_DATA)
+    {
+        get_u32_le(&frame[3], &offset);
+        get_u16_le(&frame[7], &length);
+
+        if (frame[2] != 0)
+        {
+            /* the host refused the request, abort the update */
+            PL_Printf(DBG_DEBUG, "dry-run: data response status %u\n", frame[2]);
+            sim.state = SIM_V3_IDLE;
+            return;
+        }
+
+        if (offset != sim.offset || length > len - 9)
+        {
+            simV3SendDataRequest(0); /* ask again */
+            return;
+        }
+
+        simCompare(&frame[9], offset, length);
+        sim.offset += length;
+
+        if (sim.offset >= sim.size)
+        {
+            simV3SendId(SIM_V3_VERIFY_US, sim.mismatches == 0 ? sim.cfg.imageCrc32 : ~sim.cfg.imageCrc32 & 0xFFFFFFFFUL);
+            simUploadDone();
+        }
+        else
+        {
+            simV3SendDataRequest(0);
+        }
+    }
+}
+
+/* Decodes frames with the checksum used in protocol.c. */
+static void simFrameByte(unsigned char c)
+{
+    unsigned i;
+    unsigned short crc;
+
+    if (c == SIM_FR_END)
+    {
+        if (!sim.escaped && sim.framePos > 2)
+        {
+            crc = 0;
+            for (i = 0; i < sim.framePos - 2; i++)
+                crc += sim.frame[i];
+
+            crc = (unsigned short)(~crc + 1);
+            if (sim.frame[i] == (crc & 0xFF) && sim.frame[i + 1] == ((crc >> 8) & 0xFF))
+                simFrame(sim.frame, sim.framePos - 2);
+        }
+
+        sim.framePos = 0;
+        sim.escaped = 0;
+        return;
+    }
+
+    if (c == SIM_FR_ESC)
+    {
+        sim.escaped = 1;
+        sim.escapes++;
+        return;
+    }
+
+    if (sim.escaped)
+    {
+        sim.escaped = 0;
+        if      (c == SIM_T_FR_END) { c = SIM_FR_END; }
+        else if (c == SIM_T_FR_ESC) { c = SIM_FR_ESC; }
+        else    { sim.framePos = 0; return; }
+    }
+
+    if (sim.framePos < sizeof(sim.frame))
+        sim.frame[sim.framePos++] = c;
+}
+
+static void simV1SendGet(PL_time_t delay)
+{
+    char buf[7];
+    unsigned long page;
+
+    page = sim.offset / SIM_V1_PAGESIZE;
+
+    buf[0] = 'G';
+    buf[1] = 'E';
+    buf[2] = 'T';
+    buf[3] = (char)(page & 0xFF);
+    buf[4] = (char)((page >> 8) & 0xFF);
+    buf[5] = ';';
+    simQueueOut(delay, (unsigned char*)buf, 6, 0);
+}
+
+static void simV1Byte(unsigned char c)
+{
+    unsigned pageSize;
+
+    if (sim.state == SIM_V1_IDLE || sim.state == SIM_DONE)
+    {
+        sim.syncWord = ((sim.syncWord << 8) | c) & 0xFFFFFFFFUL;
+
+        if ((sim.syncWord & 0xFFFF) == 0x4944) /* "ID" */
+        {
+            simSendRaw(0, "\r\nBootloader V1 dry-run model, page size 256\r\n");
+        }
+        else if (sim.syncWord == 0x1A1CA9AEUL)
+        {
+            simSendRaw(0, "READY\r\n");
+            sim.state = SIM_V1_HEADER;
+            sim.headerPos = 0;
+        }
+    }
+    else if (sim.state == SIM_V1_HEADER)
+    {
+        sim.header[sim.headerPos++] = c;
+
+        if (sim.headerPos == sizeof(sim.header))
+        {
+            get_u32_le(&sim.header[0], &sim.size);
+            sim.state = SIM_V1_DATA;
+            sim.offset = 0;
+            sim.pageFill = 0;
+            sim.uploadStart = sim.now;
+            simV1SendGet(0);
+        }
+    }
+    else if (sim.state == SIM_V1_DATA)
+    {
+        simCompare(&c, sim.offset, 1);
+        sim.offset++;
+        sim.pageFill++;
+
+        pageSize = SIM_V1_PAGESIZE;
+        if (sim.size - (sim.offset - sim.pageFill) < pageSize)
+            pageSize = (unsigned)(sim.size - (sim.offset - sim.pageFill));
+
+        if (sim.pageFill == pageSize)
+        {
+            sim.pageFill = 0;
+
+            if (sim.offset >= sim.size)
+            {
+                simSendRaw(SIM_V1_VALIDATE_US, sim.mismatches == 0 ? "#VALID CRC\r\n" : "#INVALID CRC\r\n");
+                simUploadDone();
+            }
+            else
+            {
+                simV1SendGet(SIM_PAGE_WRITE_US);
+            }
+        }
+    }
+}
+
+static void simDeviceInput(const unsigned char *data, unsigned len)
+{
+    unsigned i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (sim.state == SIM_OFF)
+            return;
+
+        if (sim.state == SIM_APP || sim.cfg.bootloader == 3)
+            simFrameByte(data[i]);
+        else
+            simV1Byte(data[i]);
+    }
+}
+
+static void simResetDevice(void)
+{
+    sim.state = SIM_OFF;
+    sim.resetAt = 0;
+    sim.bootAt = sim.now + SIM_BOOT_US;
+    sim.framePos = 0;
+    sim.escaped = 0;
+    sim.syncWord = 0;
+
+    if (sim.cfg.hangupOnReset)
+    {
+        sim.presentAt = sim.now + SIM_ENUMERATE_US;
+        simQueueOut(0, 0, 0, 1);
+    }
+}
+
+static void simBoot(void)
+{
+    sim.bootAt = 0;
+    sim.state = sim.cfg.bootloader == 3 ? SIM_V3_IDLE : SIM_V1_IDLE;
+
+    /* ConBee I and RaspBee I bootloaders announce themselves after reset */
+    if (sim.state == SIM_V1_IDLE && !sim.cfg.hangupOnReset)
+        simSendRaw(0, "\r\nBootloader V1 dry-run model, page size 256\r\n");
+}
+
+void SIM_AdvanceTo(unsigned long long us)
+{
+    PL_time_t t;
+    SIM_InChunk *chunk;
+
+    for (;;)
+    {
+        /* earliest device event up to us */
+        t = us + 1;
+
+        if (sim.inRp != sim.inWp && sim.in[sim.inRp % SIM_IN_CHUNKS].at < t)
+            t = sim.in[sim.inRp % SIM_IN_CHUNKS].at;
+        if (sim.resetAt != 0 && sim.resetAt < t)
+            t = sim.resetAt;
+        if (sim.bootAt != 0 && sim.bootAt < t)
+            t = sim.bootAt;
+
+        if (t > us)
+            break;
+
+        if (t > sim.now)
+            sim.now = t;
+
+        if (sim.resetAt != 0 && sim.resetAt == t)
+        {
+            simResetDevice();
+        }
+        else if (sim.bootAt != 0 && sim.bootAt == t)
+        {
+            simBoot();
+        }
+        else
+        {
+            chunk = &sim.in[sim.inRp % SIM_IN_CHUNKS];
+            sim.inRp++;
+
+            /* a retry of the host starts over, the stalled upload is given up */
+            if ((sim.state == SIM_V1_HEADER || sim.state == SIM_V1_DATA || sim.state == SIM_V3_DATA) &&
+                chunk->at > sim.inAt + SIM_BTL_ABORT_US)
+            {
+                PL_Printf(DBG_DEBUG, "dry-run: bootloader dropped the stalled upload\n");
+                sim.state = sim.cfg.bootloader == 3 ? SIM_V3_IDLE : SIM_V1_IDLE;
+                sim.payloadDone += sim.offset; /* the payload sent so far stays on the wire counters */
+                sim.offset = 0;
+                sim.syncWord = 0;
+                sim.framePos = 0;
+                sim.escaped = 0;
+            }
+
+            sim.inAt = chunk->at;
+            simDeviceInput(chunk->data, chunk->len);
+        }
+    }
+
+    if (us > sim.now)
+        sim.now = us;
+}
+
+void SIM_Sleep(unsigned long ms)
+{
+    SIM_AdvanceTo(sim.now + (PL_time_t)ms * 1000);
+}
+
+int SIM_Connect(void)
+{
+    if (sim.now < sim.presentAt)
+        return -1;
+
+    sim.connected = 1;
+    return 0;
+}
+
+void SIM_Disconnect(void)
+{
+    sim.connected = 0;
+}
+
+int SIM_Reset(void)
+{
+    simResetDevice();
+    return 0;
+}
+
+/* Drops the bytes of a write which don't fit into the device receive buffer.
+
+   The bytes arrive evenly between \p start and \p end while the device
+   takes rxRate bytes per second out of the buffer. Once it's full only
+   every n-th byte fits, the others are lost.
+
+   \returns The number of bytes kept in \p data.
+ */
+static unsigned simRxBuffer(unsigned char *data, unsigned len, PL_time_t start, PL_time_t end)
+{
+    unsigned i;
+    unsigned kept;
+    unsigned long long cap;
+    unsigned long long drain;
+    unsigned long long arrive;
+
+    /* byte microseconds, one byte is 10^6 */
+    cap = (unsigned long long)sim.cfg.rxBufferSize * 1000000;
+
+    drain = (start - sim.rxLevelAt) * sim.cfg.rxRate;
+    sim.rxLevel = sim.rxLevel > drain ? sim.rxLevel - drain : 0;
+
+    drain = end > start ? (end - start) * sim.cfg.rxRate / len : 0; /* per byte */
+    arrive = 1000000;
+    kept = 0;
+
+    for (i = 0; i < len; i++)
+    {
+        sim.rxLevel = sim.rxLevel > drain ? sim.rxLevel - drain : 0;
+
+        if (sim.rxLevel + arrive <= cap)
+        {
+            sim.rxLevel += arrive;
+            data[kept++] = data[i];
+        }
+    }
+
+    sim.rxLevelAt = end;
+
+    if (kept != len)
+    {
+        sim.rxDropped += len - kept;
+        sim.rxOverruns++;
+        PL_Printf(DBG_DEBUG, "dry-run: device rx buffer overrun, %u of %u bytes lost\n", len - kept, len);
+    }
+
+    return kept;
+}
+
+void SIM_Write(const unsigned char *data, unsigned len)
+{
+    PL_time_t start;
+    SIM_InChunk *chunk;
+
+    if (len == 0)
+        return;
+
+    if (sim.devSpoke)
+    {
+        sim.roundTrips++;
+        sim.devSpoke = 0;
+    }
+
+    start = sim.now > sim.hostTxFree ? sim.now : sim.hostTxFree;
+    sim.hostTxFree = start + simLinkTime(len);
+    sim.hostBytes += len;
+
+    if (sim.inWp - sim.inRp == SIM_IN_CHUNKS || len > SIM_IN_CHUNK_SIZE)
+    {
+        PL_Printf(DBG_DEBUG, "dry-run: device input queue full\n");
+        return;
+    }
+
+    chunk = &sim.in[sim.inWp % SIM_IN_CHUNKS];
+    chunk->at = sim.hostTxFree + sim.cfg.rttUs / 2;
+    chunk->len = len;
+    U_memcpy(chunk->data, data, len);
+
+    if (sim.cfg.rxBufferSize != 0)
+    {
+        chunk->len = simRxBuffer(chunk->data, len, start, sim.hostTxFree);
+        if (chunk->len == 0)
+            return;
+    }
+
+    sim.inWp++;
+}
+
+unsigned SIM_Poll(unsigned char *buf, unsigned max, int *hangup)
+{
+    unsigned n;
+    SIM_OutChunk *chunk;
+
+    n = 0;
+    *hangup = 0;
+
+    for (; sim.outRp != sim.outWp;)
+    {
+        chunk = &sim.out[sim.outRp % SIM_OUT_CHUNKS];
+
+        if (chunk->at > sim.now || n + chunk->len > max)
+            break;
+
+        if (chunk->hangup)
+        {
+            if (n > 0)
+                break; /* deliver pending data first */
+
+            sim.outRp++;
+            *hangup = sim.connected;
+            break;
+        }
+
+        sim.outRp++;
+
+        if (sim.connected)
+        {
+            U_memcpy(&buf[n], chunk->data, chunk->len);
+            n += chunk->len;
+        }
+    }
+
+    if (n > 0)
+        sim.devSpoke = 1;
+
+    return n;
+}
+
+int SIM_NextEvent(unsigned long long *at)
+{
+    int ret;
+    PL_time_t t;
+
+    ret = 0;
+    t = 0;
+
+    if (sim.inRp != sim.inWp)
+    {
+        t = sim.in[sim.inRp % SIM_IN_CHUNKS].at;
+        ret = 1;
+    }
+
+    if (sim.outRp != sim.outWp && (!ret || sim.out[sim.outRp % SIM_OUT_CHUNKS].at < t))
+    {
+        t = sim.out[sim.outRp % SIM_OUT_CHUNKS].at;
+        ret = 1;
+    }
+
+    if (sim.resetAt != 0 && (!ret || sim.resetAt < t))
+    {
+        t = sim.resetAt;
+        ret = 1;
+    }
+
+    if (sim.bootAt != 0 && (!ret || sim.bootAt < t))
+    {
+        t = sim.bootAt;
+        ret = 1;
+    }
+
+    *at = t < sim.now ? sim.now : t;
+    return ret;
+}
+
+int SIM_Report(void)
+{
+    unsigned long i;
+    unsigned long special;
+    PL_time_t total;
+    PL_time_t upload;
+    unsigned long long payload;
+
+    special = 0;
+    for (i = 0; sim.cfg.image && i < sim.cfg.imageSize; i++)
+    {
+        if (sim.cfg.image[i] == SIM_FR_END || sim.cfg.image[i] == SIM_FR_ESC)
+            special++;
+    }
+
+    payload = sim.payloadDone;
+    if (sim.state != SIM_DONE)
+        payload += sim.offset;
+
+    PL_Printf(DBG_INFO, "\ndry-run: V%u bootloader, %lu baud, rtt %lu.%03lu ms\n",
+              sim.cfg.bootloader, sim.cfg.baudrate, sim.cfg.rttUs / 1000, sim.cfg.rttUs % 1000);
+
+    if (sim.cfg.image)
+    {
+        PL_Printf(DBG_INFO, "image: %lu bytes, escape density %.2f%% (%lu bytes 0xC0/0xDB)\n",
+                  sim.cfg.imageSize, sim.cfg.imageSize ? special * 100.0 / sim.cfg.imageSize : 0.0, special);
+    }
+    else
+    {
+        PL_Printf(DBG_INFO, "image: %lu bytes, verified by CRC-8\n", sim.cfg.imageSize);
+    }
+
+    PL_Printf(DBG_INFO, "wire host->device: %llu bytes (payload %llu, framing and escaping %.2f%%, %lu escapes)\n",
+              sim.hostBytes, payload, payload ? (sim.hostBytes - payload) * 100.0 / payload : 0.0, sim.escapes);
+
+    PL_Printf(DBG_INFO, "wire device->host: %llu bytes\n", sim.devBytes);
+    PL_Printf(DBG_INFO, "round trips: %lu\n", sim.roundTrips);
+
+    if (sim.cfg.rxBufferSize != 0)
+    {
+        PL_Printf(DBG_INFO, "device rx buffer: %u bytes at %lu bytes/s, %lu bytes lost in %lu writes\n",
+                  sim.cfg.rxBufferSize, sim.cfg.rxRate, sim.rxDropped, sim.rxOverruns);
+    }
+
+    if (sim.uploads > 1)
+        PL_Printf(DBG_INFO, "uploads: %u (image line shows the last one)\n", sim.uploads);
+
+    if (sim.state != SIM_DONE || sim.doneAt == 0)
+    {
+        PL_Printf(DBG_INFO, "result: upload not completed (%lu of %lu bytes)\n", sim.offset, sim.cfg.imageSize);
+        return -1;
+    }
+
+    total = sim.doneAt - sim.cfg.startTimeUs;
+    upload = sim.uploadUs;
+
+    PL_Printf(DBG_INFO, "predicted: upload %llu.%03llu s (%.1f kB/s), total %llu.%03llu s incl. reset and bootloader detection\n",
+              upload / 1000000, (upload / 1000) % 1000, upload ? payload * 1000.0 / upload : 0.0,
+              total / 1000000, (total / 1000) % 1000);
+
+    if (sim.mismatches != 0)
+    {
+        if (sim.cfg.image)
+            PL_Printf(DBG_INFO, "result: %lu bytes differ from image\n", sim.mismatches);
+        else
+            PL_Printf(DBG_INFO, "result: CRC-8 of the received image differs\n");
+        return -1;
+    }
+
+    PL_Printf(DBG_INFO, "result: image verified by bootloader model\n");
+    return 0;
+}
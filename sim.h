@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#ifndef GCFFLASHER_SIM_H
+#define GCFFLASHER_SIM_H
+
+/* In-memory device and bootloader model for --dry-run.
+
+   The platform layer routes connect, write, reset and time functions here
+   when SIM_Active() is true, and drives its main loop from a virtual clock
+   instead of waiting for file descriptors. This way the unmodified state
+   machine in gcf.c runs a complete upload in a few milliseconds.
+ */
+
+typedef struct
+{
+    unsigned bootloader;          /* 1 = V1 (ASCII pages), 3 = V3 (BTL_MAGIC frames) */
+    unsigned long baudrate;
+    unsigned long rttUs;          /* round trip time added on top of serialization */
+    int hangupOnReset;            /* USB CDC ACM devices drop off the bus when reset */
+    unsigned v3ChunkSize;         /* length of V3 data requests */
+    const unsigned char *image;   /* firmware data after the GCF header, 0 = verify by imageCrc8 */
+    unsigned long imageSize;
+    unsigned long imageCrc32;     /* app crc reported by V3 after a verified upload */
+    unsigned char imageCrc8;      /* GCF header checksum of the data */
+    unsigned long long startTimeUs; /* initial virtual time */
+    unsigned rxBufferSize;        /* device receive buffer in bytes, 0 = unlimited */
+    unsigned long rxRate;         /* bytes/s the device takes from the buffer, 0 = line rate */
+} SIM_Config;
+
+void SIM_Init(const SIM_Config *cfg);
+
+/*! Replaces the expected image for the next upload in the same bootloader session. */
+void SIM_SetImage(const unsigned char *image, unsigned long size, unsigned long crc32, unsigned char crc8);
+int SIM_Active(void);
+
+/*! Virtual time in microseconds. */
+unsigned long long SIM_TimeUs(void);
+void SIM_Sleep(unsigned long ms);
+
+/*! \returns 0 if the device is present, -1 while it's re-enumerating. */
+int SIM_Connect(void);
+void SIM_Disconnect(void);
+
+/*! Hardware reset via FTDI CBUS or GPIO, \returns 0. */
+int SIM_Reset(void);
+
+/*! Host to device data as it would be passed to write(). */
+void SIM_Write(const unsigned char *data, unsigned len);
+
+/*! Copies device to host data which arrived until the current virtual time.
+
+    \param hangup - set to 1 if the device dropped off the bus.
+    \returns Number of bytes placed in \p buf.
+ */
+unsigned SIM_Poll(unsigned char *buf, unsigned max, int *hangup);
+
+/*! Time of the next device or link event in microseconds.
+
+    \returns 1 if an event is pending, 0 otherwise.
+ */
+int SIM_NextEvent(unsigned long long *at);
+
+/*! Advances the virtual clock to \p us and runs device events up to then. */
+void SIM_AdvanceTo(unsigned long long us);
+
+/*! Prints wire statistics and the predicted upload time.
+
+    \returns 0 if the model verified the uploaded image, -1 otherwise.
+ */
+int SIM_Report(void);
+
+#endif /* GCFFLASHER_SIM_H */
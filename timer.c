@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#include "timer.h"
+
+#define TIMER_BITS 6 /* log2(TIMER_SLOTS) */
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_RANGE (1ULL << (TIMER_BITS * TIMER_LEVELS))
+
+#define TIMER_INDEX(handle) ((handle) & 0xFFFF)
+#define TIMER_GEN(handle)   (((handle) >> 16) & 0xFFFF)
+
+static unsigned timerCtz(unsigned long long x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+#else
+    unsigned n;
+
+    for (n = 0; (x & 1) == 0; n++)
+        x >>= 1;
+    return n;
+#endif
+}
+
+/* Bits of slots after \p idx. */
+static unsigned long long timerAbove(unsigned idx)
+{
+    return idx == TIMER_MASK ? 0 : (~0ULL << (idx + 1));
+}
+
+static void timerLink(TIMER_Wheel *wheel, unsigned short i)
+{
+    unsigned level;
+    unsigned slot;
+    unsigned long long delta;
+    unsigned long long pos;
+    TIMER_Entry *e;
+
+    e = &wheel->entries[i];
+    delta = e->expires - wheel->now;
+    pos = e->expires;
+
+    for (level = 0; level < TIMER_LEVELS - 1; level++)
+    {
+        if (delta < (1ULL << (TIMER_BITS * (level + 1))))
+            break;
+    }
+
+    if (delta >= TIMER_RANGE)
+        pos = wheel->now + TIMER_RANGE - 1; /* parked, re-inserted on cascade */
+
+    slot = (unsigned)(pos >> (TIMER_BITS * level)) & TIMER_MASK;
+
+    e->level = (unsigned char)level;
+    e->slot = (unsigned char)slot;
+    e->prev = 0;
+    e->next = wheel->slots[level][slot];
+
+    if (e->next)
+        wheel->entries[e->next].prev = i;
+
+    wheel->slots[level][slot] = i;
+    wheel->bitmap[level] |= 1ULL << slot;
+}
+
+static void timerUnlink(TIMER_Wheel *wheel, unsigned short i)
+{
+    TIMER_Entry *e;
+
+    e = &wheel->entries[i];
+
+    if (e->prev)
+        wheel->entries[e->prev].next = e->next;
+    else
+        wheel->slots[e->level][e->slot] = e->next;
+
+    if (e->next)
+        wheel->entries[e->next].prev = e->prev;
+
+    if (wheel->slots[e->level][e->slot] == 0)
+        wheel->bitmap[e->level] &= ~(1ULL << e->slot);
+}
+
+static void timerFree(TIMER_Wheel *wheel, unsigned short i)
+{
+    TIMER_Entry *e;
+
+    e = &wheel->entries[i];
+    e->level = TIMER_LEVELS;
+    e->gen = (unsigned short)(e->gen + 1);
+    if (e->gen == 0)
+        e->gen = 1;
+
+    e->next = wheel->freeList;
+    wheel->freeList = i;
+    wheel->count--;
+}
+
+void TIMER_Init(TIMER_Wheel *wheel, unsigned long long now)
+{
+    unsigned i;
+    unsigned level;
+
+    wheel->now = now;
+    wheel->count = 0;
+    wheel->freeList = 0;
+
+    for (level = 0; level < TIMER_LEVELS; level++)
+    {
+        wheel->bitmap[level] = 0;
+        for (i = 0; i < TIMER_SLOTS; i++)
+            wheel->slots[level][i] = 0;
+    }
+
+    for (i = TIMER_MAX_TIMERS; i > 0; i--)
+    {
+        wheel->entries[i].level = TIMER_LEVELS;
+        wheel->entries[i].gen = 1;
+        wheel->entries[i].next = wheel->freeList;
+        wheel->freeList = (unsigned short)i;
+    }
+}
+
+unsigned long TIMER_Start(TIMER_Wheel *wheel, unsigned long long expires, TIMER_Func fn, void *arg)
+{
+    unsigned short i;
+    TIMER_Entry *e;
+
+    i = wheel->freeList;
+    if (i == 0)
+        return 0;
+
+    e = &wheel->entries[i];
+    wheel->freeList = e->next;
+    wheel->count++;
+
+    /* the current tick is already processed */
+    e->expires = expires > wheel->now ? expires : wheel->now + 1;
+    e->fn = fn;
+    e->arg = arg;
+
+    timerLink(wheel, i);
+
+    return ((unsigned long)e->gen << 16) | i;
+}
+
+int TIMER_Stop(TIMER_Wheel *wheel, unsigned long handle)
+{
+    unsigned short i;
+    TIMER_Entry *e;
+
+    i = (unsigned short)TIMER_INDEX(handle);
+    if (i == 0 || i > TIMER_MAX_TIMERS)
+        return -1;
+
+    e = &wheel->entries[i];
+    if (e->level == TIMER_LEVELS || e->gen != TIMER_GEN(handle))
+        return -1;
+
+    timerUnlink(wheel, i);
+    timerFree(wheel, i);
+
+    return 0;
+}
+
+/* Earliest tick after wheel->now which has timers to fire or to cascade. */
+static unsigned long long timerNextTick(const TIMER_Wheel *wheel)
+{
+    unsigned level;
+    unsigned shift;
+    unsigned idx;
+    unsigned long long bits;
+    unsigned long long tick;
+    unsigned long long best;
+
+    best = ~0ULL;
+
+    for (level = 0; level < TIMER_LEVELS; level++)
+    {
+        if (wheel->bitmap[level] == 0)
+            continue;
+
+        shift = TIMER_BITS * level;
+        idx = (unsigned)(wheel->now >> shift) & TIMER_MASK;
+        bits = wheel->bitmap[level] & timerAbove(idx);
+
+        if (bits)
+        {
+            /* slot in the current rotation */
+            tick = ((wheel->now >> shift) & ~(unsigned long long)TIMER_MASK) | timerCtz(bits);
+            tick <<= shift;
+        }
+        else
+        {
+            /* slot in the next rotation, continue from its start */
+            tick = ((wheel->now >> (shift + TIMER_BITS)) + 1) << (shift + TIMER_BITS);
+        }
+
+        if (tick < best)
+            best = tick;
+    }
+
+    return best;
+}
+
+static void timerCascade(TIMER_Wheel *wheel, unsigned level, unsigned slot)
+{
+    unsigned short i;
+    unsigned short next;
+
+    i = wheel->slots[level][slot];
+    wheel->slots[level][slot] = 0;
+    wheel->bitmap[level] &= ~(1ULL << slot);
+
+    for (; i; i = next)
+    {
+        next = wheel->entries[i].next;
+        timerLink(wheel, i); /* expires >= now, lands in a lower level */
+    }
+}
+
+void TIMER_Advance(TIMER_Wheel *wheel, unsigned long long now)
+{
+    unsigned level;
+    unsigned slot;
+    unsigned short i;
+    unsigned long long tick;
+    TIMER_Entry *e;
+
+    while (wheel->count > 0)
+    {
+        tick = timerNextTick(wheel);
+        if (tick > now)
+            break;
+
+        wheel->now = tick;
+
+        for (level = TIMER_LEVELS - 1; level > 0; level--)
+        {
+            if ((tick & ((1ULL << (TIMER_BITS * level)) - 1)) == 0)
+            {
+                slot = (unsigned)(tick >> (TIMER_BITS * level)) & TIMER_MASK;
+                if (wheel->slots[level][slot])
+                    timerCascade(wheel, level, slot);
+            }
+        }
+
+        slot = (unsigned)tick & TIMER_MASK;
+
+        /* callbacks may start and stop timers, always take the list head */
+        while ((i = wheel->slots[0][slot]) != 0)
+        {
+            TIMER_Func fn;
+            void *arg;
+
+            e = &wheel->entries[i];
+            fn = e->fn;
+            arg = e->arg;
+
+            timerUnlink(wheel, i);
+            timerFree(wheel, i);
+
+            fn(arg);
+        }
+    }
+
+    if (now > wheel->now)
+        wheel->now = now;
+}
+
+int TIMER_NextExpiry(const TIMER_Wheel *wheel, unsigned long long *at)
+{
+    unsigned level;
+    unsigned slot;
+    unsigned idx;
+    unsigned short i;
+    unsigned long long bits;
+    unsigned long long best;
+
+    if (wheel->count == 0)
+        return 0;
+
+    best = ~0ULL;
+
+    /* per level the first non-empty slot after the current one holds the
+       earliest timers of that level, the slots are ordered in time */
+    for (level = 0; level < TIMER_LEVELS; level++)
+    {
+        if (wheel->bitmap[level] == 0)
+            continue;
+
+        idx = (unsigned)(wheel->now >> (TIMER_BITS * level)) & TIMER_MASK;
+        bits = wheel->bitmap[level] & timerAbove(idx);
+        if (bits == 0)
+            bits = wheel->bitmap[level];
+
+        slot = timerCtz(bits);
+
+        for (i = wheel->slots[level][slot]; i; i = wheel->entries[i].next)
+        {
+            if (wheel->entries[i].expires < best)
+                best = wheel->entries[i].expires;
+        }
+    }
+
+    *at = best;
+    return 1;
+}
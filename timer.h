@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#ifndef GCFFLASHER_TIMER_H
+#define GCFFLASHER_TIMER_H
+
+/* Hierarchical timing wheel with microsecond ticks.
+
+   5 levels of 64 slots cover 2^30 us (~18 minutes), timers further away
+   are parked in the last level and re-inserted when it cascades.
+   Start and stop are O(1), a bitmap per level lets TIMER_Advance() and
+   TIMER_NextExpiry() skip empty slots, so idle time costs nothing.
+
+   Timers are referenced by handles which contain a generation counter,
+   stopping an already fired or reused timer is a harmless no-op.
+ */
+
+#define TIMER_LEVELS     5
+#define TIMER_SLOTS      64
+#define TIMER_MAX_TIMERS 4096
+
+typedef void (*TIMER_Func)(void *arg);
+
+typedef struct
+{
+    unsigned long long expires;
+    TIMER_Func fn;
+    void *arg;
+    unsigned short next; /* entry index, 0 = end of list */
+    unsigned short prev;
+    unsigned short gen;
+    unsigned char level; /* TIMER_LEVELS = free */
+    unsigned char slot;
+} TIMER_Entry;
+
+typedef struct
+{
+    unsigned long long now; /* last processed tick */
+    unsigned long long bitmap[TIMER_LEVELS];
+    unsigned short slots[TIMER_LEVELS][TIMER_SLOTS];
+    unsigned short freeList;
+    unsigned count;
+    TIMER_Entry entries[TIMER_MAX_TIMERS + 1]; /* [0] is unused */
+} TIMER_Wheel;
+
+void TIMER_Init(TIMER_Wheel *wheel, unsigned long long now);
+
+/*! Starts a one-shot timer which calls \p fn(arg) at time \p expires.
+
+    \returns A non zero handle, or 0 if all timers are in use.
+ */
+unsigned long TIMER_Start(TIMER_Wheel *wheel, unsigned long long expires, TIMER_Func fn, void *arg);
+
+/*! \returns 0 if the timer was stopped, -1 if it wasn't pending. */
+int TIMER_Stop(TIMER_Wheel *wheel, unsigned long handle);
+
+/*! Fires all timers which expired up to time \p now. */
+void TIMER_Advance(TIMER_Wheel *wheel, unsigned long long now);
+
+/*! \returns 1 and the earliest expiry in \p at, or 0 if no timer is pending. */
+int TIMER_NextExpiry(const TIMER_Wheel *wheel, unsigned long long *at);
+
+#endif /* GCFFLASHER_TIMER_H */
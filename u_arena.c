@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#include "u_arena.h"
+
+void U_arena_init(U_Arena *arena, void *data, unsigned long size)
+{
+    unsigned long skip;
+
+    /* align the start, the block may come from a plain byte array */
+    skip = (U_ARENA_ALIGN - ((unsigned long)data & (U_ARENA_ALIGN - 1))) & (U_ARENA_ALIGN - 1);
+    if (skip > size)
+        skip = size;
+
+    arena->data = (unsigned char*)data + skip;
+    arena->size = size - skip;
+    arena->pos = 0;
+    arena->peak = 0;
+}
+
+void *U_arena_reserve(U_Arena *arena, unsigned long *avail)
+{
+    *avail = arena->size - arena->pos;
+    return &arena->data[arena->pos];
+}
+
+void U_arena_commit(U_Arena *arena, unsigned long size)
+{
+    size = (size + U_ARENA_ALIGN - 1) & ~(unsigned long)(U_ARENA_ALIGN - 1);
+
+    if (size > arena->size - arena->pos)
+        size = arena->size - arena->pos;
+
+    arena->pos += size;
+    if (arena->pos > arena->peak)
+        arena->peak = arena->pos;
+}
+
+void *U_arena_alloc(U_Arena *arena, unsigned long size)
+{
+    unsigned long avail;
+    void *mem;
+
+    mem = U_arena_reserve(arena, &avail);
+    if (size > avail)
+        return 0;
+
+    U_arena_commit(arena, size);
+    return mem;
+}
+
+unsigned long U_arena_mark(const U_Arena *arena)
+{
+    return arena->pos;
+}
+
+void U_arena_release(U_Arena *arena, unsigned long mark)
+{
+    if (mark < arena->pos)
+        arena->pos = mark;
+}
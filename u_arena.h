@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#ifndef U_ARENA_H
+#define U_ARENA_H
+
+/* Bump allocator over a caller provided memory block.
+
+   Allocations are aligned to cache lines and live until U_arena_release()
+   drops everything after a mark. Pages of the block which are never handed
+   out are never touched.
+ */
+
+#define U_ARENA_ALIGN 64
+
+typedef struct U_Arena
+{
+    unsigned char *data;
+    unsigned long pos;
+    unsigned long size;
+    unsigned long peak; /* highest pos seen */
+} U_Arena;
+
+void U_arena_init(U_Arena *arena, void *data, unsigned long size);
+
+/*! \returns \p size bytes of uninitialised memory, or 0 if the arena is exhausted. */
+void *U_arena_alloc(U_Arena *arena, unsigned long size);
+
+/*! Variable sized allocation, e.g. a file read, in two steps.
+
+    \returns The free memory, its size is placed in \p avail.
+             U_arena_commit() then takes the actually used part.
+ */
+void *U_arena_reserve(U_Arena *arena, unsigned long *avail);
+void U_arena_commit(U_Arena *arena, unsigned long size);
+
+unsigned long U_arena_mark(const U_Arena *arena);
+
+/*! Frees all allocations made after U_arena_mark() returned \p mark. */
+void U_arena_release(U_Arena *arena, unsigned long mark);
+
+#endif /* U_ARENA_H */
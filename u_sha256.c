@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#include "u_sha256.h"
+
+#define ROR32(x, n) ((((x) >> (n)) | ((x) << (32 - (n)))) & 0xFFFFFFFFUL)
+
+static const unsigned long sha256_k[64] =
+{
+    0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL, 0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
+    0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL, 0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
+    0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL, 0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
+    0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL, 0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
+    0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL, 0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+    0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL, 0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
+    0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL, 0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
+    0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL, 0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
+};
+
+static void sha256_block(U_Sha256 *sha, const unsigned char *p)
+{
+    unsigned i;
+    unsigned long t1;
+    unsigned long t2;
+    unsigned long w[64];
+    unsigned long a, b, c, d, e, f, g, h;
+
+    for (i = 0; i < 16; i++, p += 4)
+    {
+        w[i] = ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+               ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+    }
+
+    for (i = 16; i < 64; i++)
+    {
+        t1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        t2 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        w[i] = (t1 + w[i - 7] + t2 + w[i - 16]) & 0xFFFFFFFFUL;
+    }
+
+    a = sha->state[0]; b = sha->state[1]; c = sha->state[2]; d = sha->state[3];
+    e = sha->state[4]; f = sha->state[5]; g = sha->state[6]; h = sha->state[7];
+
+    for (i = 0; i < 64; i++)
+    {
+        t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = (d + t1) & 0xFFFFFFFFUL;
+        d = c;
+        c = b;
+        b = a;
+        a = (t1 + t2) & 0xFFFFFFFFUL;
+    }
+
+    sha->state[0] = (sha->state[0] + a) & 0xFFFFFFFFUL;
+    sha->state[1] = (sha->state[1] + b) & 0xFFFFFFFFUL;
+    sha->state[2] = (sha->state[2] + c) & 0xFFFFFFFFUL;
+    sha->state[3] = (sha->state[3] + d) & 0xFFFFFFFFUL;
+    sha->state[4] = (sha->state[4] + e) & 0xFFFFFFFFUL;
+    sha->state[5] = (sha->state[5] + f) & 0xFFFFFFFFUL;
+    sha->state[6] = (sha->state[6] + g) & 0xFFFFFFFFUL;
+    sha->state[7] = (sha->state[7] + h) & 0xFFFFFFFFUL;
+}
+
+void U_sha256_init(U_Sha256 *sha)
+{
+    sha->state[0] = 0x6a09e667UL;
+    sha->state[1] = 0xbb67ae85UL;
+    sha->state[2] = 0x3c6ef372UL;
+    sha->state[3] = 0xa54ff53aUL;
+    sha->state[4] = 0x510e527fUL;
+    sha->state[5] = 0x9b05688cUL;
+    sha->state[6] = 0x1f83d9abUL;
+    sha->state[7] = 0x5be0cd19UL;
+    sha->length = 0;
+    sha->fill = 0;
+}
+
+void U_sha256_update(U_Sha256 *sha, const void *data, unsigned long len)
+{
+    const unsigned char *p;
+
+    p = (const unsigned char*)data;
+    sha->length += len;
+
+    for (;len;)
+    {
+        if (sha->fill == 0 && len >= 64)
+        {
+            /* full blocks directly from input */
+            sha256_block(sha, p);
+            p += 64;
+            len -= 64;
+            continue;
+        }
+
+        sha->block[sha->fill++] = *p++;
+        len--;
+
+        if (sha->fill == 64)
+        {
+            sha256_block(sha, sha->block);
+            sha->fill = 0;
+        }
+    }
+}
+
+void U_sha256_final(U_Sha256 *sha, unsigned char digest[U_SHA256_DIGEST_SIZE])
+{
+    unsigned i;
+    unsigned long long bits;
+
+    bits = sha->length * 8;
+
+    sha->block[sha->fill++] = 0x80;
+
+    if (sha->fill > 56)
+    {
+        for (; sha->fill < 64; sha->fill++)
+            sha->block[sha->fill] = 0;
+
+        sha256_block(sha, sha->block);
+        sha->fill = 0;
+    }
+
+    for (; sha->fill < 56; sha->fill++)
+        sha->block[sha->fill] = 0;
+
+    for (i = 0; i < 8; i++)
+        sha->block[56 + i] = (unsigned char)(bits >> (56 - i * 8));
+
+    sha256_block(sha, sha->block);
+
+    for (i = 0; i < 8; i++)
+    {
+        digest[i * 4 + 0] = (unsigned char)(sha->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(sha->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(sha->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)(sha->state[i]);
+    }
+}
+
+void U_sha256_hex(const unsigned char digest[U_SHA256_DIGEST_SIZE], char *hex)
+{
+    unsigned i;
+    static const char lut[16] = {
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+    };
+
+    for (i = 0; i < U_SHA256_DIGEST_SIZE; i++)
+    {
+        hex[i * 2] = lut[(digest[i] >> 4) & 0xF];
+        hex[i * 2 + 1] = lut[digest[i] & 0xF];
+    }
+
+    hex[U_SHA256_DIGEST_SIZE * 2] = '\0';
+}
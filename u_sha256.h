@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2024 dresden elektronik ingenieurtechnik gmbh.
+ * All rights reserved.
+ *
+ * The software in this package is published under the terms of the BSD
+ * style license a copy of which has been included with this distribution in
+ * the LICENSE.txt file.
+ *
+ */
+
+#ifndef U_SHA256_H
+#define U_SHA256_H
+
+/* ANSI C SHA-256 (FIPS 180-4), standalone without using libc. */
+
+#define U_SHA256_DIGEST_SIZE 32
+
+typedef struct U_Sha256
+{
+    unsigned long state[8];
+    unsigned long long length; /* total bytes */
+    unsigned fill;
+    unsigned char block[64];
+} U_Sha256;
+
+void U_sha256_init(U_Sha256 *sha);
+void U_sha256_update(U_Sha256 *sha, const void *data, unsigned long len);
+void U_sha256_final(U_Sha256 *sha, unsigned char digest[U_SHA256_DIGEST_SIZE]);
+
+/*! Writes the lower case hex string of \p digest to \p hex (65 bytes incl. '\0'). */
+void U_sha256_hex(const unsigned char digest[U_SHA256_DIGEST_SIZE], char *hex);
+
+#endif /* U_SHA256_H */
@@ -234,144 +234,130 @@ void U_sstream_put_str(U_SStream *ss, const char *str)
     }
 }
 
-/*  Outputs the signed 32/64-bit integer 'num' as ASCII string.
-
-    The range is different on 32-bit systems and Windows
-    and 64-bit systems.
-
-    -2147483648 .. 2147483647
-    -9223372036854775807 .. 9223372036854775807
-
-    \param num signed number
-*/
-void U_sstream_put_long(U_SStream *ss, long num)
+/* "00" "01" .. "99", two digits per division */
+static const char uss_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void uss_put_buf(U_SStream *ss, const char *buf, unsigned len)
 {
-    int i;
-    int pos;
-    int remainder;
-    long int n;
-    unsigned char buf[24];
-
     if (ss->status != U_SSTREAM_OK)
         return;
 
-    /* sign + max digits + NUL := 21 bytes on 64-bit */
-
-    n = num;
-    if (n < 0)
-        ss->str[ss->pos++] = '-';
-
-    pos = 0;
-    do
-    {
-        remainder = n % 10;
-        remainder = remainder < 0 ? -remainder : remainder;
-        n = n / 10;
-        buf[pos++] = '0' + remainder;
-    }
-    while (n);
-
-    if (ss->len - ss->pos < (unsigned)pos + 1) /* not enough space */
+    if (ss->len - ss->pos < len + 1) /* not enough space */
     {
         ss->status = U_SSTREAM_ERR_NO_SPACE;
         return;
     }
 
-    for (i = pos; i > 0; i--) /* reverse copy */
-    {
-        ss->str[ss->pos++] = buf[i - 1];
-    }
+    for (; len; len--, buf++)
+        ss->str[ss->pos++] = *buf;
 
     ss->str[ss->pos] = '\0';
 }
 
-/*  Outputs the signed 64-bit integer 'num' as ASCII string.
+/*  Writes the digits of 'num' backwards ending at 'end'.
 
-    -9223372036854775807 .. 9223372036854775807
-
-    \param num signed number
+    \returns pointer to the first digit.
 */
-void U_sstream_put_longlong(U_SStream *ss, long long num)
+static char *uss_format_u64(char *end, unsigned long long num)
 {
-    int i;
-    int pos;
-    int remainder;
-    long long n;
-    unsigned char buf[24];
-
-    if (ss->status != U_SSTREAM_OK)
-        return;
-
-    /* sign + max digits + NUL := 21 bytes on 64-bit */
-
-    n = num;
-    if (n < 0)
-        ss->str[ss->pos++] = '-';
+    unsigned i;
+    unsigned long n32;
 
-    pos = 0;
-    do
+    /* 64-bit divisions are slow on 32-bit targets, switch over early */
+    while (num > 0xFFFFFFFFULL)
     {
-        remainder = n % 10;
-        remainder = remainder < 0 ? -remainder : remainder;
-        n = n / 10;
-        buf[pos++] = '0' + remainder;
+        i = (unsigned)(num % 100) * 2;
+        num /= 100;
+        *--end = uss_digit_pairs[i + 1];
+        *--end = uss_digit_pairs[i];
     }
-    while (n);
 
-    if (ss->len - ss->pos < (unsigned)pos + 1) /* not enough space */
+    n32 = (unsigned long)num;
+    while (n32 >= 100)
     {
-        ss->status = U_SSTREAM_ERR_NO_SPACE;
-        return;
+        i = (unsigned)(n32 % 100) * 2;
+        n32 /= 100;
+        *--end = uss_digit_pairs[i + 1];
+        *--end = uss_digit_pairs[i];
     }
 
-    for (i = pos; i > 0; i--) /* reverse copy */
+    if (n32 >= 10)
     {
-        ss->str[ss->pos++] = buf[i - 1];
+        i = (unsigned)n32 * 2;
+        *--end = uss_digit_pairs[i + 1];
+        *--end = uss_digit_pairs[i];
+    }
+    else
+    {
+        *--end = (char)('0' + n32);
     }
 
-    ss->str[ss->pos] = '\0';
+    return end;
 }
 
-/*  Outputs the unsigned 64-bit integer 'num' as ASCII string.
+static void uss_put_integer(U_SStream *ss, unsigned long long num, int negative)
+{
+    char buf[24]; /* sign + 20 digits */
+    char *p;
 
-    0 .. 18446744073709551615
+    p = uss_format_u64(&buf[sizeof(buf)], num);
+    if (negative)
+        *--p = '-';
 
-    \param num unsigned number
+    uss_put_buf(ss, p, (unsigned)(&buf[sizeof(buf)] - p));
+}
+
+/*  Outputs the signed 32/64-bit integer 'num' as ASCII string.
+
+    The range is different on 32-bit systems and Windows
+    and 64-bit systems.
+
+    -2147483648 .. 2147483647
+    -9223372036854775807 .. 9223372036854775807
+
+    \param num signed number
 */
-void U_sstream_put_ulonglong(U_SStream *ss, unsigned long long num)
+void U_sstream_put_long(U_SStream *ss, long num)
 {
-    int i;
-    int pos;
-    int remainder;
-    unsigned char buf[24];
-
-    if (ss->status != U_SSTREAM_OK)
-        return;
+    if (num < 0)
+        uss_put_integer(ss, 0ULL - (unsigned long long)num, 1);
+    else
+        uss_put_integer(ss, (unsigned long long)num, 0);
+}
 
-    /* max digits + NUL := 21 bytes on 64-bit */
+/*  Outputs the signed 64-bit integer 'num' as ASCII string.
 
+    -9223372036854775807 .. 9223372036854775807
 
-    pos = 0;
-    do
-    {
-        remainder = num % 10;
-        num = num / 10;
-        buf[pos++] = '0' + remainder;
-    }
-    while (num);
+    \param num signed number
+*/
+void U_sstream_put_longlong(U_SStream *ss, long long num)
+{
+    if (num < 0)
+        uss_put_integer(ss, 0ULL - (unsigned long long)num, 1);
+    else
+        uss_put_integer(ss, (unsigned long long)num, 0);
+}
 
-    if (ss->len - ss->pos < (unsigned)pos + 1) /* not enough space */
-    {
-        ss->status = U_SSTREAM_ERR_NO_SPACE;
-        return;
-    }
+/*  Outputs the unsigned 64-bit integer 'num' as ASCII string.
 
-    for (i = pos; i > 0; i--) /* reverse copy */
-    {
-        ss->str[ss->pos++] = buf[i - 1];
-    }
+    0 .. 18446744073709551615
 
-    ss->str[ss->pos] = '\0';
+    \param num unsigned number
+*/
+void U_sstream_put_ulonglong(U_SStream *ss, unsigned long long num)
+{
+    uss_put_integer(ss, num, 0);
 }
 
 union u64f
@@ -418,71 +404,368 @@ static int uss_is_infinity(double x)
 }
 
 /*
- * Code adapted from musl libc modf implementation.
- * https://steve.hollasch.net/cgindex/coding/ieeefloat.html
+ * Shortest digits of a double, Grisu2 algorithm from
+ * Florian Loitsch "Printing Floating-Point Numbers Quickly and
+ * Accurately with Integers" (PLDI 2010).
  *
- * Sign    Exponent      Mantissa
- * 1 [63]  11 [62-52]    52 [51-0]
- * S       EEEEEEE EEEE  FFFF FFFFFFFF FFFFFFFF FFFFFFFF FFFFFFFF FFFFFFFF FFFFFFFF
+ * The output always reads back to the same double, in rare cases
+ * the last digit isn't the closest one or one digit more is used.
  */
-static double uss_modf(double x, double *iptr)
+
+typedef struct
 {
+    unsigned long long f;
     int e;
+} uss_diyfp;
+
+/* 10^k as normalized 64-bit significand and binary exponent, k = -348, -340, .. 340 */
+static const unsigned long long uss_cached_pow_f[87] = {
+    0xFA8FD5A0081C0288ULL, 0xBAAEE17FA23EBF76ULL, 0x8B16FB203055AC76ULL,
+    0xCF42894A5DCE35EAULL, 0x9A6BB0AA55653B2DULL, 0xE61ACF033D1A45DFULL,
+    0xAB70FE17C79AC6CAULL, 0xFF77B1FCBEBCDC4FULL, 0xBE5691EF416BD60CULL,
+    0x8DD01FAD907FFC3CULL, 0xD3515C2831559A83ULL, 0x9D71AC8FADA6C9B5ULL,
+    0xEA9C227723EE8BCBULL, 0xAECC49914078536DULL, 0x823C12795DB6CE57ULL,
+    0xC21094364DFB5637ULL, 0x9096EA6F3848984FULL, 0xD77485CB25823AC7ULL,
+    0xA086CFCD97BF97F4ULL, 0xEF340A98172AACE5ULL, 0xB23867FB2A35B28EULL,
+    0x84C8D4DFD2C63F3BULL, 0xC5DD44271AD3CDBAULL, 0x936B9FCEBB25C996ULL,
+    0xDBAC6C247D62A584ULL, 0xA3AB66580D5FDAF6ULL, 0xF3E2F893DEC3F126ULL,
+    0xB5B5ADA8AAFF80B8ULL, 0x87625F056C7C4A8BULL, 0xC9BCFF6034C13053ULL,
+    0x964E858C91BA2655ULL, 0xDFF9772470297EBDULL, 0xA6DFBD9FB8E5B88FULL,
+    0xF8A95FCF88747D94ULL, 0xB94470938FA89BCFULL, 0x8A08F0F8BF0F156BULL,
+    0xCDB02555653131B6ULL, 0x993FE2C6D07B7FACULL, 0xE45C10C42A2B3B06ULL,
+    0xAA242499697392D3ULL, 0xFD87B5F28300CA0EULL, 0xBCE5086492111AEBULL,
+    0x8CBCCC096F5088CCULL, 0xD1B71758E219652CULL, 0x9C40000000000000ULL,
+    0xE8D4A51000000000ULL, 0xAD78EBC5AC620000ULL, 0x813F3978F8940984ULL,
+    0xC097CE7BC90715B3ULL, 0x8F7E32CE7BEA5C70ULL, 0xD5D238A4ABE98068ULL,
+    0x9F4F2726179A2245ULL, 0xED63A231D4C4FB27ULL, 0xB0DE65388CC8ADA8ULL,
+    0x83C7088E1AAB65DBULL, 0xC45D1DF942711D9AULL, 0x924D692CA61BE758ULL,
+    0xDA01EE641A708DEAULL, 0xA26DA3999AEF774AULL, 0xF209787BB47D6B85ULL,
+    0xB454E4A179DD1877ULL, 0x865B86925B9BC5C2ULL, 0xC83553C5C8965D3DULL,
+    0x952AB45CFA97A0B3ULL, 0xDE469FBD99A05FE3ULL, 0xA59BC234DB398C25ULL,
+    0xF6C69A72A3989F5CULL, 0xB7DCBF5354E9BECEULL, 0x88FCF317F22241E2ULL,
+    0xCC20CE9BD35C78A5ULL, 0x98165AF37B2153DFULL, 0xE2A0B5DC971F303AULL,
+    0xA8D9D1535CE3B396ULL, 0xFB9B7CD9A4A7443CULL, 0xBB764C4CA7A44410ULL,
+    0x8BAB8EEFB6409C1AULL, 0xD01FEF10A657842CULL, 0x9B10A4E5E9913129ULL,
+    0xE7109BFBA19C0C9DULL, 0xAC2820D9623BF429ULL, 0x80444B5E7AA7CF85ULL,
+    0xBF21E44003ACDD2DULL, 0x8E679C2F5E44FF8FULL, 0xD433179D9C8CB841ULL,
+    0x9E19DB92B4E31BA9ULL, 0xEB96BF6EBADF77D9ULL, 0xAF87023B9BF0EE6BULL
+};
+
+static const short uss_cached_pow_e[87] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const unsigned long uss_pow10_32[10] = {
+    1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL, 100000000UL, 1000000000UL
+};
+
+static const unsigned long long uss_pow10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+#define USS_DP_HIDDEN_BIT 0x0010000000000000ULL
+#define USS_DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+
+static uss_diyfp uss_diyfp_mul(uss_diyfp x, uss_diyfp y)
+{
+    uss_diyfp r;
+    unsigned long long a, b, c, d;
+    unsigned long long ac, bc, ad, bd, tmp;
+
+    a = x.f >> 32;
+    b = x.f & 0xFFFFFFFFULL;
+    c = y.f >> 32;
+    d = y.f & 0xFFFFFFFFULL;
+
+    ac = a * c;
+    bc = b * c;
+    ad = a * d;
+    bd = b * d;
+
+    tmp = (bd >> 32) + (ad & 0xFFFFFFFFULL) + (bc & 0xFFFFFFFFULL);
+    tmp += 1ULL << 31; /* round */
+
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static uss_diyfp uss_diyfp_normalize(uss_diyfp x)
+{
+    while ((x.f & (1ULL << 63)) == 0)
+    {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static void uss_grisu_round(char *buf, int len, unsigned long long delta, unsigned long long rest,
+                            unsigned long long ten_kappa, unsigned long long wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int uss_count_digits32(unsigned long n)
+{
+    int k;
+
+    for (k = 1; k < 10 && n >= uss_pow10_32[k]; k++)
+        ;
+    return k;
+}
+
+/*  Generates the digits of the positive, finite, non zero double 'x'.
+
+    x = buf[0..len) * 10^k
+
+    \returns number of digits in 'buf' (max. 17).
+*/
+static int uss_grisu2(double x, char *buf, int *k)
+{
+    int i;
+    int q;
+    int len;
+    int kappa;
+    unsigned d;
+    unsigned long p1;
+    unsigned long long p2;
+    unsigned long long delta;
+    unsigned long long one_mask;
+    double dk;
     union u64f u;
-    unsigned long long mask;
+    uss_diyfp v, w, wp, wm, c_mk, one;
 
-    u.i = 0; /* if unsigned long long becomes > 64-bit some day */
+    u.i = 0;
     u.f = x;
-    /*
-     * get 11-bit exponent, cut off sign bit
-     */
-    e = (int)(u.i >> 52 & 0x7ff);
-    e -= 1023; /* substract bias */
 
-    /* no fractional part */
-    /*
-     * exponent range 2..2^52
-     */
-    if (e >= 52)
+    v.f = u.i & USS_DP_SIGNIFICAND_MASK;
+    v.e = (int)(u.i >> 52 & 0x7ff);
+    if (v.e)
+    {
+        v.f += USS_DP_HIDDEN_BIT;
+        v.e -= 1075;
+    }
+    else
+    {
+        v.e = -1074; /* subnormal */
+    }
+
+    /* boundaries m+ and m- halfway to the neighbouring doubles */
+    wp.f = (v.f << 1) + 1;
+    wp.e = v.e - 1;
+    while ((wp.f & (USS_DP_HIDDEN_BIT << 1)) == 0)
+    {
+        wp.f <<= 1;
+        wp.e--;
+    }
+    wp.f <<= 10;
+    wp.e -= 10;
+
+    if (v.f == USS_DP_HIDDEN_BIT)
+    {
+        wm.f = (v.f << 2) - 1;
+        wm.e = v.e - 2;
+    }
+    else
+    {
+        wm.f = (v.f << 1) - 1;
+        wm.e = v.e - 1;
+    }
+    wm.f <<= wm.e - wp.e;
+    wm.e = wp.e;
+
+    /* cached power which brings the exponent into [-60, -32] */
+    dk = (-61 - wp.e) * 0.30102999566398114 + 347;
+    q = (int)dk;
+    if (dk - q > 0.0)
+        q++;
+    i = (q >> 3) + 1;
+    *k = -(-348 + i * 8);
+    c_mk.f = uss_cached_pow_f[i];
+    c_mk.e = uss_cached_pow_e[i];
+
+    w = uss_diyfp_mul(uss_diyfp_normalize(v), c_mk);
+    wp = uss_diyfp_mul(wp, c_mk);
+    wm = uss_diyfp_mul(wm, c_mk);
+    wm.f++;
+    wp.f--;
+
+    delta = wp.f - wm.f;
+    one.e = wp.e;
+    one.f = 1ULL << -one.e;
+    one_mask = one.f - 1;
+
+    p1 = (unsigned long)(wp.f >> -one.e);
+    p2 = wp.f & one_mask;
+    kappa = uss_count_digits32(p1);
+    len = 0;
+
+    while (kappa > 0)
+    {
+        d = (unsigned)(p1 / uss_pow10_32[kappa - 1]);
+        p1 = p1 % uss_pow10_32[kappa - 1];
+        if (d || len)
+            buf[len++] = (char)('0' + d);
+        kappa--;
+
+        if ((((unsigned long long)p1 << -one.e) + p2) <= delta)
+        {
+            *k += kappa;
+            uss_grisu_round(buf, len, delta, ((unsigned long long)p1 << -one.e) + p2,
+                            uss_pow10[kappa] << -one.e, wp.f - w.f);
+            return len;
+        }
+    }
+
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        d = (unsigned)(p2 >> -one.e);
+        if (d || len)
+            buf[len++] = (char)('0' + d);
+        p2 &= one_mask;
+        kappa--;
+
+        if (p2 < delta)
+        {
+            *k += kappa;
+            uss_grisu_round(buf, len, delta, p2, one.f,
+                            (wp.f - w.f) * (-kappa < 20 ? uss_pow10[-kappa] : 0));
+            return len;
+        }
+    }
+}
+
+/* Unsigned integer of up to 256 bits, 32-bit limbs, least significant first. */
+typedef struct
+{
+    unsigned long limb[8];
+    int n;
+} uss_bignum;
+
+static void uss_big_set(uss_bignum *b, unsigned long long v)
+{
+    b->n = 0;
+    for (; v; v >>= 32)
+        b->limb[b->n++] = (unsigned long)(v & 0xFFFFFFFFULL);
+}
+
+static void uss_big_mul(uss_bignum *b, unsigned long m)
+{
+    int i;
+    unsigned long long t;
+
+    t = 0;
+    for (i = 0; i < b->n; i++)
     {
-        *iptr = x;
-        /*
-         * NaN when exponent = 1024 and mantissa != 0
-         */
-        if (e == 1024 && u.i << 12 != 0) /* nan */
-            return x;
-        u.i &= 1ULL << 63; /* keep the sign */
-        return u.f;
+        t += (unsigned long long)b->limb[i] * m;
+        b->limb[i] = (unsigned long)(t & 0xFFFFFFFFULL);
+        t >>= 32;
     }
 
-    /* no integral part*/
-    if (e < 0)
+    if (t && b->n < 8)
+        b->limb[b->n++] = (unsigned long)t;
+}
+
+static int uss_big_cmp(const uss_bignum *a, const uss_bignum *b)
+{
+    int i;
+
+    if (a->n != b->n)
+        return a->n < b->n ? -1 : 1;
+
+    for (i = a->n - 1; i >= 0; i--)
     {
-        u.i &= 1ULL << 63;
-        *iptr = u.f;
-        return x;
+        if (a->limb[i] != b->limb[i])
+            return a->limb[i] < b->limb[i] ? -1 : 1;
     }
 
-    mask = -1ULL >> 12 >> e;
-    if ((u.i & mask) == 0)
+    return 0;
+}
+
+/*  Compares the non integral double 'x' exactly with the decimal n * 10^k.
+
+    The caller ensures -20 < k < 0.
+
+    \returns -1, 0 or 1 like strcmp().
+*/
+static int uss_cmp_decimal(double x, unsigned long long n, int k)
+{
+    int i;
+    int e;
+    unsigned long long m;
+    union u64f u;
+    uss_bignum a;
+    uss_bignum b;
+
+    u.i = 0;
+    u.f = x;
+
+    m = u.i & USS_DP_SIGNIFICAND_MASK;
+    e = (int)(u.i >> 52 & 0x7ff);
+    if (e)
     {
-        *iptr = x;
-        u.i &= 1ULL << 63;
-        return u.f;
+        m += USS_DP_HIDDEN_BIT;
+        e -= 1075;
     }
-    u.i &= ~mask;
-    *iptr = u.f;
-    return x - u.f;
+    else
+    {
+        e = -1074;
+    }
+
+    /* m * 2^e <> n * 10^k, both e and k are negative: m * 10^-k <> n * 2^-e */
+    uss_big_set(&a, m);
+    for (i = k; i < 0; i++)
+        uss_big_mul(&a, 10);
+
+    uss_big_set(&b, n);
+    for (i = e; i < 0; i++)
+        uss_big_mul(&b, 2);
+
+    return uss_big_cmp(&a, &b);
 }
 
+/*  Outputs 'num' in JSON fixed notation with the shortest digits
+    which read back as the same double, limited to 'precision'
+    fractional digits. Rounding is done on the exact value of 'num'
+    and gives the same digits as printf("%.*f"), exact ties round
+    to even.
+*/
 void U_sstream_put_double(U_SStream *ss, double num, int precision)
 {
-    unsigned i;
-    double ipart;
-    double frac;
-    double prec;
+    int i;
+    int k;
+    int len;
+    int point;
+    int end;
+    int up;
+    int negative;
+    unsigned slack;
+    unsigned long long t;
+    unsigned long long tail;
+    unsigned long long half;
+    char digits[24];
+    char buf[48]; /* sign + 16 integer digits + '.' + 18 fractional digits */
+    unsigned pos;
     long long b;
-    char buf[32];
 
     if (uss_is_nan(num))
     {
@@ -503,48 +786,143 @@ void U_sstream_put_double(U_SStream *ss, double num, int precision)
     if      (precision < 1) precision = 1;
     else if (precision > 18) precision = 18;
 
-    frac = uss_modf(num, &ipart);
-
     /*
      * https://developer.mozilla.org/en-US/docs/Web/JavaScript/Reference/Global_Objects/Number/MIN_SAFE_INTEGER
      */
-    if (ipart > 9007199254740991.0 || ipart < -9007199254740991.0)
+    if (num > 9007199254740991.0 || num < -9007199254740991.0)
     {
         /* error outside of max safe range 2^53-1 */
         ss->status = U_SSTREAM_ERR_RANGE;
         return;
     }
 
-    if (ipart < 0)
+    negative = 0;
+    if (num < 0)
+    {
+        negative = 1;
+        num = -num;
+    }
+
+    if (num == 0) /* also -0 */
+    {
+        uss_put_buf(ss, "0", 1);
+        return;
+    }
+
+    b = (long long)num;
+    if ((double)b == num) /* integral, common for counters */
+    {
+        uss_put_integer(ss, (unsigned long long)b, negative);
+        return;
+    }
+
+    /* digits[0] takes the carry of rounding up */
+    digits[0] = '0';
+    len = uss_grisu2(num, &digits[1], &k) + 1;
+    point = len + k; /* digits before the decimal point */
+
+    end = point + precision;
+
+    if (end < 0)
     {
-        ipart = -ipart;
-        frac = -frac;
-        U_sstream_put_str(ss, "-");
+        len = 0; /* below half of the last kept digit */
+    }
+    else if (end <= len)
+    {
+        /* Round to t = digits[0..end) or a neighbour. The shortest digits
+           are within half an ulp of 'num', with up to 15, 16, 17 significant
+           digits that is below 'slack' tenths of their last digit. They only
+           give the side of the midpoints t +- 1/2 if they are further away,
+           else the exact value is compared. */
+        slack = len <= 16 ? 2 : (len == 17 ? 12 : 112);
+        tail = 0;
+        half = 5;
+        for (i = end; i < len; i++)
+        {
+            tail = tail * 10 + (unsigned long long)(digits[i] - '0');
+            half *= 10;
+        }
+        tail *= 10; /* tenths of the last digit like 'half' */
+
+        if (half >= slack && (tail > half ? tail - half : half - tail) >= slack)
+        {
+            up = tail > half;
+        }
+        else
+        {
+            t = 0;
+            for (i = 0; i < end; i++)
+                t = t * 10 + (unsigned long long)(digits[i] - '0');
+
+            up = 0;
+            k = -precision - 1;
+            i = end > 0 ? uss_cmp_decimal(num, t * 10, k) : 0;
+            if (i > 0)
+            {
+                i = uss_cmp_decimal(num, t * 10 + 5, k);
+                up = i > 0 || (i == 0 && (t & 1));
+            }
+            else if (i < 0)
+            {
+                i = uss_cmp_decimal(num, t * 10 - 5, k);
+                up = i < 0 || (i == 0 && (t & 1)) ? -1 : 0;
+            }
+        }
+
+        len = end;
+        if (up > 0)
+        {
+            for (i = end - 1; i >= 0 && digits[i] == '9'; i--)
+                digits[i] = '0';
+            if (i >= 0)
+                digits[i]++;
+        }
+        else if (up < 0)
+        {
+            for (i = end - 1; i >= 0 && digits[i] == '0'; i--)
+                digits[i] = '9';
+            if (i >= 0)
+                digits[i]--;
+        }
     }
 
-    prec = 10;
+    /* strip trailing zeros of the fraction */
+    for (; len > point && len > 0 && digits[len - 1] == '0'; len--)
+        ;
 
-    b = (long long)ipart;
-    U_sstream_put_longlong(ss, b);
+    for (i = 0; i < len && digits[i] == '0'; i++)
+        ;
 
-    i = 0;
-    buf[i++] = '.';
+    if (i == len) /* rounded to zero, no sign */
+    {
+        uss_put_buf(ss, "0", 1);
+        return;
+    }
 
-    for (;precision && i < sizeof(buf) - 1; precision--)
+    pos = 0;
+    if (negative)
+        buf[pos++] = '-';
+
+    if (i >= point)
     {
-        b = (long long)(frac * prec);
-        b = b % 10;
-        prec *= 10;
-        buf[i++] = b + '0';
+        buf[pos++] = '0';
+    }
+    else
+    {
+        for (; i < point; i++)
+            buf[pos++] = i < len ? digits[i] : '0';
     }
-    buf[i] = '\0';
 
-    /* strip trailing zero and dot */
-    for (; i && (buf[i-1] == '0' || buf[i-1] == '.'); i--)
-        buf[i-1] = '\0';
+    if (len > point)
+    {
+        buf[pos++] = '.';
+        for (i = point; i < 0; i++)
+            buf[pos++] = '0';
+        for (i = point < 0 ? 0 : point; i < len; i++)
+            buf[pos++] = digits[i];
+    }
 
-    if (buf[0])
-        U_sstream_put_str(ss, &buf[0]);
+    uss_put_buf(ss, &buf[0], pos);
 }
 
 static const char _hex_table[16] = {
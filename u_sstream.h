@@ -67,6 +67,9 @@ U_LIBAPI void U_sstream_seek(U_SStream *ss, unsigned pos);
 U_LIBAPI void U_sstream_put_str(U_SStream *ss, const char *str);
 
 /** Limited JSON friendly double to string conversion.
+ *
+ * Prints the shortest digits which read back as the same double in
+ * fixed notation, rounded to \p precision fractional digits.
  *
  * Important: Only the values in range -2^53-1 to 2^53-1 are supported!
  * E.g. [+-]9007199254740991. Values out of this range result in